@@ -0,0 +1,105 @@
+/*  This example measures the serial link to the Amulet module when commissioning a panel.
+ *  It runs linkTest once a minute, which times Set Word and Get Word round trips, Set and
+ *  Get Word Array transfers of increasing size and callScript pings, and checks every value
+ *  it reads back.
+ *  The results are written to InternalRAM words 100 to 111, so a GEMstudio page can show them:
+ *    100 passed (1) or failed (0)    104 largest array, in words     108 retries
+ *    101 min round trip, us          105 frames per second           109 CRC errors
+ *    102 avg round trip, us          106 payload bytes per second/10 110 CRC errors per 10000 frames
+ *    103 max round trip, us          107 avg callScript ping, us     111 mismatches + failures
+ *  On boards with a second serial port, such as the Mega, they are also printed on Serial1.
+
+   linkTest uses InternalRAM words 0 to 31 as scratch space, and calls a GEMscript function
+   named ping on the current page. Add an empty one in GEMstudio:
+   function ping() { }
+*/
+
+#include <AmuletLCD.h>
+
+#define VDP_SIZE 32
+//Virtual Dual Port memory used for communicating with Amulet Display
+uint16_t AmuletWords[VDP_SIZE];
+
+AmuletLCD myModule;
+AmuletLinkTest result;
+
+unsigned long testInterval = 60000;   // run the test once a minute
+unsigned long previousMillis = 0;     // will store last time the test ran
+
+void runTest();
+
+void setup() {
+  //start communication with Amulet Display at default baud
+  myModule.begin(115200);
+  //register our local buffer with Amulet state machine
+  myModule.setWordPointer(AmuletWords, VDP_SIZE);
+#if defined(HAVE_HWSERIAL1)
+  Serial1.begin(115200);
+#endif
+  runTest();
+}
+
+void loop() {
+  if (millis() - previousMillis >= testInterval) {
+    runTest();
+  }
+}
+
+void runTest() {
+  previousMillis = millis();
+  uint8_t passed = myModule.linkTest(&result, 0, 50, "ping");
+
+  //results go to the display one Set Word at a time, so the scratch words are left alone
+  myModule.setWord(100, passed);
+  myModule.setWord(101, min(result.rttMin, 65535UL));
+  myModule.setWord(102, min(result.rttAvg, 65535UL));
+  myModule.setWord(103, min(result.rttMax, 65535UL));
+  myModule.setWord(104, result.arrayCount);
+  myModule.setWord(105, min(result.framesPerSec, 65535UL));
+  myModule.setWord(106, min(result.bytesPerSec / 10, 65535UL));
+  myModule.setWord(107, min(result.scriptAvg, 65535UL));
+  myModule.setWord(108, result.retries);
+  myModule.setWord(109, result.crcErrors);
+  myModule.setWord(110, result.crcErrorRate);
+  myModule.setWord(111, result.mismatches + result.failures);
+
+#if defined(HAVE_HWSERIAL1)
+  Serial1.print(passed ? "linkTest passed at " : "linkTest FAILED at ");
+  Serial1.print(result.baud);
+  Serial1.println(" baud");
+  Serial1.print("  round trip us min ");
+  Serial1.print(result.rttMin);
+  Serial1.print(" avg ");
+  Serial1.print(result.rttAvg);
+  Serial1.print(" max ");
+  Serial1.println(result.rttMax);
+  Serial1.print("  ");
+  Serial1.print(result.arrayCount);
+  Serial1.print(" words per array: ");
+  Serial1.print(result.framesPerSec);
+  Serial1.print(" frames/s, ");
+  Serial1.print(result.bytesPerSec);
+  Serial1.println(" payload bytes/s");
+  Serial1.print("  callScript avg us ");
+  Serial1.print(result.scriptAvg);
+  Serial1.print(" max ");
+  Serial1.println(result.scriptMax);
+  Serial1.print("  ");
+  Serial1.print(result.frames);
+  Serial1.print(" frames, ");
+  Serial1.print(result.retries);
+  Serial1.print(" retries, ");
+  Serial1.print(result.crcErrors);
+  Serial1.print(" CRC errors, ");
+  Serial1.print(result.mismatches);
+  Serial1.print(" mismatches, ");
+  Serial1.print(result.failures);
+  Serial1.println(" failures");
+#endif
+}
+
+//This method automatically gets called if there is any serial data available
+//http://www.arduino.cc/en/Tutorial/SerialEvent
+void serialEvent() {
+  myModule.serialEvent();  //send any incoming data to the Amulet state machine
+}
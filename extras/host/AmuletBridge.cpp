@@ -0,0 +1,714 @@
+/*
+  AmuletBridge.cpp - Batched Get/Set requests from local processes over a Unix domain socket.
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "AmuletBridge.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+
+// AMULET_BRIDGE_GET/SET header after the operation byte: bank, loc, count
+#define BRIDGE_RANGE_HEADER  5
+#define BRIDGE_LISTENER      AMULET_BRIDGE_CLIENTS
+
+static const uint8_t banks[3] = {_GET_BYTE, _GET_WORD, _GET_COLOR};
+
+/**
+* Index of a bank into the bridge arrays, or -1 for anything else. A value of the bank is 1 << index bytes.
+*/
+static int bankIndex(uint8_t bank){
+	for (int i = 0; i < 3; i++){
+		if (banks[i] == bank)
+			return i;
+	}
+	return -1;
+}
+
+AmuletBridge::AmuletBridge(){
+	_lcd = NULL;
+	_events = NULL;
+	_epfd = -1;
+	_listenfd = -1;
+	_path[0] = 0;
+	_hook = NULL;
+	_hookContext = NULL;
+	for (uint8_t i = 0; i < 3; i++){
+		_arrays[i] = NULL;
+		_counts[i] = 0;
+		_seqs[i] = 0;
+	}
+	for (uint8_t c = 0; c < AMULET_BRIDGE_CLIENTS; c++)
+		_clients[c].fd = -1;
+	_opCount = 0;
+	_rounds = 0;
+	_roundOps = 0;
+	_transfers = 0;
+}
+
+AmuletBridge::~AmuletBridge(){
+	close();
+}
+
+/**
+* Listen on a Unix domain socket and serve it from an event loop. The bridge allocates the local
+* arrays of lcd and owns them until close.
+* @param events AmuletEventLoop* begun with lcd
+* @param lcd AmuletLCD* the display, before any traffic
+* @param path const char* socket path. A socket left behind by a bridge that is gone is replaced.
+* @param bytes uint16_t length of the local Byte array, 0 for none
+* @param words uint16_t length of the local Word array
+* @param colors uint16_t length of the local Color array
+* @return int 0 on success, -1 with errno set otherwise. EADDRINUSE if another bridge is listening.
+*/
+int AmuletBridge::begin(AmuletEventLoop * events, AmuletLCD * lcd, const char * path, uint16_t bytes, uint16_t words, uint16_t colors){
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+	uint16_t counts[3] = {bytes, words, colors};
+	close();
+	if (strlen(path) >= sizeof(addr.sun_path) || strlen(path) >= sizeof(_path)){
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (probe >= 0){
+		int running = (connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+		::close(probe);
+		if (running){
+			errno = EADDRINUSE;
+			return -1;
+		}
+	}
+	unlink(path);
+	_listenfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (_listenfd < 0)
+		return -1;
+	if (bind(_listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+		int err = errno;
+		close();
+		errno = err;
+		return -1;
+	}
+	strcpy(_path, path);
+	_epfd = epoll_create1(EPOLL_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.u32 = BRIDGE_LISTENER;
+	if (listen(_listenfd, AMULET_BRIDGE_CLIENTS) != 0 || _epfd < 0 || epoll_ctl(_epfd, EPOLL_CTL_ADD, _listenfd, &ev) != 0
+	    || events->add(_epfd, EPOLLIN, onReady, this) != 0){
+		int err = errno;
+		close();
+		errno = err;
+		return -1;
+	}
+	_events = events;
+
+	for (uint8_t i = 0; i < 3; i++){
+		_arrays[i] = (uint8_t *)calloc(counts[i] ? counts[i] : 1, 1 << i);
+		if (!_arrays[i]){
+			close();
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	_lcd = lcd;
+	#ifndef AMULET_NO_BYTES
+	_counts[0] = bytes;
+	lcd->setBytePointer(_arrays[0], bytes);
+	#endif
+	#ifndef AMULET_NO_WORDS
+	_counts[1] = words;
+	lcd->setWordPointer((uint16_t *)_arrays[1], words);
+	#endif
+	#ifndef AMULET_NO_COLORS
+	_counts[2] = colors;
+	lcd->setColorPointer((uint32_t *)_arrays[2], colors);
+	#endif
+	lcd->setSeqPointers(&_seqs[0], &_seqs[1], &_seqs[2]);
+	return 0;
+}
+
+/**
+* Disconnect every client, stop listening and remove the socket. The local arrays of lcd are
+* given back as empty ones.
+*/
+void AmuletBridge::close(){
+	for (uint8_t c = 0; c < AMULET_BRIDGE_CLIENTS; c++){
+		if (_clients[c].fd >= 0)
+			drop(c);
+	}
+	if (_events && _epfd >= 0)
+		_events->remove(_epfd);
+	_events = NULL;
+	if (_epfd >= 0)
+		::close(_epfd);
+	_epfd = -1;
+	if (_listenfd >= 0)
+		::close(_listenfd);
+	_listenfd = -1;
+	if (_path[0])
+		unlink(_path);
+	_path[0] = 0;
+	if (_lcd){
+		#ifndef AMULET_NO_BYTES
+		_lcd->setBytePointer(NULL, 0);
+		#endif
+		#ifndef AMULET_NO_WORDS
+		_lcd->setWordPointer(NULL, 0);
+		#endif
+		#ifndef AMULET_NO_COLORS
+		_lcd->setColorPointer(NULL, 0);
+		#endif
+		_lcd->setSeqPointers(NULL, NULL, NULL);
+		_lcd = NULL;
+	}
+	for (uint8_t i = 0; i < 3; i++){
+		free(_arrays[i]);
+		_arrays[i] = NULL;
+		_counts[i] = 0;
+	}
+}
+
+/**
+* Set a function called as each client disconnects, with its final statistics. Runs on the event loop.
+* @param hook bridgeHook the function, NULL for none
+* @param context void* passed through to hook
+*/
+void AmuletBridge::setDisconnectHook(bridgeHook hook, void * context){
+	_hook = hook;
+	_hookContext = context;
+}
+
+/**
+* @return uint8_t the number of clients connected
+*/
+uint8_t AmuletBridge::clients(){
+	uint8_t n = 0;
+	for (uint8_t c = 0; c < AMULET_BRIDGE_CLIENTS; c++){
+		if (_clients[c].fd >= 0)
+			n++;
+	}
+	return n;
+}
+
+/**
+* Statistics of one connected client, the same a client gets with AMULET_BRIDGE_STATS.
+* @param client uint8_t slot, 0 to AMULET_BRIDGE_CLIENTS - 1
+* @param stats AmuletBridgeStats* filled in
+* @return uint8_t true if a client is connected in that slot
+*/
+uint8_t AmuletBridge::stats(uint8_t client, AmuletBridgeStats * stats){
+	if (client >= AMULET_BRIDGE_CLIENTS || _clients[client].fd < 0)
+		return false;
+	fill(client, stats);
+	return true;
+}
+
+void AmuletBridge::onReady(int fd, uint32_t events, void * context){
+	((AmuletBridge *)context)->service();
+}
+
+/**
+* Accept new clients, take one packet from each client that has one and run rounds until every
+* packet taken has been answered.
+*/
+void AmuletBridge::service(){
+	struct epoll_event ready[AMULET_BRIDGE_CLIENTS + 1];
+	int n = epoll_wait(_epfd, ready, AMULET_BRIDGE_CLIENTS + 1, 0);
+	for (int k = 0; k < n; k++){
+		uint32_t id = ready[k].data.u32;
+		if (id == BRIDGE_LISTENER)
+			admit();
+		else if (_clients[id].fd >= 0)
+			receive(id);
+	}
+	while (round())
+		;
+}
+
+void AmuletBridge::admit(){
+	struct epoll_event ev;
+	for (;;){
+		int fd = accept4(_listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+		uint8_t c = 0;
+		while (c < AMULET_BRIDGE_CLIENTS && _clients[c].fd >= 0)
+			c++;
+		ev.events = EPOLLIN;
+		ev.data.u32 = c;
+		if (c == AMULET_BRIDGE_CLIENTS || epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) != 0){
+			::close(fd);  //full: the client sees the connection close
+			continue;
+		}
+		Client * cl = &_clients[c];
+		cl->fd = fd;
+		cl->pending = false;
+		cl->taken = false;
+		cl->connected = millis();
+		cl->latencySum = 0;
+		memset(&cl->stats, 0, sizeof(cl->stats));
+		cl->stats.latencyMin = 0xFFFFFFFF;
+	}
+}
+
+/**
+* Read the next packet of a client, unless it still has one waiting for a round.
+*/
+void AmuletBridge::receive(uint8_t client){
+	Client * cl = &_clients[client];
+	if (cl->pending)
+		return;
+	ssize_t n = recv(cl->fd, cl->buffer, AMULET_BRIDGE_MSG, MSG_DONTWAIT | MSG_TRUNC);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n < 2 || n > AMULET_BRIDGE_MSG){  //hung up, or a packet too short or too long to answer
+		drop(client);
+		return;
+	}
+	cl->length = n;
+	cl->pending = true;
+	cl->received = micros();
+	cl->stats.bytesIn += n;
+}
+
+void AmuletBridge::drop(uint8_t client){
+	Client * cl = &_clients[client];
+	if (_hook){
+		AmuletBridgeStats stats;
+		fill(client, &stats);
+		_hook(client, &stats, _hookContext);
+	}
+	epoll_ctl(_epfd, EPOLL_CTL_DEL, cl->fd, NULL);
+	::close(cl->fd);
+	cl->fd = -1;
+	cl->pending = false;
+	cl->taken = false;
+}
+
+/**
+* Add the operations of a client's packet to the round. A packet that does not parse drops the client.
+* @return uint8_t true if they were added, false if they wait for the next round or the client was dropped
+*/
+uint8_t AmuletBridge::parse(uint8_t client){
+	Client * cl = &_clients[client];
+	uint16_t start = _opCount;
+	uint16_t pos = 2;
+	uint32_t replyLength = 2;
+	while (pos < cl->length){
+		if (_opCount >= AMULET_BRIDGE_OPS){
+			_opCount = start;
+			if (start == 0)
+				drop(client);  //more operations than a round holds
+			return false;
+		}
+		Op * op = &_ops[_opCount];
+		op->client = client;
+		op->type = cl->buffer[pos++];
+		op->bank = 0;
+		op->ok = false;
+		op->loc = 0;
+		op->count = 0;
+		op->data = 0;
+		op->reply = 0;
+		uint8_t valid = true;
+		if (op->type == AMULET_BRIDGE_GET || op->type == AMULET_BRIDGE_SET){
+			int b = (pos + BRIDGE_RANGE_HEADER <= cl->length) ? bankIndex(cl->buffer[pos]) : -1;
+			if (b < 0){
+				valid = false;
+			}
+			else{
+				op->bank = b;
+				memcpy(&op->loc, cl->buffer + pos + 1, 2);
+				memcpy(&op->count, cl->buffer + pos + 3, 2);
+				pos += BRIDGE_RANGE_HEADER;
+				uint32_t bytes = (uint32_t)op->count << b;
+				op->ok = (op->count > 0) && ((uint32_t)op->loc + op->count <= _counts[b]);
+				if (op->type == AMULET_BRIDGE_SET){
+					valid = (pos + bytes <= cl->length);
+					op->data = pos;
+					pos += bytes;
+				}
+				else if (op->ok && (replyLength + 1 + bytes <= AMULET_BRIDGE_MSG)){
+					replyLength += bytes;
+				}
+				else{
+					op->ok = false;
+				}
+			}
+		}
+		else if (op->type == AMULET_BRIDGE_SCRIPT){
+			uint8_t length = (pos < cl->length) ? cl->buffer[pos] : 0;
+			valid = (pos + 1 + length <= cl->length);
+			op->data = pos + 1;
+			op->count = length;
+			op->ok = (length > 0) && (length <= 32);
+			pos += 1 + length;
+			replyLength += 4;
+		}
+		else if (op->type == AMULET_BRIDGE_STATS){
+			op->ok = true;
+			replyLength += sizeof(AmuletBridgeStats);
+		}
+		else{
+			valid = false;
+		}
+		replyLength++;
+		if (!valid || replyLength > AMULET_BRIDGE_MSG){
+			_opCount = start;
+			drop(client);
+			return false;
+		}
+		_opCount++;
+	}
+	cl->firstOp = start;
+	cl->opCount = _opCount - start;
+	cl->taken = true;
+	return true;
+}
+
+/**
+* Run the packets taken from the clients as one round and answer them.
+* @return uint8_t true if any packet was run
+*/
+uint8_t AmuletBridge::round(){
+	uint8_t taken = 0;
+	_opCount = 0;
+	for (uint8_t c = 0; c < AMULET_BRIDGE_CLIENTS; c++){
+		if (_clients[c].fd >= 0 && _clients[c].pending && parse(c))
+			taken++;
+	}
+	if (!taken)
+		return false;
+
+	for (uint16_t i = 0; i < _opCount; i++){
+		Op * op = &_ops[i];
+		if (op->type != AMULET_BRIDGE_SET || !op->ok)
+			continue;
+		_seqs[op->bank]++;
+		AMULET_BARRIER();
+		memcpy(_arrays[op->bank] + ((uint32_t)op->loc << op->bank), _clients[op->client].buffer + op->data, (uint32_t)op->count << op->bank);
+		AMULET_BARRIER();
+		_seqs[op->bank]++;
+	}
+	runs(AMULET_BRIDGE_SET);
+	for (uint16_t i = 0; i < _opCount; i++){
+		Op * op = &_ops[i];
+		if (op->type != AMULET_BRIDGE_SCRIPT || !op->ok)
+			continue;
+		#ifndef AMULET_NO_GEMSCRIPT
+		char name[33];
+		memcpy(name, _clients[op->client].buffer + op->data, op->count);
+		name[op->count] = 0;
+		op->ok = (_lcd->callScript(name) == true);
+		op->reply = _lcd->scriptReply();
+		_transfers++;
+		#else
+		op->ok = false;
+		#endif
+	}
+	runs(AMULET_BRIDGE_GET);
+
+	_rounds++;
+	_roundOps += _opCount;
+	for (uint8_t c = 0; c < AMULET_BRIDGE_CLIENTS; c++){
+		if (_clients[c].fd >= 0 && _clients[c].taken)
+			reply(c);
+	}
+	return true;
+}
+
+/**
+* Send the Set or Get operations of the round, each run of a bank with one transfer. Sets are
+* merged when they overlap or touch, gets also across gaps of up to AMULET_BRIDGE_GAP variables.
+* @param type uint8_t AMULET_BRIDGE_SET or AMULET_BRIDGE_GET
+*/
+void AmuletBridge::runs(uint8_t type){
+	uint16_t n = 0;
+	uint32_t gap = (type == AMULET_BRIDGE_GET) ? AMULET_BRIDGE_GAP : 0;
+	for (uint16_t i = 0; i < _opCount; i++){
+		if (_ops[i].type == type && _ops[i].ok)
+			_order[n++] = i;
+	}
+	std::sort(_order, _order + n, [this](uint16_t a, uint16_t b){
+		return (_ops[a].bank != _ops[b].bank) ? (_ops[a].bank < _ops[b].bank) : (_ops[a].loc < _ops[b].loc);
+	});
+	for (uint16_t i = 0; i < n; ){
+		uint8_t bank = _ops[_order[i]].bank;
+		uint32_t lo = _ops[_order[i]].loc;
+		uint32_t hi = lo + _ops[_order[i]].count;
+		uint16_t j = i + 1;
+		while (j < n && _ops[_order[j]].bank == bank && _ops[_order[j]].loc <= hi + gap){
+			hi = std::max(hi, (uint32_t)_ops[_order[j]].loc + _ops[_order[j]].count);
+			j++;
+		}
+		uint8_t ok = (type == AMULET_BRIDGE_SET) ? _lcd->pushRange(banks[bank], lo, hi - lo) : _lcd->pullRange(banks[bank], lo, hi - lo);
+		_transfers++;
+		for (; i < j; i++)
+			_ops[_order[i]].ok = ok;
+	}
+}
+
+/**
+* Answer the packet a client had in the round, and update its statistics.
+*/
+void AmuletBridge::reply(uint8_t client){
+	Client * cl = &_clients[client];
+	uint16_t pos = 2;
+	memcpy(_reply, cl->buffer, 2);  //tag
+	for (uint16_t i = cl->firstOp; i < cl->firstOp + cl->opCount; i++){
+		Op * op = &_ops[i];
+		_reply[pos++] = op->ok;
+		if (!op->ok)
+			cl->stats.failures++;
+		if (op->type == AMULET_BRIDGE_GET && op->ok){
+			uint16_t bytes = op->count << op->bank;
+			memcpy(_reply + pos, _arrays[op->bank] + ((uint32_t)op->loc << op->bank), bytes);
+			pos += bytes;
+		}
+		else if (op->type == AMULET_BRIDGE_SCRIPT){
+			memcpy(_reply + pos, &op->reply, 4);
+			pos += 4;
+		}
+		else if (op->type == AMULET_BRIDGE_STATS){
+			AmuletBridgeStats stats;
+			fill(client, &stats);
+			memcpy(_reply + pos, &stats, sizeof(stats));
+			pos += sizeof(stats);
+		}
+	}
+	cl->pending = false;
+	cl->taken = false;
+	ssize_t sent = send(cl->fd, _reply, pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+	uint32_t us = micros() - cl->received;
+	cl->stats.packets++;
+	cl->stats.ops += cl->opCount;
+	cl->stats.bytesOut += pos;
+	cl->latencySum += us;
+	if (us < cl->stats.latencyMin)
+		cl->stats.latencyMin = us;
+	if (us > cl->stats.latencyMax)
+		cl->stats.latencyMax = us;
+	if (sent != pos)
+		drop(client);  //gone, or not reading its replies
+}
+
+void AmuletBridge::fill(uint8_t client, AmuletBridgeStats * stats){
+	Client * cl = &_clients[client];
+	*stats = cl->stats;
+	if (stats->packets){
+		stats->latencyAvg = cl->latencySum / stats->packets;
+	}
+	else{
+		stats->latencyMin = 0;
+	}
+	stats->connectedMs = millis() - cl->connected;
+	stats->rounds = _rounds;
+	stats->roundOps = _roundOps;
+	stats->transfers = _transfers;
+}
+
+AmuletBridgeClient::AmuletBridgeClient(){
+	_fd = -1;
+	_tag = 0;
+	begin();
+}
+
+AmuletBridgeClient::~AmuletBridgeClient(){
+	close();
+}
+
+/**
+* Connect to a bridge.
+* @param path const char* the socket path given to AmuletBridge::begin
+* @return int 0 on success, -1 with errno set otherwise
+*/
+int AmuletBridgeClient::open(const char * path){
+	struct sockaddr_un addr;
+	close();
+	if (strlen(path) >= sizeof(addr.sun_path)){
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (_fd < 0)
+		return -1;
+	if (connect(_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+		int err = errno;
+		close();
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+void AmuletBridgeClient::close(){
+	if (_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+}
+
+/**
+* Start a new batch. Call it before adding the operations of each batch.
+*/
+void AmuletBridgeClient::begin(){
+	_length = 2;
+	_replyLength = 2;
+	_opCount = 0;
+}
+
+uint8_t AmuletBridgeClient::add(uint8_t type, uint16_t request, uint16_t reply, void * out){
+	if (_opCount >= sizeof(_ops) / sizeof(_ops[0]) || _length + 1 + request > AMULET_BRIDGE_MSG
+	    || _replyLength + 1 + reply > AMULET_BRIDGE_MSG)
+		return false;
+	_ops[_opCount].type = type;
+	_ops[_opCount].ok = false;
+	_ops[_opCount].length = reply;
+	_ops[_opCount].out = out;
+	_opCount++;
+	_buffer[_length++] = type;
+	_replyLength += 1 + reply;
+	return true;
+}
+
+/**
+* Add reading a range of a bank from the display to the batch.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param loc uint16_t first variable
+* @param count uint16_t number of variables
+* @param values void* uint8_t, uint16_t or uint32_t array to match bank, filled by transact if the operation succeeds
+* @return uint8_t true if it was added, false if bank is not valid or the batch is full
+*/
+uint8_t AmuletBridgeClient::get(uint8_t bank, uint16_t loc, uint16_t count, void * values){
+	int b = bankIndex(bank);
+	if (b < 0 || ((uint32_t)count << b) > AMULET_BRIDGE_MSG || !add(AMULET_BRIDGE_GET, BRIDGE_RANGE_HEADER, count << b, values))
+		return false;
+	_buffer[_length] = bank;
+	memcpy(_buffer + _length + 1, &loc, 2);
+	memcpy(_buffer + _length + 3, &count, 2);
+	_length += BRIDGE_RANGE_HEADER;
+	return true;
+}
+
+/**
+* Add writing a range of a bank to the display to the batch.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param loc uint16_t first variable
+* @param count uint16_t number of variables
+* @param values const void* uint8_t, uint16_t or uint32_t array to match bank, copied into the batch
+* @return uint8_t true if it was added, false if bank is not valid or the batch is full
+*/
+uint8_t AmuletBridgeClient::set(uint8_t bank, uint16_t loc, uint16_t count, const void * values){
+	int b = bankIndex(bank);
+	if (b < 0 || ((uint32_t)count << b) > AMULET_BRIDGE_MSG || !add(AMULET_BRIDGE_SET, BRIDGE_RANGE_HEADER + (count << b), 0, NULL))
+		return false;
+	_buffer[_length] = bank;
+	memcpy(_buffer + _length + 1, &loc, 2);
+	memcpy(_buffer + _length + 3, &count, 2);
+	memcpy(_buffer + _length + BRIDGE_RANGE_HEADER, values, count << b);
+	_length += BRIDGE_RANGE_HEADER + (count << b);
+	return true;
+}
+
+/**
+* Add a GEMscript call to the batch.
+* @param fname const char* function name, up to 32 characters
+* @param reply int32_t* the value the function returned, set by transact. NULL if not needed.
+* @return uint8_t true if it was added, false if fname is too long or the batch is full
+*/
+uint8_t AmuletBridgeClient::callScript(const char * fname, int32_t * reply){
+	size_t length = strlen(fname);
+	if (length == 0 || length > 32 || !add(AMULET_BRIDGE_SCRIPT, 1 + length, 4, reply))
+		return false;
+	_buffer[_length++] = length;
+	memcpy(_buffer + _length, fname, length);
+	_length += length;
+	return true;
+}
+
+/**
+* Add a request for this client's statistics and the bridge totals to the batch.
+* @param stats AmuletBridgeStats* filled in by transact
+* @return uint8_t true if it was added
+*/
+uint8_t AmuletBridgeClient::stats(AmuletBridgeStats * stats){
+	return add(AMULET_BRIDGE_STATS, 0, sizeof(AmuletBridgeStats), stats);
+}
+
+/**
+* Send the batch and wait for its reply. Call begin before adding the next batch.
+* @param timeoutMs int how long to wait for the reply
+* @return int the number of operations that succeeded, see ok. -1 with errno set if the bridge
+* could not be reached or did not answer in time.
+*/
+int AmuletBridgeClient::transact(int timeoutMs){
+	struct pollfd pfd;
+	ssize_t n;
+	int succeeded = 0;
+	if (_fd < 0){
+		errno = ENOTCONN;
+		return -1;
+	}
+	_tag++;
+	memcpy(_buffer, &_tag, 2);
+	if (send(_fd, _buffer, _length, MSG_NOSIGNAL) != _length)
+		return -1;
+	do {
+		pfd.fd = _fd;
+		pfd.events = POLLIN;
+		int ready = poll(&pfd, 1, timeoutMs);
+		if (ready <= 0){
+			if (ready == 0)
+				errno = ETIMEDOUT;
+			return -1;
+		}
+		n = recv(_fd, _buffer, AMULET_BRIDGE_MSG, 0);
+		if (n <= 0){
+			if (n == 0)
+				errno = ECONNRESET;
+			return -1;
+		}
+	} while (n < 2 || memcmp(_buffer, &_tag, 2) != 0);  //a late reply to a batch that timed out
+
+	uint16_t pos = 2;
+	for (uint8_t i = 0; i < _opCount; i++){
+		Op * op = &_ops[i];
+		if (pos >= n){
+			errno = EPROTO;
+			return -1;
+		}
+		op->ok = _buffer[pos++];
+		if (op->type == AMULET_BRIDGE_GET && !op->ok)
+			continue;
+		if (pos + op->length > n){
+			errno = EPROTO;
+			return -1;
+		}
+		if (op->out)
+			memcpy(op->out, _buffer + pos, op->length);
+		pos += op->length;
+		if (op->ok)
+			succeeded++;
+	}
+	return succeeded;
+}
+
+/**
+* @param op uint8_t operation of the last batch, in the order it was added
+* @return uint8_t true if it succeeded
+*/
+uint8_t AmuletBridgeClient::ok(uint8_t op){
+	return (op < _opCount) ? _ops[op].ok : false;
+}
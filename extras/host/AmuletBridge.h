@@ -0,0 +1,216 @@
+/*
+  AmuletBridge.h - Batched Get/Set requests from local processes over a Unix domain socket
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  AmuletBridge serves the display to processes that can not map AmuletShared memory. It listens
+  on a SOCK_SEQPACKET Unix domain socket from an AmuletEventLoop. Each packet from a client is a
+  batch of operations and gets one reply packet. The bridge takes one packet from every client
+  that has one ready, then runs them together as a round:
+    1. Set values are stored in the local arrays, in arrival order, and every run of
+       overlapping or neighbouring variables of a bank is sent with one pushRange.
+    2. GEMscript calls are made in arrival order.
+    3. Get ranges closer than AMULET_BRIDGE_GAP variables are merged and read with one pullRange.
+  Packets that arrive while a round is on the wire are merged into the next one, so the frames
+  on the UART get longer, not more numerous, as clients are added.
+
+  Packet format, host byte order, no padding:
+    request  tag:2 op...                  reply  tag:2 result...
+    AMULET_BRIDGE_GET     bank:1 loc:2 count:2          -> ok:1 value * count (only if ok)
+    AMULET_BRIDGE_SET     bank:1 loc:2 count:2 value * count  -> ok:1
+    AMULET_BRIDGE_SCRIPT  length:1 name                 -> ok:1 reply:4
+    AMULET_BRIDGE_STATS                                 -> ok:1 AmuletBridgeStats
+  bank is _GET_BYTE, _GET_WORD or _GET_COLOR, and values are 1, 2 or 4 bytes to match. A packet
+  that does not parse closes the connection.
+
+  Daemon:
+    AmuletBridge bridge;
+    events.begin(&myModule);
+    bridge.begin(&events, &myModule, "/run/amulet.sock", 256, 256, 64);
+    events.run();
+
+  Client:
+    AmuletBridgeClient c;
+    c.open("/run/amulet.sock");
+    uint16_t levels[8];
+    c.begin();
+    c.set(_GET_WORD, 3, 1, &alarm);
+    c.get(_GET_WORD, 10, 8, levels);
+    c.transact();                   //2 if both succeeded
+
+  extras/host/amulet_bridge is a ready made daemon, and amulet_bench -u drives it.
+ */
+
+#ifndef AmuletBridge_h
+#define AmuletBridge_h
+
+#include "AmuletLCD.h"
+#include "AmuletEventLoop.h"
+
+// Operations in a packet
+#define AMULET_BRIDGE_GET      0x01
+#define AMULET_BRIDGE_SET      0x02
+#define AMULET_BRIDGE_SCRIPT   0x03
+#define AMULET_BRIDGE_STATS    0x04
+
+// Longest request or reply packet, in bytes
+#ifndef AMULET_BRIDGE_MSG
+#define AMULET_BRIDGE_MSG      4096
+#endif
+// Clients connected at once
+#ifndef AMULET_BRIDGE_CLIENTS
+#define AMULET_BRIDGE_CLIENTS  16
+#endif
+// Operations in a round, from all clients. Also the most in one packet.
+#ifndef AMULET_BRIDGE_OPS
+#define AMULET_BRIDGE_OPS      256
+#endif
+// Get ranges this many variables apart or closer are read together
+#ifndef AMULET_BRIDGE_GAP
+#define AMULET_BRIDGE_GAP      8
+#endif
+
+/**
+* struct answered to AMULET_BRIDGE_STATS and passed to the disconnect hook. Latencies are in us,
+* from receiving a packet to sending its reply.
+*/
+typedef struct {
+	uint32_t packets;      //request packets answered
+	uint32_t ops;          //operations in them
+	uint32_t failures;     //operations that failed
+	uint32_t bytesIn;
+	uint32_t bytesOut;
+	uint32_t latencyMin;
+	uint32_t latencyAvg;
+	uint32_t latencyMax;
+	uint32_t connectedMs;
+	uint32_t rounds;       //bridge totals, every client: rounds run
+	uint32_t roundOps;     //operations run in them
+	uint32_t transfers;    //pushRange, pullRange and callScript calls they took
+} AmuletBridgeStats;
+
+/**
+* typedef used by AmuletBridge::setDisconnectHook.
+*/
+typedef void (* bridgeHook) (uint8_t client, const AmuletBridgeStats * stats, void * context);
+
+/**
+* A class used to serve Get/Set/GEMscript batches from other processes over a Unix domain socket.
+*/
+class AmuletBridge
+{
+  public:
+	AmuletBridge();
+	~AmuletBridge();
+	int begin(AmuletEventLoop * events, AmuletLCD * lcd, const char * path, uint16_t bytes, uint16_t words, uint16_t colors);
+	void close();
+	void setDisconnectHook(bridgeHook hook, void * context);
+	uint8_t clients();
+	uint8_t stats(uint8_t client, AmuletBridgeStats * stats);
+
+  private:
+	struct Op {
+		uint8_t  client;
+		uint8_t  type;
+		uint8_t  bank;    //index into _arrays
+		uint8_t  ok;
+		uint16_t loc;
+		uint16_t count;
+		uint16_t data;    //offset of the values or the script name in the client's packet
+		int32_t  reply;
+	};
+	struct Client {
+		int      fd;
+		uint8_t  pending;  //a packet is in buffer
+		uint8_t  taken;    //its operations are in the current round
+		uint16_t length;
+		uint16_t firstOp;
+		uint16_t opCount;
+		unsigned long received;
+		unsigned long connected;
+		uint64_t latencySum;
+		AmuletBridgeStats stats;
+		uint8_t  buffer[AMULET_BRIDGE_MSG];
+	};
+
+	static void onReady(int fd, uint32_t events, void * context);
+	void service();
+	void admit();
+	void receive(uint8_t client);
+	void drop(uint8_t client);
+	uint8_t parse(uint8_t client);
+	uint8_t round();
+	void runs(uint8_t type);
+	void reply(uint8_t client);
+	void fill(uint8_t client, AmuletBridgeStats * stats);
+
+	AmuletLCD * _lcd;
+	AmuletEventLoop * _events;
+	int _epfd;
+	int _listenfd;
+	char _path[108];
+	bridgeHook _hook;
+	void * _hookContext;
+	uint8_t * _arrays[3];
+	uint16_t _counts[3];
+	volatile amulet_seq_t _seqs[3];
+	Client _clients[AMULET_BRIDGE_CLIENTS];
+	Op _ops[AMULET_BRIDGE_OPS];
+	uint16_t _order[AMULET_BRIDGE_OPS];
+	uint16_t _opCount;
+	uint32_t _rounds;
+	uint32_t _roundOps;
+	uint32_t _transfers;
+	uint8_t _reply[AMULET_BRIDGE_MSG];
+};
+
+/**
+* A class used to send batches to an AmuletBridge from another process.
+*/
+class AmuletBridgeClient
+{
+  public:
+	AmuletBridgeClient();
+	~AmuletBridgeClient();
+	int open(const char * path);
+	void close();
+	void begin();
+	uint8_t get(uint8_t bank, uint16_t loc, uint16_t count, void * values);
+	uint8_t set(uint8_t bank, uint16_t loc, uint16_t count, const void * values);
+	uint8_t callScript(const char * fname, int32_t * reply = NULL);
+	uint8_t stats(AmuletBridgeStats * stats);
+	int transact(int timeoutMs = 1000);
+	uint8_t ok(uint8_t op);
+
+  private:
+	struct Op {
+		uint8_t  type;
+		uint8_t  ok;
+		uint16_t length;  //reply bytes after ok
+		void *   out;
+	};
+	uint8_t add(uint8_t type, uint16_t request, uint16_t reply, void * out);
+
+	int _fd;
+	uint16_t _tag;
+	uint16_t _length;
+	uint16_t _replyLength;
+	uint8_t _opCount;
+	Op _ops[AMULET_BRIDGE_OPS < 255 ? AMULET_BRIDGE_OPS : 255];
+	uint8_t _buffer[AMULET_BRIDGE_MSG];
+};
+
+#endif
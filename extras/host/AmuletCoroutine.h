@@ -0,0 +1,194 @@
+/*
+  AmuletCoroutine.h - C++20 coroutine interface to AmuletIOThread
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  Lets one UI transaction with several dependent round trips read top to bottom:
+
+    AmuletTask alarm(AmuletAsync & lcd){
+      AmuletResult level = co_await lcd.requestWord(5);
+      if (level.ok && level.value > 800){
+        co_await lcd.setColor(2, 0xFFFF0000);
+        co_await lcd.callScript("flashAlarm");
+      }
+    }
+    ...
+    AmuletAsync lcd(io);   //io is a running AmuletIOThread
+    alarm(lcd);            //runs until the first co_await, then continues on the I/O thread
+
+  Each co_await suspends on one request and is resumed by the I/O thread when the display
+  answers. The awaiter embeds its AmuletRequest, so awaiting allocates nothing. Coroutine
+  frames come from a fixed pool of AMULET_CO_FRAMES blocks of AMULET_CO_FRAME_LEN bytes,
+  falling back to the heap only when the pool is empty or a frame is larger.
+
+  Needs -std=c++20 (or -fcoroutines on GCC 10). Without coroutine support this header is empty.
+ */
+
+#ifndef AmuletCoroutine_h
+#define AmuletCoroutine_h
+
+#if defined(__cpp_impl_coroutine)
+
+#include "AmuletIOThread.h"
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <new>
+
+// Frame pool for AmuletTask coroutines
+#ifndef AMULET_CO_FRAMES
+#define AMULET_CO_FRAMES     32
+#endif
+#ifndef AMULET_CO_FRAME_LEN
+#define AMULET_CO_FRAME_LEN  512
+#endif
+
+/**
+* Fixed pool of coroutine frames shared by all AmuletTask coroutines.
+* Frames are usually taken on the caller's thread and returned on the I/O thread, hence the lock.
+*/
+class AmuletFramePool
+{
+  public:
+	static void * allocate(size_t size){
+		AmuletFramePool & pool = instance();
+		if (size <= AMULET_CO_FRAME_LEN){
+			std::lock_guard<std::mutex> hold(pool._lock);
+			if (pool._free){
+				Block * block = pool._free;
+				pool._free = block->next;
+				return block;
+			}
+		}
+		return ::operator new(size);
+	}
+	static void release(void * frame){
+		AmuletFramePool & pool = instance();
+		Block * block = (Block *)frame;
+		if (block >= pool._blocks && block < pool._blocks + AMULET_CO_FRAMES){
+			std::lock_guard<std::mutex> hold(pool._lock);
+			block->next = pool._free;
+			pool._free = block;
+			return;
+		}
+		::operator delete(frame);
+	}
+
+  private:
+	union Block {
+		Block * next;
+		alignas(std::max_align_t) unsigned char frame[AMULET_CO_FRAME_LEN];
+	};
+	AmuletFramePool(){
+		_free = NULL;
+		for (int i = AMULET_CO_FRAMES - 1; i >= 0; i--){
+			_blocks[i].next = _free;
+			_free = &_blocks[i];
+		}
+	}
+	static AmuletFramePool & instance(){
+		static AmuletFramePool pool;
+		return pool;
+	}
+	std::mutex _lock;
+	Block * _free;
+	Block _blocks[AMULET_CO_FRAMES];
+};
+
+/**
+* Return type of a coroutine that talks to the display. Starts at once and runs to completion
+* on its own; the frame is freed when it finishes. Nothing waits for it.
+*/
+struct AmuletTask {
+	struct promise_type {
+		AmuletTask get_return_object(){ return AmuletTask(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void(){}
+		void unhandled_exception(){ std::terminate(); }
+		static void * operator new(size_t size){ return AmuletFramePool::allocate(size); }
+		static void operator delete(void * frame){ AmuletFramePool::release(frame); }
+	};
+};
+
+/**
+* Awaiter for one request. Lives in the awaiting coroutine's frame while it is suspended.
+*/
+class AmuletAwaitable
+{
+  public:
+	AmuletAwaitable(AmuletIOThread & io, uint8_t opcode, uint16_t loc, uint32_t value, const char * script) : _io(io){
+		_request.opcode = opcode;
+		_request.lane = AMULET_LANE_URGENT;
+		_request.loc = loc;
+		_request.value = value;
+		_request.script = script;
+		_request.callback = resume;
+		_request.context = this;
+	}
+	bool await_ready(){ return false; }
+	void await_suspend(std::coroutine_handle<> handle){
+		_handle = handle;
+		_io.submit(&_request);  //may resume on the I/O thread before this returns, so nothing after it
+	}
+	AmuletResult await_resume(){ return _result; }
+
+  private:
+	static void resume(AmuletResult result, void * context){
+		AmuletAwaitable * self = (AmuletAwaitable *)context;
+		self->_result = result;
+		self->_handle.resume();
+	}
+	AmuletIOThread & _io;
+	AmuletRequest _request;
+	AmuletResult _result;
+	std::coroutine_handle<> _handle;
+};
+
+/**
+* Awaitable versions of the AmuletLCD requests, run through an AmuletIOThread.
+* Array requests move data between the display and the local arrays, like the AmuletLCD versions.
+*/
+class AmuletAsync
+{
+  public:
+	AmuletAsync(AmuletIOThread & io) : _io(io) {}
+
+	AmuletAwaitable setByte(uint16_t loc, uint8_t value)   { return AmuletAwaitable(_io, _SET_BYTE, loc, value, NULL); }
+	AmuletAwaitable setWord(uint16_t loc, uint16_t value)  { return AmuletAwaitable(_io, _SET_WORD, loc, value, NULL); }
+	AmuletAwaitable setColor(uint16_t loc, uint32_t value) { return AmuletAwaitable(_io, _SET_COLOR, loc, value, NULL); }
+	AmuletAwaitable setBytes(uint16_t start, uint8_t count)  { return AmuletAwaitable(_io, _SET_BYTE_ARRAY, start, count, NULL); }
+	AmuletAwaitable setWords(uint16_t start, uint8_t count)  { return AmuletAwaitable(_io, _SET_WORD_ARRAY, start, count, NULL); }
+	AmuletAwaitable setColors(uint16_t start, uint8_t count) { return AmuletAwaitable(_io, _SET_COLOR_ARRAY, start, count, NULL); }
+
+	AmuletAwaitable requestByte(uint16_t loc)  { return AmuletAwaitable(_io, _GET_BYTE, loc, 0, NULL); }
+	AmuletAwaitable requestWord(uint16_t loc)  { return AmuletAwaitable(_io, _GET_WORD, loc, 0, NULL); }
+	AmuletAwaitable requestColor(uint16_t loc) { return AmuletAwaitable(_io, _GET_COLOR, loc, 0, NULL); }
+	AmuletAwaitable requestBytes(uint16_t start, uint8_t count)  { return AmuletAwaitable(_io, _GET_BYTE_ARRAY, start, count, NULL); }
+	AmuletAwaitable requestWords(uint16_t start, uint8_t count)  { return AmuletAwaitable(_io, _GET_WORD_ARRAY, start, count, NULL); }
+	AmuletAwaitable requestColors(uint16_t start, uint8_t count) { return AmuletAwaitable(_io, _GET_COLOR_ARRAY, start, count, NULL); }
+
+	// fname must stay valid until the call completes, e.g. a literal or a local of the coroutine
+	AmuletAwaitable callScript(const char * fname) { return AmuletAwaitable(_io, _INVOKE_GEMSCRIPT, 0, 0, fname); }
+
+  private:
+	AmuletIOThread & _io;
+};
+
+#endif // __cpp_impl_coroutine
+
+#endif
@@ -0,0 +1,145 @@
+/*
+  AmuletEventLoop.cpp - epoll loop driving AmuletLCD on a Linux host.
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "AmuletEventLoop.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+AmuletEventLoop::AmuletEventLoop(){
+	_epfd = -1;
+	_lcd = NULL;
+	_running = false;
+	for (uint8_t i = 0; i < AMULET_HOST_MAX_FDS; i++)
+		_handlers[i].fd = -1;
+}
+
+AmuletEventLoop::~AmuletEventLoop(){
+	if (_epfd >= 0)
+		close(_epfd);
+}
+
+/**
+* Create the epoll instance and watch the serial port. Serial must already be open.
+* @param lcd AmuletLCD* the state machine fed from the port
+* @return int 0 on success, -1 with errno set otherwise
+*/
+int AmuletEventLoop::begin(AmuletLCD * lcd){
+	struct epoll_event ev;
+	_lcd = lcd;
+	if (_epfd < 0)
+		_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epfd < 0)
+		return -1;
+	ev.events = EPOLLIN;
+	ev.data.fd = Serial.fd();
+	if (epoll_ctl(_epfd, EPOLL_CTL_ADD, Serial.fd(), &ev) != 0 && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+/**
+* Watch another descriptor, e.g. a socket or timerfd, calling back from runOnce when it is ready.
+* @param fd int the descriptor
+* @param events uint32_t EPOLLIN, EPOLLOUT, ...
+* @param callback eventCallback called with the events that fired
+* @param context void* passed through to callback
+* @return int 0 on success, -1 if the table is full or epoll_ctl fails
+*/
+int AmuletEventLoop::add(int fd, uint32_t events, eventCallback callback, void * context){
+	struct epoll_event ev;
+	for (uint8_t i = 0; i < AMULET_HOST_MAX_FDS; i++){
+		if (_handlers[i].fd < 0){
+			ev.events = events;
+			ev.data.fd = fd;
+			if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+				return -1;
+			_handlers[i].fd = fd;
+			_handlers[i].callback = callback;
+			_handlers[i].context = context;
+			return 0;
+		}
+	}
+	errno = ENOSPC;
+	return -1;
+}
+
+/**
+* Stop watching a descriptor added with add.
+* @return int 0 on success, -1 if fd was not added
+*/
+int AmuletEventLoop::remove(int fd){
+	for (uint8_t i = 0; i < AMULET_HOST_MAX_FDS; i++){
+		if (_handlers[i].fd == fd){
+			epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
+			_handlers[i].fd = -1;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+* Wait up to timeoutMs for the port or another descriptor, then handle whatever is ready.
+* Serial data is read in one chunk per read() call and parsed straight from the receive buffer.
+* Frames batched by setTxBatchPointer are written before going to sleep.
+* @param timeoutMs int how long to sleep if nothing is ready, -1 for no limit
+* @return int number of ready descriptors, 0 on timeout, -1 if the port hung up or epoll failed
+*/
+int AmuletEventLoop::runOnce(int timeoutMs){
+	struct epoll_event events[AMULET_HOST_MAX_FDS + 1];
+	#ifndef AMULET_NO_TX_BATCH
+	_lcd->flush();
+	#endif
+	int n = epoll_wait(_epfd, events, AMULET_HOST_MAX_FDS + 1, timeoutMs);
+	if (n < 0)
+		return (errno == EINTR) ? 0 : -1;
+	for (int k = 0; k < n; k++){
+		int fd = events[k].data.fd;
+		if (fd == Serial.fd()){
+			if (Serial.fill() < 0)
+				return -1;
+			_lcd->serialEvent();
+			continue;
+		}
+		for (uint8_t i = 0; i < AMULET_HOST_MAX_FDS; i++){
+			if (_handlers[i].fd == fd){
+				_handlers[i].callback(fd, events[k].events, _handlers[i].context);
+				break;
+			}
+		}
+	}
+	return n;
+}
+
+/**
+* Handle events until stop() is called or the port hangs up.
+* The polling scheduler and the link monitor are given a chance to run at least every tickMs.
+* @param tickMs int longest sleep between pollUpdate calls
+* @return int 0 after stop(), -1 on hangup or error
+*/
+int AmuletEventLoop::run(int tickMs){
+	_running = true;
+	while (_running){
+		if (runOnce(tickMs) < 0){
+			_running = false;
+			return -1;
+		}
+		#ifndef AMULET_NO_POLLING
+		_lcd->pollUpdate();
+		#endif
+		#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+		_lcd->checkLink();
+		#endif
+	}
+	return 0;
+}
+
+/**
+* Make run() return after the current pass. Call from a callback or a signal handler.
+*/
+void AmuletEventLoop::stop(){
+	_running = false;
+}
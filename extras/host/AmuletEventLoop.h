@@ -0,0 +1,75 @@
+/*
+  AmuletEventLoop.h - epoll loop driving AmuletLCD on a Linux host
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  Takes the place of loop() + serialEvent() on a gateway. The loop sleeps in epoll_wait until the
+  port is readable, reads everything the kernel has in one read() call and runs the parser over it.
+  Other descriptors (sockets, timerfds) can be added with their own callbacks.
+
+  Example:
+    AmuletLCD myModule;
+    AmuletEventLoop events;
+    Serial.open("/dev/ttyS1");
+    myModule.begin(115200);
+    myModule.setWordPointer(AmuletWords, 32);
+    events.begin(&myModule);
+    events.run();
+ */
+
+#ifndef AmuletEventLoop_h
+#define AmuletEventLoop_h
+
+#include "AmuletLCD.h"
+
+// Descriptors the loop can watch besides the serial port
+#ifndef AMULET_HOST_MAX_FDS
+#define AMULET_HOST_MAX_FDS  8
+#endif
+
+/**
+* typedef used by AmuletEventLoop::add. events holds the EPOLLIN/EPOLLOUT/... bits that fired.
+*/
+typedef void (* eventCallback) (int fd, uint32_t events, void * context);
+
+/**
+* A class used to run the Amulet state machine from epoll on a Linux host.
+*/
+class AmuletEventLoop
+{
+  public:
+	AmuletEventLoop();
+	~AmuletEventLoop();
+	int begin(AmuletLCD * lcd);
+	int add(int fd, uint32_t events, eventCallback callback, void * context);
+	int remove(int fd);
+	int runOnce(int timeoutMs);
+	int run(int tickMs = 10);
+	void stop();
+
+  private:
+	struct Handler {
+		int           fd;
+		eventCallback callback;
+		void *        context;
+	};
+	int _epfd;
+	AmuletLCD * _lcd;
+	volatile uint8_t _running;
+	Handler _handlers[AMULET_HOST_MAX_FDS];
+};
+
+#endif
@@ -0,0 +1,414 @@
+/*
+  AmuletIOThread.cpp - Thread-safe front end for AmuletLCD on a Linux host.
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "AmuletIOThread.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+AmuletIOThread::AmuletIOThread() : _stopping(false), _closed(false), _signalled(false), _completed(0){
+	_lcd = NULL;
+	_eventfd = -1;
+	_tickMs = 10;
+	for (uint8_t lane = 0; lane < AMULET_LANES; lane++){
+		_stub[lane].lane = lane;
+		_stub[lane].next.store(NULL, std::memory_order_relaxed);
+		_head[lane].store(&_stub[lane], std::memory_order_relaxed);
+		_tail[lane] = &_stub[lane];
+	}
+	_bulk = NULL;
+	_chunk = AMULET_IO_CHUNK;
+	_wakeups = 0;
+	_preemptions = 0;
+}
+
+AmuletIOThread::~AmuletIOThread(){
+	stop();
+}
+
+/**
+* Start the I/O thread. From here on, only the I/O thread may call lcd directly.
+* @param lcd AmuletLCD* already begun, with Serial open
+* @param tickMs int longest sleep between pollUpdate calls
+* @return int 0 on success, -1 with errno set otherwise
+*/
+int AmuletIOThread::begin(AmuletLCD * lcd, int tickMs){
+	_lcd = lcd;
+	_tickMs = tickMs;
+	_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_eventfd < 0)
+		return -1;
+	if (_events.begin(lcd) != 0 || _events.add(_eventfd, EPOLLIN, onWake, this) != 0)
+		return -1;
+	_stopping.store(false);
+	_closed.store(false);
+	_thread = std::thread([this]{
+		_events.run(_tickMs);
+		_closed.store(true, std::memory_order_release);
+		drain();  //fail whatever was submitted while the loop was ending
+	});
+	return 0;
+}
+
+/**
+* Finish the requests already queued, then stop and join the I/O thread.
+* Requests submitted afterwards, or after the port hung up, complete at once with ok = false.
+* Do not submit from other threads while stop() itself is running.
+*/
+void AmuletIOThread::stop(){
+	if (!_thread.joinable())
+		return;
+	_stopping.store(true);
+	uint64_t one = 1;
+	if (write(_eventfd, &one, sizeof(one)) < 0){
+		//counter full: the I/O thread is awake anyway
+	}
+	_thread.join();
+	drain();  //jobs that slipped in while the loop was ending
+	_events.remove(_eventfd);
+	close(_eventfd);
+	_eventfd = -1;
+}
+
+/**
+* Set the most bytes of a bulk lane array request sent or requested at once, rounded down to whole
+* variables. That bounds how long an urgent request waits. Call before begin.
+* @param bytes uint16_t payload bytes per chunk, default AMULET_IO_CHUNK. 0 sends bulk arrays whole.
+*/
+void AmuletIOThread::setChunk(uint16_t bytes){
+	_chunk = bytes;
+}
+
+/**
+* Producer side of the queue of the request's lane. Wait-free: one exchange and one store.
+*/
+void AmuletIOThread::enqueue(AmuletRequest * request){
+	uint8_t lane = (request->lane < AMULET_LANES) ? request->lane : AMULET_LANE_BULK;
+	request->next.store(NULL, std::memory_order_relaxed);
+	AmuletRequest * prev = _head[lane].exchange(request, std::memory_order_acq_rel);
+	prev->next.store(request, std::memory_order_release);
+}
+
+/**
+* Queue a request owned by the caller and wake the I/O thread. Nothing is allocated.
+* The eventfd is only written if no wakeup is already pending.
+* @param request AmuletRequest* filled in by the caller, with a callback. Must stay valid until the callback runs.
+*/
+void AmuletIOThread::submit(AmuletRequest * request){
+	if (_closed.load(std::memory_order_acquire)){  //I/O thread gone, fail right away
+		execute(request, 0);
+		return;
+	}
+	enqueue(request);
+	if (!_signalled.exchange(true, std::memory_order_acq_rel)){
+		uint64_t one = 1;
+		if (write(_eventfd, &one, sizeof(one)) < 0){
+			//counter full: a wakeup is pending anyway
+		}
+	}
+}
+
+/**
+* Consumer side of the queue of one lane, I/O thread only.
+* @param lane uint8_t AMULET_LANE_URGENT or AMULET_LANE_BULK
+* @return AmuletRequest* the oldest request, or NULL if the queue is empty or a producer is half way through enqueue
+*/
+AmuletRequest * AmuletIOThread::pop(uint8_t lane){
+	AmuletRequest * stub = &_stub[lane];
+	AmuletRequest * tail = _tail[lane];
+	AmuletRequest * next = tail->next.load(std::memory_order_acquire);
+	if (tail == stub){
+		if (next == NULL)
+			return NULL;
+		_tail[lane] = next;
+		tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next){
+		_tail[lane] = next;
+		return tail;
+	}
+	if (tail != _head[lane].load(std::memory_order_acquire))
+		return NULL;  //producer between exchange and store, its wakeup follows
+	enqueue(stub);
+	next = tail->next.load(std::memory_order_acquire);
+	if (next){
+		_tail[lane] = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/**
+* Run one request, or the next chunk of an array request, and hand the result to its callback once it is done.
+* The request is not touched after the callback, which may free or reuse it.
+* @param chunk uint16_t most payload bytes of an array to move now, 0 for all of it
+* @return uint8_t true if the request is done, false if chunks of the array are left
+*/
+uint8_t AmuletIOThread::execute(AmuletRequest * request, uint16_t chunk){
+	AmuletResult result = {false, 0};
+	uint16_t loc = request->loc;
+	if (!_closed.load(std::memory_order_acquire)){
+		switch (request->opcode){
+			case _SET_BYTE:  result.ok = _lcd->setByte(loc, request->value, true); break;
+			case _SET_WORD:  result.ok = _lcd->setWord(loc, request->value, true); break;
+			case _SET_COLOR: result.ok = _lcd->setColor(loc, request->value, true); break;
+			case _SET_BYTE_ARRAY:  case _GET_BYTE_ARRAY:
+			case _SET_WORD_ARRAY:  case _GET_WORD_ARRAY:
+			case _SET_COLOR_ARRAY: case _GET_COLOR_ARRAY: {
+				uint8_t op = request->opcode;
+				uint8_t bank = (op == _SET_BYTE_ARRAY || op == _GET_BYTE_ARRAY) ? _GET_BYTE :
+				               (op == _SET_WORD_ARRAY || op == _GET_WORD_ARRAY) ? _GET_WORD : _GET_COLOR;
+				uint8_t width = (bank == _GET_BYTE) ? 1 : (bank == _GET_WORD) ? 2 : 4;
+				uint32_t count = request->value;
+				if (chunk && (count > chunk / width))
+					count = (chunk >= width) ? chunk / width : 1;
+				if (count > 0xFFFF)
+					count = 0xFFFF;
+				if (op >= _SET_BYTE_ARRAY)
+					result.ok = _lcd->pushRange(bank, loc, count);
+				else
+					result.ok = _lcd->pullRange(bank, loc, count);
+				request->loc += count;
+				request->value -= count;
+				if (result.ok && request->value)
+					return false;
+				break;
+			}
+			case _GET_BYTE:
+				result.ok = _lcd->requestByte(loc);
+				result.value = _lcd->getByte(loc);
+				break;
+			case _GET_WORD:
+				result.ok = _lcd->requestWord(loc);
+				result.value = _lcd->getWord(loc);
+				break;
+			case _GET_COLOR:
+				result.ok = _lcd->requestColor(loc);
+				result.value = _lcd->getColor(loc);
+				break;
+			case _INVOKE_GEMSCRIPT:
+				result.ok = _lcd->callScript(request->script, true);
+				result.value = _lcd->scriptReply();
+				break;
+		}
+	}
+	_completed++;
+	request->callback(result, request->context);
+	return true;
+}
+
+/**
+* Run every queued request: urgent ones in submission order, and between them the bulk ones, one chunk
+* at a time so an urgent request submitted meanwhile goes next.
+*/
+void AmuletIOThread::drain(){
+	AmuletRequest * request;
+	_signalled.store(false, std::memory_order_release);  //before draining, so a later submit signals again
+	while (1){
+		if ((request = pop(AMULET_LANE_URGENT)) != NULL){
+			if (_bulk)
+				_preemptions++;
+			execute(request, 0);
+			continue;
+		}
+		if (!_bulk)
+			_bulk = pop(AMULET_LANE_BULK);
+		if (!_bulk)
+			break;
+		if (execute(_bulk, _chunk))
+			_bulk = NULL;
+	}
+}
+
+void AmuletIOThread::onWake(int fd, uint32_t events, void * context){
+	AmuletIOThread * self = (AmuletIOThread *)context;
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) < 0){
+		//already drained by an earlier wakeup
+	}
+	self->_wakeups++;
+	self->drain();
+	if (self->_stopping.load())
+		self->_events.stop();
+}
+
+/**
+* Completion of the future versions: set the promise and free the job.
+*/
+void AmuletIOThread::fulfil(AmuletResult result, void * context){
+	Job * job = (Job *)context;
+	job->promise.set_value(result);
+	delete job;
+}
+
+/**
+* Completion of the callback versions: call the user back and free the job.
+*/
+void AmuletIOThread::forward(AmuletResult result, void * context){
+	Job * job = (Job *)context;
+	job->userCallback(result, job->userContext);
+	delete job;
+}
+
+std::future<AmuletResult> AmuletIOThread::submit(uint8_t opcode, uint16_t loc, uint32_t value, const char * fname, uint8_t lane){
+	Job * job = new Job();
+	job->opcode = opcode;
+	job->lane = lane;
+	job->loc = loc;
+	job->value = value;
+	if (fname)
+		job->name = fname;
+	job->script = job->name.c_str();
+	job->callback = fulfil;
+	job->context = job;
+	std::future<AmuletResult> result = job->promise.get_future();
+	submit(job);
+	return result;
+}
+
+void AmuletIOThread::submit(uint8_t opcode, uint16_t loc, uint32_t value, const char * fname, uint8_t lane, resultCallback callback, void * context){
+	Job * job = new Job();
+	job->opcode = opcode;
+	job->lane = lane;
+	job->loc = loc;
+	job->value = value;
+	if (fname)
+		job->name = fname;
+	job->script = job->name.c_str();
+	job->callback = forward;
+	job->context = job;
+	job->userCallback = callback;
+	job->userContext = context;
+	submit(job);
+}
+
+/**
+* The Set or Get Array opcode of a bank.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param set uint8_t true for _SET_BYTE_ARRAY.., false for _GET_BYTE_ARRAY..
+*/
+static uint8_t arrayOpcode(uint8_t bank, uint8_t set){
+	if (bank == _GET_BYTE)
+		return set ? _SET_BYTE_ARRAY : _GET_BYTE_ARRAY;
+	if (bank == _GET_WORD)
+		return set ? _SET_WORD_ARRAY : _GET_WORD_ARRAY;
+	return set ? _SET_COLOR_ARRAY : _GET_COLOR_ARRAY;
+}
+
+/**
+* Queue a Set Byte. The future is ready once the display has acknowledged it, or retries ran out.
+*/
+std::future<AmuletResult> AmuletIOThread::setByte(uint16_t loc, uint8_t value, uint8_t lane){
+	return submit(_SET_BYTE, loc, value, NULL, lane);
+}
+
+std::future<AmuletResult> AmuletIOThread::setWord(uint16_t loc, uint16_t value, uint8_t lane){
+	return submit(_SET_WORD, loc, value, NULL, lane);
+}
+
+std::future<AmuletResult> AmuletIOThread::setColor(uint16_t loc, uint32_t value, uint8_t lane){
+	return submit(_SET_COLOR, loc, value, NULL, lane);
+}
+
+/**
+* Queue a Get Byte. AmuletResult::value holds the local copy after the reply.
+*/
+std::future<AmuletResult> AmuletIOThread::requestByte(uint16_t loc, uint8_t lane){
+	return submit(_GET_BYTE, loc, 0, NULL, lane);
+}
+
+std::future<AmuletResult> AmuletIOThread::requestWord(uint16_t loc, uint8_t lane){
+	return submit(_GET_WORD, loc, 0, NULL, lane);
+}
+
+std::future<AmuletResult> AmuletIOThread::requestColor(uint16_t loc, uint8_t lane){
+	return submit(_GET_COLOR, loc, 0, NULL, lane);
+}
+
+/**
+* Queue a GEMscript call. fname is copied. AmuletResult::value holds scriptReply().
+*/
+std::future<AmuletResult> AmuletIOThread::callScript(const char * fname, uint8_t lane){
+	return submit(_INVOKE_GEMSCRIPT, 0, 0, fname, lane);
+}
+
+/**
+* Queue a transfer of any length from the local array to the display, like AmuletLCD::pushRange.
+* In the bulk lane it is sent one setChunk at a time. AmuletResult::ok is false if any chunk failed.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+*/
+std::future<AmuletResult> AmuletIOThread::pushRange(uint8_t bank, uint16_t start, uint16_t count, uint8_t lane){
+	return submit(arrayOpcode(bank, true), start, count, NULL, lane);
+}
+
+/**
+* Queue a transfer of any length from the display into the local array, like AmuletLCD::pullRange.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+*/
+std::future<AmuletResult> AmuletIOThread::pullRange(uint8_t bank, uint16_t start, uint16_t count, uint8_t lane){
+	return submit(arrayOpcode(bank, false), start, count, NULL, lane);
+}
+
+/**
+* Callback versions: callback runs on the I/O thread once the request completes, and must not block.
+*/
+void AmuletIOThread::setByte(uint16_t loc, uint8_t value, resultCallback callback, void * context, uint8_t lane){
+	submit(_SET_BYTE, loc, value, NULL, lane, callback, context);
+}
+
+void AmuletIOThread::setWord(uint16_t loc, uint16_t value, resultCallback callback, void * context, uint8_t lane){
+	submit(_SET_WORD, loc, value, NULL, lane, callback, context);
+}
+
+void AmuletIOThread::setColor(uint16_t loc, uint32_t value, resultCallback callback, void * context, uint8_t lane){
+	submit(_SET_COLOR, loc, value, NULL, lane, callback, context);
+}
+
+void AmuletIOThread::requestByte(uint16_t loc, resultCallback callback, void * context, uint8_t lane){
+	submit(_GET_BYTE, loc, 0, NULL, lane, callback, context);
+}
+
+void AmuletIOThread::requestWord(uint16_t loc, resultCallback callback, void * context, uint8_t lane){
+	submit(_GET_WORD, loc, 0, NULL, lane, callback, context);
+}
+
+void AmuletIOThread::requestColor(uint16_t loc, resultCallback callback, void * context, uint8_t lane){
+	submit(_GET_COLOR, loc, 0, NULL, lane, callback, context);
+}
+
+void AmuletIOThread::callScript(const char * fname, resultCallback callback, void * context, uint8_t lane){
+	submit(_INVOKE_GEMSCRIPT, 0, 0, fname, lane, callback, context);
+}
+
+void AmuletIOThread::pushRange(uint8_t bank, uint16_t start, uint16_t count, resultCallback callback, void * context, uint8_t lane){
+	submit(arrayOpcode(bank, true), start, count, NULL, lane, callback, context);
+}
+
+void AmuletIOThread::pullRange(uint8_t bank, uint16_t start, uint16_t count, resultCallback callback, void * context, uint8_t lane){
+	submit(arrayOpcode(bank, false), start, count, NULL, lane, callback, context);
+}
+
+/**
+* @return uint32_t requests completed by the I/O thread. Read from the I/O thread or after stop().
+*/
+uint32_t AmuletIOThread::completed(){
+	return _completed;
+}
+
+/**
+* @return uint32_t eventfd wakeups. completed() / wakeups() is how many requests each wakeup batched.
+*/
+uint32_t AmuletIOThread::wakeups(){
+	return _wakeups;
+}
+
+/**
+* @return uint32_t urgent requests that ran between two chunks of a bulk array. Read from the I/O thread or after stop().
+*/
+uint32_t AmuletIOThread::preemptions(){
+	return _preemptions;
+}
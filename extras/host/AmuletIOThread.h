@@ -0,0 +1,172 @@
+/*
+  AmuletIOThread.h - Thread-safe front end for AmuletLCD on a Linux host
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  One I/O thread owns the AmuletLCD, its parser and the port. Any other thread submits
+  requests through a lock-free multi-producer queue and gets the result back through a
+  std::future or a callback run on the I/O thread. Submitting is an atomic exchange plus,
+  if the I/O thread may be asleep, one eventfd write; producers never wait on each other
+  or on the UART.
+
+  Example:
+    AmuletIOThread io;
+    Serial.open("/dev/ttyS1");
+    myModule.begin(115200);
+    io.begin(&myModule);
+    ...any thread...
+    io.setWord(3, alarmLevel);                  //fire and forget
+    AmuletResult r = io.requestWord(5).get();   //wait for the display
+    io.stop();
+
+  The local arrays are written by the I/O thread. Read them from other threads with
+  snapshotBytes/Words/Colors, or from a callback.
+
+  Requests go into one of two lanes. The I/O thread always takes the oldest urgent request
+  first. Array requests in the bulk lane are sent in chunks of at most setChunk bytes, and
+  the urgent lane is checked between chunks, so an urgent request waits for at most one
+  chunk of bulk work. Order is only kept within a lane:
+    io.pushRange(_GET_COLOR, 0, 1000);          //bulk lane by default
+    io.callScript("showAlarm");                 //urgent lane, sent after the current chunk
+ */
+
+#ifndef AmuletIOThread_h
+#define AmuletIOThread_h
+
+#include "AmuletLCD.h"
+#include "AmuletEventLoop.h"
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+
+// Outbound priority classes, see AmuletRequest::lane
+#define AMULET_LANE_URGENT   0
+#define AMULET_LANE_BULK     1
+#define AMULET_LANES         2
+
+// Default setChunk: the payload of one array frame that fits the builtin buffers
+#ifndef AMULET_IO_CHUNK
+#define AMULET_IO_CHUNK      (((AMULET_TX_BUF_LEN < AMULET_RX_BUF_LEN) ? AMULET_TX_BUF_LEN : AMULET_RX_BUF_LEN) - 7)
+#endif
+
+/**
+* struct returned for every submitted request.
+*/
+typedef struct {
+	int8_t   ok;     //return value of the AmuletLCD call: true on success
+	uint32_t value;  //requestX: the local copy after the reply. callScript: scriptReply(). Otherwise 0.
+} AmuletResult;
+
+/**
+* typedef used by the callback versions of the AmuletIOThread requests. Runs on the I/O thread.
+*/
+typedef void (* resultCallback) (AmuletResult result, void * context);
+
+/**
+* struct used to submit a request without AmuletIOThread allocating anything, see AmuletIOThread::submit.
+* The caller owns it and must keep it alive until callback has been called.
+*/
+typedef struct AmuletRequest {
+	std::atomic<struct AmuletRequest *> next;  //queue link, set by submit
+	uint8_t  opcode;        //_SET_BYTE.._SET_COLOR_ARRAY, _GET_BYTE.._GET_COLOR_ARRAY or _INVOKE_GEMSCRIPT
+	uint8_t  lane;          //AMULET_LANE_URGENT or AMULET_LANE_BULK
+	uint16_t loc;           //index, or first index for arrays. Advanced as a bulk array is sent.
+	uint32_t value;         //value to set, or count for arrays, any number. Counts down as a bulk array is sent.
+	const char * script;    //_INVOKE_GEMSCRIPT only, must stay valid until callback
+	resultCallback callback;
+	void * context;
+} AmuletRequest;
+
+/**
+* A class used to run one AmuletLCD on its own thread and accept requests from any thread.
+*/
+class AmuletIOThread
+{
+  public:
+	AmuletIOThread();
+	~AmuletIOThread();
+	int begin(AmuletLCD * lcd, int tickMs = 10);
+	void stop();
+	void setChunk(uint16_t bytes);
+
+	std::future<AmuletResult> setByte(uint16_t loc, uint8_t value, uint8_t lane = AMULET_LANE_URGENT);
+	std::future<AmuletResult> setWord(uint16_t loc, uint16_t value, uint8_t lane = AMULET_LANE_URGENT);
+	std::future<AmuletResult> setColor(uint16_t loc, uint32_t value, uint8_t lane = AMULET_LANE_URGENT);
+	std::future<AmuletResult> requestByte(uint16_t loc, uint8_t lane = AMULET_LANE_URGENT);
+	std::future<AmuletResult> requestWord(uint16_t loc, uint8_t lane = AMULET_LANE_URGENT);
+	std::future<AmuletResult> requestColor(uint16_t loc, uint8_t lane = AMULET_LANE_URGENT);
+	std::future<AmuletResult> callScript(const char * fname, uint8_t lane = AMULET_LANE_URGENT);
+	std::future<AmuletResult> pushRange(uint8_t bank, uint16_t start, uint16_t count, uint8_t lane = AMULET_LANE_BULK);
+	std::future<AmuletResult> pullRange(uint8_t bank, uint16_t start, uint16_t count, uint8_t lane = AMULET_LANE_BULK);
+
+	void setByte(uint16_t loc, uint8_t value, resultCallback callback, void * context, uint8_t lane = AMULET_LANE_URGENT);
+	void setWord(uint16_t loc, uint16_t value, resultCallback callback, void * context, uint8_t lane = AMULET_LANE_URGENT);
+	void setColor(uint16_t loc, uint32_t value, resultCallback callback, void * context, uint8_t lane = AMULET_LANE_URGENT);
+	void requestByte(uint16_t loc, resultCallback callback, void * context, uint8_t lane = AMULET_LANE_URGENT);
+	void requestWord(uint16_t loc, resultCallback callback, void * context, uint8_t lane = AMULET_LANE_URGENT);
+	void requestColor(uint16_t loc, resultCallback callback, void * context, uint8_t lane = AMULET_LANE_URGENT);
+	void callScript(const char * fname, resultCallback callback, void * context, uint8_t lane = AMULET_LANE_URGENT);
+	void pushRange(uint8_t bank, uint16_t start, uint16_t count, resultCallback callback, void * context, uint8_t lane = AMULET_LANE_BULK);
+	void pullRange(uint8_t bank, uint16_t start, uint16_t count, resultCallback callback, void * context, uint8_t lane = AMULET_LANE_BULK);
+
+	void submit(AmuletRequest * request);
+
+	uint32_t completed();
+	uint32_t wakeups();
+	uint32_t preemptions();
+
+  private:
+	// Request allocated by the future and callback versions, freed once it completes
+	struct Job : AmuletRequest {
+		std::string name;
+		std::promise<AmuletResult> promise;
+		resultCallback userCallback;
+		void * userContext;
+	};
+
+	std::future<AmuletResult> submit(uint8_t opcode, uint16_t loc, uint32_t value, const char * fname, uint8_t lane);
+	void submit(uint8_t opcode, uint16_t loc, uint32_t value, const char * fname, uint8_t lane, resultCallback callback, void * context);
+	void enqueue(AmuletRequest * request);
+	AmuletRequest * pop(uint8_t lane);
+	uint8_t execute(AmuletRequest * request, uint16_t chunk);
+	void drain();
+	static void onWake(int fd, uint32_t events, void * context);
+	static void fulfil(AmuletResult result, void * context);
+	static void forward(AmuletResult result, void * context);
+
+	AmuletLCD * _lcd;
+	AmuletEventLoop _events;
+	std::thread _thread;
+	int _eventfd;
+	int _tickMs;
+	std::atomic<uint8_t> _stopping;
+	std::atomic<uint8_t> _closed;     //the I/O thread has left its loop
+	std::atomic<uint8_t> _signalled;  //an eventfd write is pending, producers need not write again
+
+	// One Vyukov intrusive MPSC queue per lane: producers exchange _head, the I/O thread alone walks _tail.
+	std::atomic<AmuletRequest *> _head[AMULET_LANES];
+	AmuletRequest * _tail[AMULET_LANES];
+	AmuletRequest _stub[AMULET_LANES];
+	AmuletRequest * _bulk;   //bulk array request with chunks left to send
+	uint16_t _chunk;
+
+	std::atomic<uint32_t> _completed;
+	uint32_t _wakeups;
+	uint32_t _preemptions;   //urgent requests run between the chunks of a bulk array
+};
+
+#endif
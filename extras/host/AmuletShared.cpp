@@ -0,0 +1,446 @@
+/*
+  AmuletShared.cpp - AmuletLCD local arrays in POSIX shared memory.
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "AmuletShared.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+/**
+* Index of a bank into AmuletSharedHeader::seq, or -1 for anything else.
+*/
+static int bankIndex(uint8_t bank){
+	if (bank == _GET_BYTE)
+		return 0;
+	if (bank == _GET_WORD)
+		return 1;
+	if (bank == _GET_COLOR)
+		return 2;
+	return -1;
+}
+
+static uint8_t bankWidth(int index){
+	return (index == 0) ? 1 : (index == 1) ? 2 : 4;
+}
+
+static uint16_t bankCount(AmuletSharedHeader * header, int index){
+	return (index == 0) ? header->byteCount : (index == 1) ? header->wordCount : header->colorCount;
+}
+
+static uint8_t * bankBase(AmuletSharedHeader * header, int index){
+	uint32_t offset = (index == 0) ? header->byteOffset : (index == 1) ? header->wordOffset : header->colorOffset;
+	return (uint8_t *)header + offset;
+}
+
+static uint32_t align64(uint32_t offset){
+	return (offset + 63) & ~63U;
+}
+
+AmuletShared::AmuletShared(){
+	_lcd = NULL;
+	_events = NULL;
+	_header = NULL;
+	_name[0] = 0;
+	_timerfd = -1;
+}
+
+AmuletShared::~AmuletShared(){
+	close();
+}
+
+/**
+* Create the segment and move the local arrays of lcd and their sequence numbers into it.
+* A segment left behind by an owner that is gone is replaced.
+* @param name const char* shm_open name, e.g. "/amulet"
+* @param lcd AmuletLCD* the display, before any traffic
+* @param bytes uint16_t length of the local Byte array, 0 for none
+* @param words uint16_t length of the local Word array
+* @param colors uint16_t length of the local Color array
+* @param ringLength uint32_t slots for posted writes, rounded up to a power of 2
+* @return int 0 on success, -1 with errno set otherwise. EEXIST if another owner is running.
+*/
+int AmuletShared::create(const char * name, AmuletLCD * lcd, uint16_t bytes, uint16_t words, uint16_t colors, uint32_t ringLength){
+	uint32_t ring = 1;
+	while (ring < ringLength)
+		ring <<= 1;
+	uint32_t byteOffset = align64(sizeof(AmuletSharedHeader));
+	uint32_t wordOffset = align64(byteOffset + bytes);
+	uint32_t colorOffset = align64(wordOffset + 2UL * words);
+	uint32_t ringOffset = align64(colorOffset + 4UL * colors);
+	uint32_t size = ringOffset + ring * sizeof(AmuletSharedWrite);
+
+	close();
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+	if (fd < 0 && errno == EEXIST){
+		AmuletSharedView old;
+		if (old.open(name) == 0 && old.ownerAlive()){
+			errno = EEXIST;
+			return -1;
+		}
+		old.close();
+		shm_unlink(name);
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+	}
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size) != 0){
+		::close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED){
+		shm_unlink(name);
+		return -1;
+	}
+	_header = (AmuletSharedHeader *)map;  //zero filled by ftruncate
+	_header->size = size;
+	_header->owner = getpid();
+	_header->byteCount = bytes;
+	_header->wordCount = words;
+	_header->colorCount = colors;
+	_header->byteOffset = byteOffset;
+	_header->wordOffset = wordOffset;
+	_header->colorOffset = colorOffset;
+	_header->ringOffset = ringOffset;
+	_header->ringLength = ring;
+	AmuletSharedWrite * slots = (AmuletSharedWrite *)((uint8_t *)map + ringOffset);
+	for (uint32_t i = 0; i < ring; i++)
+		slots[i].seq.store(i, std::memory_order_relaxed);
+	_header->magic.store(AMULET_SHARED_MAGIC, std::memory_order_release);
+	snprintf(_name, sizeof(_name), "%s", name);
+
+	_lcd = lcd;
+	#ifndef AMULET_NO_BYTES
+	lcd->setBytePointer(bankBase(_header, 0), bytes);
+	#endif
+	#ifndef AMULET_NO_WORDS
+	lcd->setWordPointer((uint16_t *)bankBase(_header, 1), words);
+	#endif
+	#ifndef AMULET_NO_COLORS
+	lcd->setColorPointer((uint32_t *)bankBase(_header, 2), colors);
+	#endif
+	lcd->setSeqPointers(&_header->seq[0], &_header->seq[1], &_header->seq[2]);
+	return 0;
+}
+
+/**
+* Flush posted writes from an event loop, every periodMs.
+* @param events AmuletEventLoop* begun with the same AmuletLCD
+* @param periodMs int how long a posted write may wait
+* @return int 0 on success, -1 with errno set otherwise
+*/
+int AmuletShared::attach(AmuletEventLoop * events, int periodMs){
+	struct itimerspec period = {{periodMs / 1000, (periodMs % 1000) * 1000000L}, {periodMs / 1000, (periodMs % 1000) * 1000000L}};
+	_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (_timerfd < 0)
+		return -1;
+	if (timerfd_settime(_timerfd, 0, &period, NULL) != 0 || events->add(_timerfd, EPOLLIN, onTimer, this) != 0){
+		::close(_timerfd);
+		_timerfd = -1;
+		return -1;
+	}
+	_events = events;
+	return 0;
+}
+
+void AmuletShared::onTimer(int fd, uint32_t events, void * context){
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) < 0){
+		//already read
+	}
+	((AmuletShared *)context)->flush();
+}
+
+/**
+* Take the posted writes off the ring, store them in the local arrays and send them to the display.
+* Writes to the same or neighbouring variables of a bank are sent together, as one pushRange.
+* Call it on the thread that runs the parser.
+* @return uint16_t the number of writes taken, at most one ring full per call
+*/
+uint16_t AmuletShared::flush(){
+	AmuletSharedWrite * slots;
+	uint32_t mask;
+	uint16_t taken = 0;
+	int runBank = -1;
+	uint16_t lo = 0, hi = 0;
+	if (!_header)
+		return 0;
+	slots = (AmuletSharedWrite *)((uint8_t *)_header + _header->ringOffset);
+	mask = _header->ringLength - 1;
+	while (taken <= mask){
+		uint32_t pos = _header->ringTail;
+		AmuletSharedWrite * slot = &slots[pos & mask];
+		if (slot->seq.load(std::memory_order_acquire) != pos + 1)
+			break;  //empty, or a poster is still filling the slot
+		int b = bankIndex(slot->bank);
+		uint16_t loc = slot->loc;
+		uint32_t value = slot->value;
+		slot->seq.store(pos + mask + 1, std::memory_order_release);
+		_header->ringTail = pos + 1;
+		taken++;
+		if ((b < 0) || (loc >= bankCount(_header, b))){
+			_header->failed++;
+			continue;
+		}
+		if ((runBank >= 0) && ((b != runBank) || (loc + 1 < lo) || (loc > hi))){
+			push(runBank, lo, hi);
+			runBank = -1;
+		}
+		_header->seq[b]++;
+		AMULET_BARRIER();
+		uint8_t * base = bankBase(_header, b);
+		if (b == 0)
+			base[loc] = value;
+		else if (b == 1)
+			((uint16_t *)base)[loc] = value;
+		else
+			((uint32_t *)base)[loc] = value;
+		AMULET_BARRIER();
+		_header->seq[b]++;
+		if (runBank < 0){
+			runBank = b;
+			lo = loc;
+			hi = loc + 1;
+		}
+		else{
+			if (loc < lo)
+				lo = loc;
+			if (loc + 1 > hi)
+				hi = loc + 1;
+		}
+	}
+	if (runBank >= 0)
+		push(runBank, lo, hi);
+	return taken;
+}
+
+/**
+* Send one run of a bank to the display.
+* @param bank uint8_t index into AmuletSharedHeader::seq
+* @param start uint16_t first variable of the run
+* @param end uint16_t one past the last variable
+* @return uint8_t true if the display acknowledged it
+*/
+uint8_t AmuletShared::push(uint8_t bank, uint16_t start, uint16_t end){
+	static const uint8_t banks[3] = {_GET_BYTE, _GET_WORD, _GET_COLOR};
+	if (_lcd->pushRange(banks[bank], start, end - start)){
+		_header->flushed += end - start;
+		return true;
+	}
+	_header->failed += end - start;
+	return false;
+}
+
+/**
+* Give the local arrays back to lcd as empty ones, then unmap and remove the segment.
+* Processes that still have it mapped keep the last values.
+*/
+void AmuletShared::close(){
+	if (_events && _timerfd >= 0)
+		_events->remove(_timerfd);
+	if (_timerfd >= 0)
+		::close(_timerfd);
+	_timerfd = -1;
+	_events = NULL;
+	if (_lcd){
+		#ifndef AMULET_NO_BYTES
+		_lcd->setBytePointer(NULL, 0);
+		#endif
+		#ifndef AMULET_NO_WORDS
+		_lcd->setWordPointer(NULL, 0);
+		#endif
+		#ifndef AMULET_NO_COLORS
+		_lcd->setColorPointer(NULL, 0);
+		#endif
+		_lcd->setSeqPointers(NULL, NULL, NULL);
+		_lcd = NULL;
+	}
+	if (_header){
+		munmap(_header, _header->size);
+		shm_unlink(_name);
+		_header = NULL;
+	}
+}
+
+/**
+* @return AmuletSharedHeader* the segment, for its counters. NULL before create.
+*/
+AmuletSharedHeader * AmuletShared::header(){
+	return _header;
+}
+
+AmuletSharedView::AmuletSharedView(){
+	_header = NULL;
+}
+
+AmuletSharedView::~AmuletSharedView(){
+	close();
+}
+
+/**
+* Map a segment created by AmuletShared::create.
+* @param name const char* the name passed to create
+* @return int 0 on success, -1 with errno set otherwise. EPROTO if it is not set up, or has another layout.
+*/
+int AmuletSharedView::open(const char * name){
+	struct stat st;
+	close();
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(AmuletSharedHeader)){
+		::close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	void * map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	_header = (AmuletSharedHeader *)map;
+	if (_header->magic.load(std::memory_order_acquire) != AMULET_SHARED_MAGIC || _header->size != (uint32_t)st.st_size){
+		munmap(map, st.st_size);
+		_header = NULL;
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+void AmuletSharedView::close(){
+	if (_header)
+		munmap(_header, _header->size);
+	_header = NULL;
+}
+
+/**
+* @return uint8_t true if the process that created the segment is still running
+*/
+uint8_t AmuletSharedView::ownerAlive(){
+	return _header && (kill(_header->owner, 0) == 0 || errno == EPERM);
+}
+
+uint8_t AmuletSharedView::getByte(uint16_t loc){
+	uint8_t value = 0;
+	snapshot(_GET_BYTE, loc, 1, &value);
+	return value;
+}
+
+uint16_t AmuletSharedView::getWord(uint16_t loc){
+	uint16_t value = 0;
+	snapshot(_GET_WORD, loc, 1, &value);
+	return value;
+}
+
+uint32_t AmuletSharedView::getColor(uint16_t loc){
+	uint32_t value = 0;
+	snapshot(_GET_COLOR, loc, 1, &value);
+	return value;
+}
+
+/**
+* Copy a consistent range of the Byte array, see AmuletLCD::snapshotBytes.
+* @return uint8_t true if the range is valid and was read
+*/
+uint8_t AmuletSharedView::snapshotBytes(uint16_t start, uint16_t count, uint8_t * dest){
+	return snapshot(_GET_BYTE, start, count, dest);
+}
+
+uint8_t AmuletSharedView::snapshotWords(uint16_t start, uint16_t count, uint16_t * dest){
+	return snapshot(_GET_WORD, start, count, dest);
+}
+
+uint8_t AmuletSharedView::snapshotColors(uint16_t start, uint16_t count, uint32_t * dest){
+	return snapshot(_GET_COLOR, start, count, dest);
+}
+
+/**
+* Utility function behind the get and snapshot methods. Retries while the owner writes to the bank.
+* @return uint8_t true if the range is valid and was read, false if it is not or the owner stayed in a write
+*/
+uint8_t AmuletSharedView::snapshot(uint8_t bank, uint16_t start, uint16_t count, void * dest){
+	int b = bankIndex(bank);
+	if (!_header || (b < 0) || ((uint32_t)start + count > bankCount(_header, b)))
+		return false;
+	uint8_t width = bankWidth(b);
+	const uint8_t * src = bankBase(_header, b) + start * width;
+	for (uint32_t spin = 0; spin < AMULET_SHARED_SPIN; spin++){
+		amulet_seq_t seq = _header->seq[b];
+		if (seq & 1){
+			sched_yield();
+			continue;
+		}
+		AMULET_BARRIER();
+		memcpy(dest, src, count * width);
+		AMULET_BARRIER();
+		if (_header->seq[b] == seq)
+			return true;
+	}
+	return false;
+}
+
+/**
+* Post a write for the owner to store and send to the display. Lock-free: posters never wait on each
+* other or on the owner.
+* @return uint8_t true if posted, false if the index is invalid or the ring is full
+*/
+uint8_t AmuletSharedView::setByte(uint16_t loc, uint8_t value){
+	return post(_GET_BYTE, loc, value);
+}
+
+uint8_t AmuletSharedView::setWord(uint16_t loc, uint16_t value){
+	return post(_GET_WORD, loc, value);
+}
+
+uint8_t AmuletSharedView::setColor(uint16_t loc, uint32_t value){
+	return post(_GET_COLOR, loc, value);
+}
+
+/**
+* Utility function behind the set methods: claim a slot of the ring, fill it and publish it.
+*/
+uint8_t AmuletSharedView::post(uint8_t bank, uint16_t loc, uint32_t value){
+	int b = bankIndex(bank);
+	if (!_header || (b < 0) || (loc >= bankCount(_header, b)))
+		return false;
+	AmuletSharedWrite * slots = (AmuletSharedWrite *)((uint8_t *)_header + _header->ringOffset);
+	uint32_t mask = _header->ringLength - 1;
+	uint32_t pos = _header->ringHead.load(std::memory_order_relaxed);
+	while (1){
+		AmuletSharedWrite * slot = &slots[pos & mask];
+		int32_t diff = (int32_t)(slot->seq.load(std::memory_order_acquire) - pos);
+		if (diff == 0){
+			if (_header->ringHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+				slot->bank = bank;
+				slot->loc = loc;
+				slot->value = value;
+				slot->seq.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0){
+			_header->dropped++;
+			return false;
+		}
+		else
+			pos = _header->ringHead.load(std::memory_order_relaxed);
+	}
+}
+
+/**
+* @return AmuletSharedHeader* the segment, for its counters and bank lengths. NULL before open.
+*/
+AmuletSharedHeader * AmuletSharedView::header(){
+	return _header;
+}
@@ -0,0 +1,152 @@
+/*
+  AmuletShared.h - AmuletLCD local arrays in POSIX shared memory
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  The process that owns the AmuletLCD keeps its local Byte, Word and Color arrays, and the
+  sequence numbers guarding them, in a shared memory segment. Other processes map the same
+  segment with AmuletSharedView: they read variables straight from it, with the same lock-free
+  retry as AmuletLCD::snapshotWords, and post writes into a bounded lock-free ring. The owner
+  takes the writes off the ring, stores them in the local arrays and sends each run of
+  neighbouring variables to the display as one pushRange.
+
+  Owner:
+    AmuletShared shared;
+    shared.create("/amulet", &myModule, 64, 256, 16);   //sets the local array pointers
+    events.begin(&myModule);
+    shared.attach(&events, 10);                         //flush posted writes every 10 ms
+    events.run();
+
+  Any other process:
+    AmuletSharedView view;
+    view.open("/amulet");
+    uint16_t level = view.getWord(5);
+    view.setWord(3, 1);                                 //sent by the owner's next flush
+
+  flush runs the parser's blocking calls, so the owner must call it on the thread that runs the
+  parser, which attach does. Link with -lrt on older glibc.
+ */
+
+#ifndef AmuletShared_h
+#define AmuletShared_h
+
+#include "AmuletLCD.h"
+#include "AmuletEventLoop.h"
+#include <atomic>
+#include <sys/types.h>
+
+// Set in the header once the owner has set the segment up. Changes whenever the layout does.
+#define AMULET_SHARED_MAGIC    0x414D5601
+// Default slots in the write ring, a power of 2
+#ifndef AMULET_SHARED_RING
+#define AMULET_SHARED_RING     256
+#endif
+// Times a reader retries while the owner is writing to a bank, before it gives up
+#ifndef AMULET_SHARED_SPIN
+#define AMULET_SHARED_SPIN     100000
+#endif
+
+/**
+* struct of one slot of the write ring, a Vyukov bounded queue.
+*/
+typedef struct {
+	std::atomic<uint32_t> seq;  //position when free, position + 1 once posted
+	uint8_t  bank;              //_GET_BYTE, _GET_WORD or _GET_COLOR
+	uint16_t loc;
+	uint32_t value;
+} AmuletSharedWrite;
+
+/**
+* struct at the start of the segment. Offsets are from the start of the segment.
+*/
+typedef struct {
+	std::atomic<uint32_t> magic;       //AMULET_SHARED_MAGIC, stored last by create
+	uint32_t size;                     //bytes in the segment
+	pid_t    owner;
+	uint16_t byteCount;
+	uint16_t wordCount;
+	uint16_t colorCount;
+	uint32_t byteOffset;
+	uint32_t wordOffset;
+	uint32_t colorOffset;
+	uint32_t ringOffset;
+	uint32_t ringLength;               //slots, a power of 2
+	volatile amulet_seq_t seq[3];      //Byte, Word, Color: odd while the owner writes to the bank
+	std::atomic<uint32_t> ringHead;    //next slot a poster claims
+	uint32_t ringTail;                 //next slot the owner takes, owner only
+	std::atomic<uint32_t> dropped;     //posts that found the ring full
+	std::atomic<uint32_t> flushed;     //posted writes stored and sent
+	std::atomic<uint32_t> failed;      //posted writes the display did not acknowledge
+} AmuletSharedHeader;
+
+/**
+* A class used by the owner of an AmuletLCD to share its local arrays with other processes.
+*/
+class AmuletShared
+{
+  public:
+	AmuletShared();
+	~AmuletShared();
+	int create(const char * name, AmuletLCD * lcd, uint16_t bytes, uint16_t words, uint16_t colors, uint32_t ringLength = AMULET_SHARED_RING);
+	int attach(AmuletEventLoop * events, int periodMs = 10);
+	uint16_t flush();
+	void close();
+	AmuletSharedHeader * header();
+
+  private:
+	uint8_t push(uint8_t bank, uint16_t start, uint16_t end);
+	static void onTimer(int fd, uint32_t events, void * context);
+
+	AmuletLCD * _lcd;
+	AmuletEventLoop * _events;
+	AmuletSharedHeader * _header;
+	char _name[64];
+	int _timerfd;
+};
+
+/**
+* A class used by other processes to read and write the variables of an AmuletShared segment.
+*/
+class AmuletSharedView
+{
+  public:
+	AmuletSharedView();
+	~AmuletSharedView();
+	int open(const char * name);
+	void close();
+	uint8_t ownerAlive();
+
+	uint8_t getByte(uint16_t loc);
+	uint16_t getWord(uint16_t loc);
+	uint32_t getColor(uint16_t loc);
+	uint8_t snapshotBytes(uint16_t start, uint16_t count, uint8_t * dest);
+	uint8_t snapshotWords(uint16_t start, uint16_t count, uint16_t * dest);
+	uint8_t snapshotColors(uint16_t start, uint16_t count, uint32_t * dest);
+
+	uint8_t setByte(uint16_t loc, uint8_t value);
+	uint8_t setWord(uint16_t loc, uint16_t value);
+	uint8_t setColor(uint16_t loc, uint32_t value);
+
+	AmuletSharedHeader * header();
+
+  private:
+	uint8_t snapshot(uint8_t bank, uint16_t start, uint16_t count, void * dest);
+	uint8_t post(uint8_t bank, uint16_t loc, uint32_t value);
+
+	AmuletSharedHeader * _header;
+};
+
+#endif
@@ -0,0 +1,51 @@
+/*
+  Arduino.cpp - Timing functions of the minimal Arduino core for Linux hosts.
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "Arduino.h"
+#include <time.h>
+
+static uint64_t monotonicMicros(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+* Microseconds on CLOCK_MONOTONIC, counted from the first call.
+*/
+static uint64_t hostMicros(){
+	static const uint64_t origin = monotonicMicros();
+	return monotonicMicros() - origin;
+}
+
+/**
+* Milliseconds since the first call. Wraps like the Arduino version when unsigned long is 32 bits.
+*/
+unsigned long millis(){
+	return (unsigned long)(hostMicros() / 1000);
+}
+
+/**
+* Microseconds since the first call.
+*/
+unsigned long micros(){
+	return (unsigned long)hostMicros();
+}
+
+void delay(unsigned long ms){
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) != 0)
+		;
+}
+
+void delayMicroseconds(unsigned int us){
+	struct timespec ts;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000L;
+	while (nanosleep(&ts, &ts) != 0)
+		;
+}
@@ -0,0 +1,107 @@
+/*
+  HostClock.cpp - Virtual clock for testing AmuletLCD timeouts and retries on a Linux host.
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "Arduino.h"
+#include "HostClock.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static HostClockShared * _clock = NULL;
+static char _clockName[64];
+static uint32_t _sent0;      //Serial counters when the clock was opened
+static uint32_t _received0;
+
+/**
+* Create or join the clock segment and start the time at 0. The emulator may have joined it first.
+* @param name const char* shm_open name, the one given to amulet_emu -v
+* @return int 0, or -1 with errno set
+*/
+int hostClockOpen(const char * name){
+	hostClockClose();
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0660);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, sizeof(HostClockShared)) != 0){
+		::close(fd);
+		return -1;
+	}
+	void * map = mmap(NULL, sizeof(HostClockShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	_clock = (HostClockShared *)map;
+	uint32_t peer = _clock->peer.load();
+	if (peer && kill(peer, 0) != 0)  //left behind by an emulator that is gone
+		_clock->peer.store(0);
+	_clock->micros.store(0);
+	_clock->steps.store(0);
+	_clock->drop.store(0);
+	_clock->magic.store(HOST_CLOCK_MAGIC);
+	strncpy(_clockName, name, sizeof(_clockName) - 1);
+	_clockName[sizeof(_clockName) - 1] = 0;
+	_sent0 = Serial.bytesSent();
+	_received0 = Serial.bytesReceived();
+	return 0;
+}
+
+/**
+* Unmap and remove the segment. hostClockMillis and hostClockMicros then read the real clock.
+*/
+void hostClockClose(){
+	if (!_clock)
+		return;
+	munmap(_clock, sizeof(HostClockShared));
+	shm_unlink(_clockName);
+	_clock = NULL;
+}
+
+/**
+* @return HostClockShared* the segment, e.g. to set drop. NULL if not open.
+*/
+HostClockShared * hostClock(){
+	return _clock;
+}
+
+/**
+* clockSource for AmuletLCD::setClock. Reading the time never moves it.
+*/
+unsigned long hostClockMillis(){
+	return _clock ? (unsigned long)(_clock->micros.load() / 1000) : millis();
+}
+
+unsigned long hostClockMicros(){
+	return _clock ? (unsigned long)_clock->micros.load() : micros();
+}
+
+/**
+* idleHook for AmuletLCD::setIdleHook. Moves the time HOST_CLOCK_STEP_US if nothing is in flight
+* in either direction. Otherwise the emulator is still working, and the time stands still.
+*/
+void hostClockIdle(){
+	if (!_clock)
+		return;
+	if (_clock->peer.load()){
+		uint32_t rx = _clock->peerRx.load(std::memory_order_acquire);  //covers the replies counted in peerTx
+		uint32_t tx = _clock->peerTx.load(std::memory_order_acquire);
+		if (rx != Serial.bytesSent() - _sent0 || tx != Serial.bytesReceived() - _received0)
+			return;
+	}
+	if (Serial.available() != 0)
+		return;
+	_clock->micros += HOST_CLOCK_STEP_US;
+	_clock->steps++;
+}
+
+/**
+* Move the time forward by hand, e.g. to age the local copies read by fetchWord.
+* @param us unsigned long microseconds
+*/
+void hostClockAdvance(unsigned long us){
+	if (_clock)
+		_clock->micros += us;
+}
@@ -0,0 +1,74 @@
+/*
+  HostClock.h - Virtual clock for testing AmuletLCD timeouts and retries on a Linux host
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  The time lives in a shared memory segment that amulet_emu -v joins. It only moves while
+  every party is idle: a blocking command is waiting, the emulator has handled every byte
+  the host sent, and the host has read and parsed every byte the emulator sent. Then each
+  pass of the wait loop moves it HOST_CLOCK_STEP_US, so a command the emulator leaves
+  unanswered times out after exactly the same number of passes, without waiting for it.
+  amulet_emu -b adds the wire time of each frame to the clock instead of sleeping.
+
+  Example:
+    amulet_emu -l /tmp/amulet -v /amulet_clock &
+    Serial.open("/tmp/amulet");
+    hostClockOpen("/amulet_clock");              //before any traffic
+    myModule.setClock(hostClockMillis, hostClockMicros);
+    myModule.setIdleHook(hostClockIdle);         //or call hostClockIdle from your own hook
+    hostClock()->drop = 3;                       //the emulator ignores every 3rd command
+    myModule.setWord(5, 1);                      //retries after 200 virtual ms
+
+  Without an emulator joined, the clock moves whenever the host waits with nothing to read.
+  AmuletEventLoop still sleeps in real time.
+ */
+
+#ifndef HostClock_h
+#define HostClock_h
+
+#include <stdint.h>
+#include <atomic>
+
+// Set once the segment is set up. Changes whenever the layout does.
+#define HOST_CLOCK_MAGIC     0x414D4301
+// Virtual time that passes for each idle pass of a wait loop
+#ifndef HOST_CLOCK_STEP_US
+#define HOST_CLOCK_STEP_US   1000
+#endif
+
+/**
+* struct shared by the host and amulet_emu -v. Byte counts wrap.
+*/
+typedef struct {
+	std::atomic<uint32_t> magic;
+	std::atomic<uint32_t> peer;     //pid of the emulator, 0 if none has joined
+	std::atomic<uint64_t> micros;   //the virtual time
+	std::atomic<uint32_t> steps;    //idle passes that moved it
+	std::atomic<uint32_t> peerTx;   //bytes the emulator has written, stored before peerRx
+	std::atomic<uint32_t> peerRx;   //bytes from the host the emulator has handled
+	std::atomic<uint32_t> drop;     //the emulator leaves every drop-th command unanswered, 0 for none
+	std::atomic<uint32_t> dropped;  //commands it left unanswered
+} HostClockShared;
+
+int hostClockOpen(const char * name);
+void hostClockClose();
+HostClockShared * hostClock();
+unsigned long hostClockMillis();
+unsigned long hostClockMicros();
+void hostClockIdle();
+void hostClockAdvance(unsigned long us);
+
+#endif
@@ -0,0 +1,44 @@
+/*
+  HostImage.cpp - File storage for AmuletLCD images on a Linux host.
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "HostImage.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static int _imageFd = -1;
+
+/**
+* Open or create the image file. A file opened before is closed.
+* @param path const char* the file
+* @return int 0, or -1 with errno set
+*/
+int hostImageOpen(const char * path){
+	hostImageClose();
+	_imageFd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	return (_imageFd < 0) ? -1 : 0;
+}
+
+void hostImageClose(){
+	if (_imageFd >= 0)
+		::close(_imageFd);
+	_imageFd = -1;
+}
+
+/**
+* imageRead for restoreImage. Fails if the file is shorter, e.g. before the first saveImage.
+*/
+uint8_t hostImageRead(uint32_t offset, uint8_t * data, uint16_t length){
+	return (_imageFd >= 0) && (pread(_imageFd, data, length, offset) == (ssize_t)length);
+}
+
+/**
+* imageWrite for saveImage. saveImage writes the header at offset 0 last, so that is when the
+* image is flushed to the disk.
+*/
+uint8_t hostImageWrite(uint32_t offset, const uint8_t * data, uint16_t length){
+	if ((_imageFd < 0) || (pwrite(_imageFd, data, length, offset) != (ssize_t)length))
+		return false;
+	return (offset != 0) || (fdatasync(_imageFd) == 0);
+}
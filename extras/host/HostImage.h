@@ -0,0 +1,41 @@
+/*
+  HostImage.h - File storage for AmuletLCD images on a Linux host
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  Stands in for the EEPROM of an Arduino: saveImage and restoreImage of AmuletLCD take
+  hostImageWrite and hostImageRead, which keep the image in one file.
+
+  Example:
+    hostImageOpen("/var/lib/gateway/display.img");
+    myModule.setWordPointer(words, 256);
+    if (!myModule.restoreImage(hostImageRead))   //first run, no image yet
+      myModule.pullRange(_GET_WORD, 0, 256);
+    ...
+    myModule.saveImage(hostImageWrite);
+ */
+
+#ifndef HostImage_h
+#define HostImage_h
+
+#include <stdint.h>
+
+int hostImageOpen(const char * path);
+void hostImageClose();
+uint8_t hostImageRead(uint32_t offset, uint8_t * data, uint16_t length);
+uint8_t hostImageWrite(uint32_t offset, const uint8_t * data, uint16_t length);
+
+#endif
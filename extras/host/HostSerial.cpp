@@ -0,0 +1,265 @@
+/*
+  HostSerial.cpp - Arduino style Serial on a Linux tty or pty.
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "Arduino.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+HostSerial Serial;
+
+/**
+* Standard termios rates. A baud rate not in this table is rounded down to the nearest entry.
+*/
+static const struct {
+	unsigned long baud;
+	speed_t       speed;
+} _Speeds[] = {
+	{1200, B1200}, {2400, B2400}, {4800, B4800}, {9600, B9600}, {19200, B19200},
+	{38400, B38400}, {57600, B57600}, {115200, B115200}, {230400, B230400},
+#ifdef B460800
+	{460800, B460800}, {500000, B500000}, {576000, B576000}, {921600, B921600},
+	{1000000, B1000000}, {1152000, B1152000}, {1500000, B1500000}, {2000000, B2000000},
+#endif
+};
+
+HostSerial::HostSerial(){
+	_fd = -1;
+	_owner = false;
+	_speed = 0;
+	_readCalls = 0;
+	_bytesReceived = 0;
+	_bytesSent = 0;
+	_writeCalls = 0;
+	_rxStart = 0;
+	_rxEnd = 0;
+}
+
+HostSerial::~HostSerial(){
+	end();
+}
+
+/**
+* Open the serial device. Call before AmuletLCD::begin, which configures it.
+* @param path const char* the device, e.g. /dev/ttyS1, /dev/ttyUSB0 or a pty slave
+* @return int 0 on success, -1 with errno set otherwise
+*/
+int HostSerial::open(const char * path){
+	end();
+	int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	_fd = fd;
+	_owner = true;
+	return 0;
+}
+
+/**
+* Use a file descriptor that is already open, e.g. one end of a pty pair. It is not closed by end().
+* @param fd int the descriptor, switched to non-blocking
+*/
+void HostSerial::attach(int fd){
+	end();
+	_fd = fd;
+	_owner = false;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+void HostSerial::begin(unsigned long baud){
+	begin(baud, SERIAL_8N1);
+}
+
+/**
+* Put the port in raw mode and apply the baud rate and frame format.
+* @param baud unsigned long bits per second
+* @param config uint8_t SERIAL_8N1 etc., decoded the same way as the AVR core
+*/
+void HostSerial::begin(unsigned long baud, uint8_t config){
+	struct termios tio;
+	speed_t speed = B1200;
+	_rxStart = _rxEnd = 0;
+	if (_fd < 0 || tcgetattr(_fd, &tio) != 0)
+		return;   //not a tty (pipe, socket): nothing to configure
+	_speed = _Speeds[0].baud;
+	for (uint8_t i = 0; i < sizeof(_Speeds) / sizeof(_Speeds[0]); i++){
+		if (_Speeds[i].baud <= baud){
+			speed = _Speeds[i].speed;
+			_speed = _Speeds[i].baud;
+		}
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+	tio.c_cflag |= CLOCAL | CREAD;
+	switch ((config >> 1) & 0x03){
+		case 0:  tio.c_cflag |= CS5; break;
+		case 1:  tio.c_cflag |= CS6; break;
+		case 2:  tio.c_cflag |= CS7; break;
+		default: tio.c_cflag |= CS8; break;
+	}
+	if (config & 0x20)
+		tio.c_cflag |= PARENB;
+	if ((config & 0x30) == 0x30)
+		tio.c_cflag |= PARODD;
+	if (config & 0x08)
+		tio.c_cflag |= CSTOPB;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	tcsetattr(_fd, TCSANOW, &tio);
+	tcflush(_fd, TCIOFLUSH);
+}
+
+void HostSerial::end(){
+	if (_fd >= 0 && _owner)
+		::close(_fd);
+	_fd = -1;
+	_owner = false;
+	_rxStart = _rxEnd = 0;
+}
+
+/**
+* Pull whatever the kernel has buffered into the receive buffer with one read() call.
+* @return int bytes added, 0 if nothing was waiting or the buffer is full, -1 on error or hangup
+*/
+int HostSerial::fill(){
+	if (_fd < 0)
+		return -1;
+	if (_rxStart == _rxEnd){
+		_rxStart = _rxEnd = 0;
+	}
+	else if (_rxEnd == HOST_SERIAL_RX_LEN && _rxStart > 0){
+		memmove(_rx, _rx + _rxStart, _rxEnd - _rxStart);
+		_rxEnd -= _rxStart;
+		_rxStart = 0;
+	}
+	if (_rxEnd == HOST_SERIAL_RX_LEN)
+		return 0;
+	ssize_t n = ::read(_fd, _rx + _rxEnd, HOST_SERIAL_RX_LEN - _rxEnd);
+	if (n > 0){
+		_rxEnd += n;
+		_readCalls++;
+		_bytesReceived += n;
+		return n;
+	}
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	return -1;
+}
+
+/**
+* Bytes waiting in the receive buffer. If it is empty, the kernel is checked once,
+* so blocking AmuletLCD calls still see replies without an event loop.
+*/
+int HostSerial::available(){
+	if (_rxStart == _rxEnd)
+		fill();
+	return _rxEnd - _rxStart;
+}
+
+int HostSerial::peek(){
+	if (available() == 0)
+		return -1;
+	return _rx[_rxStart];
+}
+
+int HostSerial::read(){
+	if (available() == 0)
+		return -1;
+	return _rx[_rxStart++];
+}
+
+/**
+* Free space in the kernel transmit queue, taken as HOST_SERIAL_TX_LEN bytes.
+*/
+int HostSerial::availableForWrite(){
+	int queued = 0;
+	if (_fd < 0)
+		return 0;
+	if (ioctl(_fd, TIOCOUTQ, &queued) != 0)
+		queued = 0;
+	return (queued < HOST_SERIAL_TX_LEN) ? HOST_SERIAL_TX_LEN - queued : 0;
+}
+
+size_t HostSerial::write(uint8_t b){
+	return write(&b, 1);
+}
+
+/**
+* Write the whole buffer, waiting for room like HardwareSerial does when its buffer is full.
+* @return size_t bytes written, less than len only on error
+*/
+size_t HostSerial::write(const uint8_t * buf, size_t len){
+	size_t done = 0;
+	if (_fd < 0)
+		return 0;
+	while (done < len){
+		ssize_t n = ::write(_fd, buf + done, len - done);
+		if (n > 0){
+			done += n;
+			_bytesSent += n;
+			_writeCalls++;
+		}
+		else if (n < 0 && errno == EAGAIN){
+			struct pollfd p = {_fd, POLLOUT, 0};
+			poll(&p, 1, -1);
+		}
+		else if (!(n < 0 && errno == EINTR)){
+			break;
+		}
+	}
+	return done;
+}
+
+/**
+* Wait until everything written has left the port.
+*/
+void HostSerial::flush(){
+	if (_fd >= 0)
+		tcdrain(_fd);
+}
+
+/**
+* @return int the file descriptor of the port, for epoll. -1 if not open.
+*/
+int HostSerial::fd(){
+	return _fd;
+}
+
+/**
+* @return unsigned long the baud rate applied by begin, after rounding to a termios rate. 0 for non-tty descriptors.
+*/
+unsigned long HostSerial::speed(){
+	return _speed;
+}
+
+/**
+* @return uint32_t read() calls that returned data. bytesReceived() / readCalls() is the average chunk size.
+*/
+uint32_t HostSerial::readCalls(){
+	return _readCalls;
+}
+
+uint32_t HostSerial::bytesReceived(){
+	return _bytesReceived;
+}
+
+uint32_t HostSerial::bytesSent(){
+	return _bytesSent;
+}
+
+/**
+* @return uint32_t write() calls that wrote data. bytesSent() / writeCalls() is the average chunk size.
+*/
+uint32_t HostSerial::writeCalls(){
+	return _writeCalls;
+}
+
+HostSerial::operator bool(){
+	return _fd >= 0;
+}
@@ -0,0 +1,85 @@
+/*
+  HostSerial.h - Arduino style Serial on a Linux tty or pty
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  The port is opened raw and non-blocking. Received bytes are pulled from the kernel with one
+  read() per call to fill(), as many as fit in the receive buffer, and handed to the
+  AmuletLCD parser from memory. See AmuletEventLoop for driving fill() from epoll.
+ */
+
+#ifndef HostSerial_h
+#define HostSerial_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Receive buffer, the most one read() call can return
+#ifndef HOST_SERIAL_RX_LEN
+#define HOST_SERIAL_RX_LEN   4096
+#endif
+// Reported by availableForWrite, less whatever is still queued in the kernel
+#ifndef HOST_SERIAL_TX_LEN
+#define HOST_SERIAL_TX_LEN   4096
+#endif
+
+/**
+* A class used to stand in for the Arduino HardwareSerial on a Linux host.
+*/
+class HostSerial
+{
+  public:
+	HostSerial();
+	~HostSerial();
+	int open(const char * path);
+	void attach(int fd);
+	void begin(unsigned long baud);
+	void begin(unsigned long baud, uint8_t config);
+	void end();
+
+	int available();
+	int peek();
+	int read();
+	int availableForWrite();
+	size_t write(uint8_t b);
+	size_t write(const uint8_t * buf, size_t len);
+	void flush();
+
+	int fill();
+	int fd();
+	unsigned long speed();
+	uint32_t readCalls();
+	uint32_t bytesReceived();
+	uint32_t bytesSent();
+	uint32_t writeCalls();
+	operator bool();
+
+  private:
+	int _fd;
+	uint8_t _owner;             //true if open() opened _fd, so end() closes it
+	unsigned long _speed;       //baud rate actually applied to the port
+	uint32_t _readCalls;        //read() system calls that returned data
+	uint32_t _bytesReceived;
+	uint32_t _bytesSent;
+	uint32_t _writeCalls;       //write() system calls that wrote data
+	uint16_t _rxStart;
+	uint16_t _rxEnd;
+	uint8_t _rx[HOST_SERIAL_RX_LEN];
+};
+
+extern HostSerial Serial;
+
+#endif
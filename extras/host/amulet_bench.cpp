@@ -0,0 +1,659 @@
+/*
+  amulet_bench.cpp - Latency and throughput of AmuletLCD on a Linux serial port or pty.
+
+  Master mode (default) times blocking requestWord round trips and requestWords / setWords
+  array transfers. With -l it runs AmuletLCD::linkTest instead and prints its results. With -t, that many threads share the port, first through one mutex around
+  blocking calls, then through AmuletIOThread. With -p it times urgent Set Words on an AmuletIOThread
+  while its bulk lane streams the Word array, sent in chunks and then whole; run it against
+  amulet_emu -b so the frames take their wire time. With -u, port is the socket of amulet_bridge, and
+  that many clients (-t, default 4) send batches of a Set Words and a Get Words to it. With -v, the
+  clock of amulet_emu -v is used to run blocking commands while the emulator leaves every 1st, 2nd,
+  3rd... command unanswered; timeouts pass in virtual time and the results are the same on every run.
+  Then the polling scheduler is checked to refill its budget after a long idle gap.
+  With -v and -k, the emulator stops answering as if the display were unplugged: count blocking Set
+  Words take their full retries without a link monitor and fail at once with one, a quiet link is
+  found down by its heartbeat, and the Word array changed meanwhile is pushed back once it answers.
+  With -w, count fire-and-forget Set Words are sent in bursts of 10 per ms, first one write() per
+  frame, then batched by setTxBatchPointer in a 64 byte buffer (the AVR transmit buffer) with a
+  500us limit or a flush() after each burst, then in a 256 byte buffer. write() calls per 1000
+  sets and the added latency are reported, and typed handle Sets are checked to stay in order
+  with batched ones.
+  With -x, no port is needed: the byte order kernels of AmuletEndian.h are checked against a byte at
+  a time loop and both are timed on 64 B, 256 B and 1 KB arrays. The backend is picked at compile
+  time, so rebuild with e.g. CXXFLAGS="-O2 -mavx2" (make clean first) to time another one.
+  Slave mode runs AmuletEventLoop and answers a display, or amulet_emu -d,
+  until it hangs up, then reports how many read() calls the received bytes took.
+
+  Usage:
+    amulet_bench port [-b baud] [-e] [-l] [-n count] [-p] [-s] [-t threads] [-u] [-v clock [-k]] [-w] [-x]
+    make bench    (runs both modes against amulet_emu over a pty pair)
+
+  Built with AMULET_LATENCY (make clean; CXXFLAGS="-O2 -DAMULET_LATENCY" make bench), slave mode
+  also reports how long each stage of handling a command from the display took, per opcode.
+
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "Arduino.h"
+#include "AmuletLCD.h"
+#include "AmuletVar.h"
+#include "AmuletEndian.h"
+#include "AmuletEventLoop.h"
+#include "AmuletIOThread.h"
+#include "AmuletBridge.h"
+#include "HostClock.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static uint16_t AmuletWords[256];
+static AmuletLCD myModule;
+static AmuletEventLoop events;
+static AmuletIOThread io;
+#ifdef AMULET_LATENCY
+static AmuletLatency latency[8];
+
+static void reportLatency(){
+	static const char * stages[AMULET_STAGES] = {"wait", "receive", "crc", "handler", "reply", "turnaround"};
+	for (int k = 0; k < 8; k++){
+		if (latency[k].opcode == 0)
+			continue;
+		printf("opcode 0x%02X, %lu replies\n", latency[k].opcode, (unsigned long)latency[k].count);
+		for (uint8_t s = 0; s < AMULET_STAGES; s++){
+			uint32_t mn, avg, mx, p99;
+			myModule.latencyStats(latency[k].opcode, s, &mn, &avg, &mx, &p99);
+			printf("  %-11s us min %-5lu avg %-5lu p99 %-5lu max %lu\n", stages[s],
+			       (unsigned long)mn, (unsigned long)avg, (unsigned long)p99, (unsigned long)mx);
+		}
+	}
+}
+#endif
+
+static void report(const char * name, std::vector<unsigned long> & us){
+	std::sort(us.begin(), us.end());
+	double sum = 0;
+	for (size_t i = 0; i < us.size(); i++)
+		sum += us[i];
+	size_t n = us.size();
+	printf("%-14s n %-6zu us min %lu avg %.1f p50 %lu p99 %lu max %lu\n", name, n,
+	       us[0], sum / n, us[n / 2], us[(n * 99) / 100], us[n - 1]);
+}
+
+/**
+* count Set Word commands split over threads, through a mutex and then through the I/O thread.
+* Each thread waits for every one of its commands to be acknowledged, like the HMI logic would.
+*/
+static int sharedPort(int threads, long count){
+	std::mutex port;
+	std::vector<std::thread> pool;
+	std::vector<unsigned long> us(count);
+	unsigned long start = micros();
+	for (int t = 0; t < threads; t++){
+		pool.push_back(std::thread([&, t]{
+			for (long k = t; k < count; k += threads){
+				unsigned long t0 = micros();
+				std::lock_guard<std::mutex> hold(port);
+				myModule.setWord(t, k, true);
+				us[k] = micros() - t0;
+			}
+		}));
+	}
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+	double secs = (micros() - start) / 1e6;
+	report("mutex", us);
+	printf("%-14s %d threads, %.0f commands/s\n", "", threads, count / secs);
+
+	pool.clear();
+	io.begin(&myModule);
+	start = micros();
+	for (int t = 0; t < threads; t++){
+		pool.push_back(std::thread([&, t]{
+			for (long k = t; k < count; k += threads){
+				unsigned long t0 = micros();
+				io.setWord(t, k).get();
+				us[k] = micros() - t0;
+			}
+		}));
+	}
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+	secs = (micros() - start) / 1e6;
+	io.stop();
+	report("io thread", us);
+	printf("%-14s %d threads, %.0f commands/s, %.2f commands per wakeup\n", "", threads, count / secs,
+	       (double)io.completed() / io.wakeups());
+	return 0;
+}
+
+/**
+* count urgent Set Word requests, one every 1-2 ms, while another thread keeps the bulk lane busy with
+* pushRange of all 256 words. An urgent request waits for at most the bulk chunk in flight.
+*/
+static int priorityLanes(long count){
+	for (int pass = 0; pass < 2; pass++){
+		AmuletIOThread lanes;
+		std::atomic<int> streaming(1);
+		std::vector<unsigned long> us;
+		long pushes = 0;
+		lanes.setChunk(pass ? 0 : AMULET_IO_CHUNK);
+		lanes.begin(&myModule);
+		std::thread bulk([&]{
+			while (streaming.load()){
+				lanes.pushRange(_GET_WORD, 0, 256).get();
+				pushes++;
+			}
+		});
+		for (long k = 0; k < count; k++){
+			usleep(1000 + rand() % 1000);
+			unsigned long t0 = micros();
+			if (!lanes.setWord(0, k).get().ok){
+				printf("urgent setWord %ld failed\n", k);
+				return 1;
+			}
+			us.push_back(micros() - t0);
+		}
+		streaming.store(0);
+		bulk.join();
+		lanes.stop();
+		report(pass ? "urgent, whole" : "urgent, chunk", us);
+		printf("%-14s bulk %u bytes at a time, %ld pushes of 512 bytes, %lu preemptions\n", "",
+		       pass ? 512 : (unsigned)AMULET_IO_CHUNK / 2 * 2, pushes, (unsigned long)lanes.preemptions());
+	}
+	return 0;
+}
+
+/**
+* count batches from clients connected to amulet_bridge at path. Client t sets words 4t to 4t+3 and
+* reads words 0 to 31 in each batch, so the batches of a round merge into one transfer each way.
+*/
+static int bridgeClients(const char * path, int clients, long count){
+	std::vector<std::thread> pool;
+	std::vector<unsigned long> us(count);
+	std::atomic<int> failed(0);
+	AmuletBridgeClient totals;  //connected throughout, so amulet_bridge -1 waits for the report
+	AmuletBridgeStats s;
+	if (totals.open(path) != 0){
+		perror(path);
+		return 1;
+	}
+	unsigned long start = micros();
+	for (int t = 0; t < clients; t++){
+		pool.push_back(std::thread([&, t]{
+			AmuletBridgeClient c;
+			if (c.open(path) != 0){
+				perror(path);
+				failed++;
+				return;
+			}
+			for (long k = t; k < count; k += clients){
+				uint16_t set[4] = {(uint16_t)k, (uint16_t)k, (uint16_t)k, (uint16_t)k};
+				uint16_t got[32];
+				unsigned long t0 = micros();
+				c.begin();
+				c.set(_GET_WORD, 4 * t, 4, set);
+				c.get(_GET_WORD, 0, 32, got);
+				if (c.transact() != 2 || got[4 * t] != (uint16_t)k){
+					printf("batch %ld failed\n", k);
+					failed++;
+					return;
+				}
+				us[k] = micros() - t0;
+			}
+		}));
+	}
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+	double secs = (micros() - start) / 1e6;
+	if (failed.load())
+		return 1;
+	totals.begin();
+	totals.stats(&s);
+	if (totals.transact() != 1){
+		perror("stats");
+		return 1;
+	}
+	report("bridge", us);
+	printf("%-14s %d clients, %.0f batches/s, %lu ops in %lu transfers, %.2f ops per transfer\n", "", clients,
+	       count / secs, (unsigned long)s.roundOps, (unsigned long)s.transfers, (double)s.roundOps / s.transfers);
+	return 0;
+}
+
+/**
+* The polling scheduler after an idle gap of about 6 minutes of virtual time, long enough for the
+* token refill to wrap 32 bits at this rate. The bucket is drained first, so only a full refill
+* lets the subscription go out. Subscriptions to a bank other than Byte, Word or Color, or past the
+* end of the local array, must be refused.
+*/
+static int pollGap(unsigned long baud){
+	static AmuletPoll polls[1];
+	uint32_t rate = (baud / 10) * 100 / 100;  //bytes/s at a 100% budget, see pollUpdate
+	uint8_t frames = 0;
+	myModule.setPollPointer(polls, 1);
+	myModule.setPollBudget(100);
+	int refused = (myModule.subscribe(0, 0, 1, 1) < 0) + (myModule.subscribe(_SET_WORD, 0, 1, 1) < 0)
+	            + (myModule.subscribe(_GET_WORD, 250, 10, 1) < 0);
+	printf("%-14s %d of 3 bad subscriptions refused\n", "subscribe", refused);
+	myModule.subscribe(_GET_WORD, 0, 24, 1);
+	for (int ms = 0; ms < 200; ms++){  //every ms refills less than one frame costs
+		hostClockAdvance(1000);
+		myModule.pollUpdate();
+	}
+	hostClockAdvance(((0xFFFFFFFFUL / rate) + 1) * 1000);
+	frames = myModule.pollUpdate();
+	myModule.setPollPointer(NULL, 0);
+	printf("%-14s %u frame after %lu virtual s idle\n", "poll gap", frames,
+	       (unsigned long)((0xFFFFFFFFUL / rate + 1) / 1000));
+	return (frames && refused == 3) ? 0 : 1;
+}
+
+/**
+* count blocking Set Words and Get Words for each drop setting of the emulator, in virtual time.
+* The digest covers every result and virtual time, so two runs can be compared at a glance.
+*/
+static int retryMatrix(const char * clock, long count, unsigned long baud){
+	static const uint32_t drops[] = {0, 7, 3, 2, 1};
+	uint32_t digest = 2166136261U;
+	if (hostClockOpen(clock) != 0){
+		perror(clock);
+		return 1;
+	}
+	myModule.setClock(hostClockMillis, hostClockMicros);
+	myModule.setIdleHook(hostClockIdle);
+	for (size_t d = 0; d < sizeof(drops) / sizeof(drops[0]); d++){
+		long n = drops[d] == 1 ? (count < 10 ? count : 10) : count;  //every one fails: 12 timeouts each
+		long ok = 0;
+		uint32_t retries = myModule.retryCount();
+		unsigned long v0 = hostClockMillis();
+		unsigned long t0 = micros();
+		hostClock()->drop = drops[d];
+		for (long k = 0; k < n; k++){
+			uint8_t r = (k & 1) ? myModule.requestWord(k & 0xFF) : myModule.setWord(k & 0xFF, k);
+			ok += r;
+			digest = (digest ^ (r + hostClockMillis())) * 16777619U;
+		}
+		hostClock()->drop = 0;
+		printf("drop every %-3u %4ld commands, %4ld ok, %5lu retries, %8lu virtual ms in %6.1f real ms\n",
+		       drops[d], n, ok, (unsigned long)(myModule.retryCount() - retries), hostClockMillis() - v0,
+		       (micros() - t0) / 1000.0);
+	}
+	printf("%lu idle steps, %lu commands left unanswered, digest %08lx\n", (unsigned long)hostClock()->steps.load(),
+	       (unsigned long)hostClock()->dropped.load(), (unsigned long)digest);
+	int result = pollGap(baud);
+	hostClockClose();
+	return result;
+}
+
+static void onLink(uint8_t up){
+	printf("%-14s hook: link %s at %lu virtual ms\n", "", up ? "up" : "down", hostClockMillis());
+}
+
+/**
+* count blocking Set Words while the emulator leaves everything unanswered, first without and then with
+* a link monitor of 3 timeouts and a 500 ms heartbeat, in virtual time. Then the local Word array changes
+* while the link is down, the emulator answers again, and checkLink runs every 10 ms until it has pushed
+* the array back. Heartbeats on the live link must change neither the display nor the local array.
+* Finally a quiet link is left to the heartbeat to find down.
+*/
+static int linkLoss(const char * clock, long count){
+	static uint16_t before[256];
+	if (hostClockOpen(clock) != 0){
+		perror(clock);
+		return 1;
+	}
+	myModule.setClock(hostClockMillis, hostClockMicros);
+	myModule.setIdleHook(hostClockIdle);
+	for (int pass = 0; pass < 2; pass++){
+		unsigned long v0 = hostClockMillis();
+		long failed = 0;
+		if (pass)
+			myModule.setLinkMonitor(3, 500, onLink);
+		hostClock()->drop = 1;
+		for (long k = 0; k < count; k++)
+			failed += !myModule.setWord(k & 0xFF, k, true);
+		printf("%-14s %ld of %ld Set Words failed in %lu virtual ms\n", pass ? "monitor" : "no monitor",
+		       failed, count, hostClockMillis() - v0);
+	}
+	for (int k = 0; k < 256; k++)
+		AmuletWords[k] = 0xA000 + k;
+	hostClock()->drop = 0;
+	unsigned long v0 = hostClockMillis();
+	uint32_t sent = Serial.bytesSent();
+	while (!myModule.checkLink())
+		hostClockAdvance(10000);
+	printf("%-14s up again after %lu virtual ms, %lu bytes sent to resync\n", "resync",
+	       hostClockMillis() - v0, (unsigned long)(Serial.bytesSent() - sent));
+	memcpy(before, AmuletWords, sizeof(before));
+	int mismatches = 0;
+	if (!myModule.pullRange(_GET_WORD, 0, 256))
+		mismatches = -1;
+	for (int k = 0; k < 256; k++)
+		mismatches += AmuletWords[k] != before[k];
+	printf("%-14s display %s the local Word array\n", "", mismatches ? "does not match" : "matches");
+	AmuletWords[0] = 0x5A5A;
+	v0 = hostClockMillis();
+	while (hostClockMillis() - v0 < 2000){
+		myModule.checkLink();
+		hostClockAdvance(10000);
+	}
+	int kept = AmuletWords[0] == 0x5A5A;
+	if (!myModule.pullRange(_GET_WORD, 0, 1) || AmuletWords[0] != before[0] || !kept)
+		mismatches++;
+	printf("%-14s 2000 virtual ms of heartbeats %s word 0\n", "", (AmuletWords[0] == before[0] && kept) ? "left alone" : "changed");
+	hostClock()->drop = 1;
+	v0 = hostClockMillis();
+	while (myModule.checkLink())
+		hostClockAdvance(10000);
+	printf("%-14s quiet link found down after %lu virtual ms\n", "heartbeat", hostClockMillis() - v0);
+	hostClock()->drop = 0;
+	hostClockClose();
+	return mismatches ? 1 : 0;
+}
+
+/**
+* ns per call of fn, averaged over enough calls to move about 4 MB.
+*/
+template <class F> static double nsPerCall(uint16_t bytes, F fn){
+	long reps = (4L << 20) / bytes;
+	auto t0 = std::chrono::steady_clock::now();
+	for (long r = 0; r < reps; r++){
+		fn();
+		__asm__ __volatile__("" ::: "memory");  //keep every call
+	}
+	std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - t0;
+	return ns.count() / reps;
+}
+
+/**
+* The AmuletEndian.h kernels next to the byte at a time loops the reply handlers used before them.
+* Every kernel's output is compared with the loop's, so a broken backend fails the bench.
+*/
+static int endianKernels(){
+	static const uint16_t sizes[] = {64, 256, 1024};
+	static uint8_t wire[1024], out[1024], ref[1024];
+	static uint16_t words[512], wordsRef[512];
+	static uint32_t colors[256], colorsRef[256];
+	#if defined(AMULET_ENDIAN_COPY)
+	const char * backend = "copy (big endian)";
+	#elif defined(AMULET_ENDIAN_AVX2)
+	const char * backend = "AVX2";
+	#elif defined(AMULET_ENDIAN_SSSE3)
+	const char * backend = "SSSE3";
+	#elif defined(AMULET_ENDIAN_BSWAP)
+	const char * backend = "bswap";
+	#else
+	const char * backend = "byte loop";
+	#endif
+	for (int i = 0; i < 1024; i++)
+		wire[i] = (uint8_t)(i * 7 + 3);
+	printf("endian kernels, %s backend, ns per call: byte loop -> kernel\n", backend);
+	for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++){
+		uint16_t bytes = sizes[z];
+		uint16_t nw = bytes / 2, nc = bytes / 4;
+		double t[10];
+		t[0] = nsPerCall(bytes, [&]{
+			for (uint16_t i = 0; i < nw; i++)
+				wordsRef[i] = ((uint16_t)wire[2 * i] << 8) | wire[2 * i + 1];
+		});
+		t[1] = nsPerCall(bytes, [&]{ amuletDecodeWords(words, wire, nw); });
+		t[2] = nsPerCall(bytes, [&]{
+			for (uint16_t i = 0; i < nc; i++)
+				colorsRef[i] = ((uint32_t)wire[4 * i] << 24) | ((uint32_t)wire[4 * i + 1] << 16) |
+				               ((uint32_t)wire[4 * i + 2] << 8) | wire[4 * i + 3];
+		});
+		t[3] = nsPerCall(bytes, [&]{ amuletDecodeColors(colors, wire, nc); });
+		if (memcmp(words, wordsRef, bytes) || memcmp(colors, colorsRef, bytes)){
+			printf("endian: decode of %u bytes does not match the byte loop\n", bytes);
+			return 1;
+		}
+		t[4] = nsPerCall(bytes, [&]{
+			for (uint16_t i = 0; i < nw; i++){
+				ref[2 * i] = (uint8_t)(words[i] >> 8);
+				ref[2 * i + 1] = (uint8_t)words[i];
+			}
+		});
+		t[5] = nsPerCall(bytes, [&]{ amuletEncodeWords(out, words, nw); });
+		if (memcmp(out, ref, bytes) || memcmp(out, wire, bytes)){
+			printf("endian: word encode of %u bytes does not match the byte loop\n", bytes);
+			return 1;
+		}
+		t[6] = nsPerCall(bytes, [&]{
+			for (uint16_t i = 0; i < nc; i++){
+				ref[4 * i] = (uint8_t)(colors[i] >> 24);
+				ref[4 * i + 1] = (uint8_t)(colors[i] >> 16);
+				ref[4 * i + 2] = (uint8_t)(colors[i] >> 8);
+				ref[4 * i + 3] = (uint8_t)colors[i];
+			}
+		});
+		t[7] = nsPerCall(bytes, [&]{ amuletEncodeColors(out, colors, nc); });
+		if (memcmp(out, ref, bytes) || memcmp(out, wire, bytes)){
+			printf("endian: color encode of %u bytes does not match the byte loop\n", bytes);
+			return 1;
+		}
+		uint16_t crc = 0, fused = 0;
+		t[8] = nsPerCall(bytes, [&]{
+			amuletEncodeWords(out, words, nw);
+			crc = amuletCRCUpdate(_CRC_SEED, out, bytes);
+		});
+		t[9] = nsPerCall(bytes, [&]{ fused = amuletEncodeWordsCRC(out, words, nw, _CRC_SEED); });
+		if (crc != fused){
+			printf("endian: fused CRC of %u bytes is %04x, expected %04x\n", bytes, fused, crc);
+			return 1;
+		}
+		printf("%4u B  decode words %6.1f -> %6.1f  colors %6.1f -> %6.1f  encode words %6.1f -> %6.1f"
+		       "  colors %6.1f -> %6.1f  encode+CRC 2 pass %7.1f fused %7.1f\n", bytes,
+		       t[0], t[1], t[2], t[3], t[4], t[5], t[6], t[7], t[8], t[9]);
+	}
+	return 0;
+}
+
+/**
+* Batched Set Words and typed handle Sets to the same variables must reach the display in the order
+* they were made. The last Set of each variable decides what the display reads back.
+*/
+static int batchOrder(){
+	typedef AmuletLink<0, 0, 8, 0> OrderLink;
+	static uint16_t words[8];
+	static uint8_t batch[64];
+	OrderLink lcd;
+	OrderLink::Word<5> five(lcd);
+	OrderLink::Word<6> six(lcd);
+	lcd.begin(115200);
+	lcd.setWordPointer(words);
+	lcd.setTxBatchPointer(batch, sizeof(batch), 0);
+	for (uint16_t k = 1; k <= 3; k++)
+		lcd.setWord(5, k, false);
+	five.set(100, false);             //last to 5
+	six.set(300, false);
+	lcd.setWord(6, 200, false);       //last to 6
+	lcd.flush();
+	lcd.setTxBatchPointer(NULL, 0, 0);
+	if (!lcd.requestWord(5) || !lcd.requestWord(6) || words[5] != 100 || words[6] != 200){
+		printf("batch order: display has %u and %u, expected 100 and 200\n", words[5], words[6]);
+		return 1;
+	}
+	printf("%-14s typed and batched Sets arrive in order\n", "batch order");
+	return 0;
+}
+
+/**
+* count Set Words without waiting for the reply, 10 at the start of every ms, with serialEvent
+* reading the replies in between. Latency is from setWord returning to its frame reaching write().
+*/
+static int txBatching(long count, uint8_t ea){
+	static const char * names[] = {"unbatched", "64B, 500us", "64B, flush", "256B, 500us"};
+	uint8_t batch[256];
+	for (int pass = 0; pass < 4; pass++){
+		std::vector<unsigned long> queued;
+		unsigned long sum = 0, worst = 0;
+		uint32_t writes = Serial.writeCalls();
+		uint32_t sent = Serial.bytesSent();
+		long k = 0;
+		size_t done = 0;
+		auto written = [&]{  //frames are 7 + ea bytes, so the byte count tells which have been written
+			unsigned long now = micros();
+			for (; done < queued.size() && (done + 1) * (7 + ea) <= Serial.bytesSent() - sent; done++){
+				unsigned long us = now - queued[done];
+				sum += us;
+				worst = std::max(worst, us);
+			}
+		};
+		if (pass)
+			myModule.setTxBatchPointer(batch, pass == 3 ? 256 : 64, pass == 2 ? 0 : 500);
+		while (k < count || done < queued.size()){
+			unsigned long tick = micros();
+			for (int j = 0; j < 10 && k < count; j++, k++){
+				queued.push_back(micros());
+				if (!myModule.setWord(k & 0xFF, k, false)){
+					printf("setWord %ld failed\n", k);
+					return 1;
+				}
+				written();
+			}
+			if (pass == 2)
+				myModule.flush();
+			do {
+				myModule.serialEvent();
+				written();
+			} while (micros() - tick < 1000);
+		}
+		myModule.setTxBatchPointer(NULL, 0, 0);
+		delay(20);
+		myModule.serialEvent();
+		printf("%-14s %6.1f write() calls per 1000 sets, added latency us avg %lu max %lu\n", names[pass],
+		       (Serial.writeCalls() - writes) * 1000.0 / count, count ? sum / count : 0, worst);
+	}
+	return ea ? 0 : batchOrder();
+}
+
+int main(int argc, char ** argv){
+	unsigned long baud = 115200;
+	uint8_t ea = 0;
+	long count = 2000;
+	int slave = 0;
+	int threads = 0;
+	int link = 0;
+	int lanes = 0;
+	int bridge = 0;
+	int batching = 0;
+	int loss = 0;
+	int endian = 0;
+	const char * clock = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:ekln:pst:uv:wx")) != -1){
+		switch (opt){
+			case 'b': baud = atol(optarg); break;
+			case 'e': ea = 1; break;
+			case 'k': loss = 1; break;
+			case 'l': link = 1; break;
+			case 'n': count = atol(optarg); break;
+			case 'p': lanes = 1; break;
+			case 's': slave = 1; break;
+			case 't': threads = atoi(optarg); break;
+			case 'u': bridge = 1; break;
+			case 'v': clock = optarg; break;
+			case 'w': batching = 1; break;
+			case 'x': endian = 1; break;
+			default:
+				fprintf(stderr, "usage: %s port [-b baud] [-e] [-l] [-n count] [-p] [-s] [-t threads] [-u] [-v clock [-k]] [-w] [-x]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (endian)
+		return endianKernels();
+	if (bridge && optind < argc)
+		return bridgeClients(argv[optind], threads > 0 ? threads : 4, count);
+	if (optind >= argc || Serial.open(argv[optind]) != 0){
+		perror(optind < argc ? argv[optind] : "port");
+		return 1;
+	}
+	myModule.begin(baud, SERIAL_8N1, ea);
+	myModule.setWordPointer(AmuletWords, 256);
+
+	if (slave){
+		#ifdef AMULET_LATENCY
+		myModule.setLatencyPointer(latency, 8);
+		#endif
+		events.begin(&myModule);
+		events.run();
+		printf("slave: %lu bytes in %lu read() calls, %.1f bytes per call\n",
+		       (unsigned long)Serial.bytesReceived(), (unsigned long)Serial.readCalls(),
+		       Serial.readCalls() ? (double)Serial.bytesReceived() / Serial.readCalls() : 0.0);
+		#ifdef AMULET_LATENCY
+		reportLatency();
+		#endif
+		return 0;
+	}
+
+	if (clock && loss)
+		return linkLoss(clock, count);
+	if (clock)
+		return retryMatrix(clock, count, baud);
+	if (threads > 0)
+		return sharedPort(threads, count);
+	if (lanes)
+		return priorityLanes(count);
+	if (batching)
+		return txBatching(count, ea);
+
+	if (link){
+		AmuletLinkTest r;
+		uint8_t ok = myModule.linkTest(&r, 0, count > 255 ? 255 : count, "ping");
+		printf("linkTest %s at %lu baud, %u rounds\n", ok ? "passed" : "FAILED", (unsigned long)r.baud, r.rounds);
+		printf("  rtt us min %lu avg %lu max %lu, script avg %lu max %lu\n", (unsigned long)r.rttMin,
+		       (unsigned long)r.rttAvg, (unsigned long)r.rttMax, (unsigned long)r.scriptAvg, (unsigned long)r.scriptMax);
+		printf("  %u words per array: %lu frames/s, %lu payload bytes/s\n", r.arrayCount,
+		       (unsigned long)r.framesPerSec, (unsigned long)r.bytesPerSec);
+		printf("  %lu frames, %u retries, %u crc errors (%u per 10000), %u mismatches, %u failures\n",
+		       (unsigned long)r.frames, r.retries, r.crcErrors, r.crcErrorRate, r.mismatches, r.failures);
+		return ok ? 0 : 1;
+	}
+
+	std::vector<unsigned long> us;
+	for (long k = 0; k < count; k++){
+		unsigned long t0 = micros();
+		if (!myModule.requestWord(k & 0xFF)){
+			printf("requestWord %ld failed\n", k);
+			return 1;
+		}
+		us.push_back(micros() - t0);
+	}
+	report("requestWord", us);
+
+	uint8_t n = 24;  //fits the default 64 byte buffers
+	us.clear();
+	unsigned long start = micros();
+	for (long k = 0; k < count; k++){
+		unsigned long t0 = micros();
+		if (!myModule.requestWords(0, n)){
+			printf("requestWords %ld failed\n", k);
+			return 1;
+		}
+		us.push_back(micros() - t0);
+	}
+	double secs = (micros() - start) / 1e6;
+	report("requestWords", us);
+	printf("%-14s %.0f payload bytes/s, %.0f words/s\n", "", count * n * 2 / secs, count * n / secs);
+
+	us.clear();
+	start = micros();
+	for (long k = 0; k < count; k++){
+		unsigned long t0 = micros();
+		if (!myModule.setWords(0, n, true)){
+			printf("setWords %ld failed\n", k);
+			return 1;
+		}
+		us.push_back(micros() - t0);
+	}
+	secs = (micros() - start) / 1e6;
+	report("setWords", us);
+	printf("%-14s %.0f payload bytes/s\n", "", count * n * 2 / secs);
+	printf("rx: %lu bytes in %lu read() calls\n", (unsigned long)Serial.bytesReceived(), (unsigned long)Serial.readCalls());
+	return 0;
+}
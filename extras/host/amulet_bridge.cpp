@@ -0,0 +1,86 @@
+/*
+  amulet_bridge.cpp - Serve a display to local processes over a Unix domain socket, see AmuletBridge.h.
+
+  Owns the serial port and answers batches from AmuletBridgeClient. Prints the statistics of each
+  client as it disconnects.
+
+  Usage:
+    amulet_bridge port socket [-b baud] [-e] [-B bytes] [-W words] [-C colors] [-1]
+      -e         2 address bytes, like begin(baud, config, 1)
+      -B, -W, -C length of the local Byte, Word and Color arrays. Default 256 each.
+      -1         exit once the last client has disconnected
+    Stops on SIGINT or SIGTERM, or when the port hangs up.
+
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "Arduino.h"
+#include "AmuletLCD.h"
+#include "AmuletEventLoop.h"
+#include "AmuletBridge.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static AmuletLCD myModule;
+static AmuletEventLoop events;
+static AmuletBridge bridge;
+static int oneShot = 0;
+
+static void onSignal(int signum){
+	events.stop();
+}
+
+static void onDisconnect(uint8_t client, const AmuletBridgeStats * s, void * context){
+	double secs = s->connectedMs / 1000.0;
+	printf("client %u: %lu packets, %lu ops, %lu failed, %.0f ops/s, in %lu out %lu bytes, latency us min %lu avg %lu max %lu\n",
+	       client, (unsigned long)s->packets, (unsigned long)s->ops, (unsigned long)s->failures,
+	       secs > 0 ? s->ops / secs : 0.0, (unsigned long)s->bytesIn, (unsigned long)s->bytesOut,
+	       (unsigned long)s->latencyMin, (unsigned long)s->latencyAvg, (unsigned long)s->latencyMax);
+	printf("bridge: %lu rounds, %lu ops in %lu transfers\n", (unsigned long)s->rounds,
+	       (unsigned long)s->roundOps, (unsigned long)s->transfers);
+	fflush(stdout);
+	if (oneShot && bridge.clients() == 1)  //the one going
+		events.stop();
+}
+
+int main(int argc, char ** argv){
+	unsigned long baud = 115200;
+	uint8_t ea = 0;
+	long counts[3] = {256, 256, 256};
+	int opt;
+	while ((opt = getopt(argc, argv, "b:eB:W:C:1")) != -1){
+		switch (opt){
+			case 'b': baud = atol(optarg); break;
+			case 'e': ea = 1; break;
+			case 'B': counts[0] = atol(optarg); break;
+			case 'W': counts[1] = atol(optarg); break;
+			case 'C': counts[2] = atol(optarg); break;
+			case '1': oneShot = 1; break;
+			default:
+				fprintf(stderr, "usage: %s port socket [-b baud] [-e] [-B bytes] [-W words] [-C colors] [-1]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind + 1 >= argc){
+		fprintf(stderr, "usage: %s port socket [-b baud] [-e] [-B bytes] [-W words] [-C colors] [-1]\n", argv[0]);
+		return 2;
+	}
+	if (Serial.open(argv[optind]) != 0){
+		perror(argv[optind]);
+		return 1;
+	}
+	myModule.begin(baud, SERIAL_8N1, ea);
+	if (events.begin(&myModule) != 0
+	    || bridge.begin(&events, &myModule, argv[optind + 1], counts[0], counts[1], counts[2]) != 0){
+		perror(argv[optind + 1]);
+		return 1;
+	}
+	bridge.setDisconnectHook(onDisconnect, NULL);
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	int result = events.run();
+	bridge.close();
+	return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+/*
+  amulet_coro.cpp - AmuletCoroutine.h on a Linux serial port or pty, built with -std=c++20.
+
+  Runs count UI transactions through AmuletAsync, one after the other. Each is a coroutine with
+  three dependent co_awaits: read a Word, set it to one more, and read it back. Every operator new
+  is counted; after a warm-up of 10 transactions, which lets the I/O thread and the frame pool
+  settle, the rest must allocate nothing. Exits non-zero if one does, or if a read back is wrong.
+
+  Usage:
+    amulet_coro port [-b baud] [-n count]
+    make bench    (runs it against amulet_emu over a pty pair)
+
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include "Arduino.h"
+#include "AmuletLCD.h"
+#include "AmuletIOThread.h"
+#include "AmuletCoroutine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include <thread>
+
+#if !defined(__cpp_impl_coroutine)
+#error amulet_coro needs -std=c++20
+#endif
+
+#define WARM_UP  10
+
+static std::atomic<unsigned long> allocations(0);
+
+void * operator new(size_t size){
+	allocations++;
+	void * p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void operator delete(void * p) noexcept { free(p); }
+void operator delete(void * p, size_t) noexcept { free(p); }
+
+static uint16_t AmuletWords[256];
+static AmuletLCD myModule;
+static AmuletIOThread io;
+static std::atomic<long> done(0);
+static std::atomic<long> failed(0);
+
+/**
+* One transaction of three round trips, each depending on the one before.
+*/
+static AmuletTask transaction(AmuletAsync & lcd, uint16_t loc){
+	AmuletResult r = co_await lcd.requestWord(loc);
+	uint16_t next = (uint16_t)(r.value + 1);
+	if (r.ok)
+		r = co_await lcd.setWord(loc, next);
+	if (r.ok)
+		r = co_await lcd.requestWord(loc);
+	if (!r.ok || r.value != next)
+		failed++;
+	done++;
+}
+
+int main(int argc, char ** argv){
+	unsigned long baud = 115200;
+	long count = 2000;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:n:")) != -1){
+		switch (opt){
+			case 'b': baud = atol(optarg); break;
+			case 'n': count = atol(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s port [-b baud] [-n count]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind >= argc || Serial.open(argv[optind]) != 0){
+		perror(optind < argc ? argv[optind] : "port");
+		return 1;
+	}
+	myModule.begin(baud);
+	myModule.setWordPointer(AmuletWords, 256);
+	io.begin(&myModule);
+	AmuletAsync lcd(io);
+
+	unsigned long before = 0, t0 = 0;
+	for (long k = 0; k < WARM_UP + count; k++){
+		if (k == WARM_UP){
+			before = allocations;
+			t0 = micros();
+		}
+		transaction(lcd, k & 0xFF);
+		while (done <= k)
+			std::this_thread::yield();
+	}
+	unsigned long us = micros() - t0;
+	unsigned long allocated = allocations - before;
+	io.stop();
+	printf("%-14s %ld transactions of 3 dependent co_awaits, %.1f us each, %ld failed\n", "coroutines",
+	       count, (double)us / count, (long)failed);
+	printf("%-14s %lu allocations after %d warm-up transactions\n", "", allocated, WARM_UP);
+	return (allocated || failed) ? 1 : 0;
+}
@@ -0,0 +1,412 @@
+/*
+  amulet_emu.cpp - Amulet display stand-in on a pty, for testing the host build without hardware.
+
+  Answers Get/Set Byte, Word, Color (and their arrays) and GEMscript calls from its own
+  InternalRAM, the way a display answers an Arduino master. With -d it also plays the display
+  as master, sending Set Word commands to the host and timing the acknowledgements.
+
+  Usage:
+    amulet_emu [-l link] [-e] [-b baud] [-d count] [-a words] [-v clock]
+      -l link    also make a symlink to the pty slave, e.g. /tmp/amulet
+      -e         2 address bytes, like begin(baud, config, 1)
+      -b baud    pace commands and replies as if sent at this rate. Default: as fast as the pty goes
+      -v clock   join the virtual clock of the host, see HostClock.h. -b then adds to it instead of
+                 sleeping, and the host can make the emulator leave commands unanswered. Not with -d.
+      -d count   after the host opens the port, send count Set Word commands to uart word 0..
+      -a words   with -d, send Set Word Array commands of this many words instead
+
+  Released under the same license as the AmuletLCD library.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+#include "HostClock.h"
+
+#define HOST_ADDRESS    0x02
+#define AMULET_ADDRESS  0x01
+
+static uint8_t  ram_bytes[0x10000];
+static uint16_t ram_words[0x10000];
+static uint32_t ram_colors[0x10000];
+static int  ea = 0;
+static long baud = 0;
+static int  master_fd = -1;
+static HostClockShared * vclock = NULL;
+static uint32_t tx_bytes = 0;  //written to the host, for the virtual clock
+
+static uint64_t now_us(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint16_t crc16(const uint8_t * p, size_t n){
+	uint16_t crc = 0xFFFF;
+	while (n--){
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+	return crc;
+}
+
+/**
+* With -b, wait as long as bytes take on the wire, 10 bits per byte.
+*/
+static void pace(size_t bytes){
+	if (baud > 0 && vclock){
+		vclock->micros += bytes * 10000000ULL / baud;
+		return;
+	}
+	if (baud > 0){
+		uint64_t ns = bytes * 10000000000ULL / baud;
+		struct timespec ts = {(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+			;
+	}
+}
+
+static void send_frame(std::vector<uint8_t> & f){
+	uint16_t crc = crc16(f.data(), f.size());
+	f.push_back(crc & 0xFF);
+	f.push_back(crc >> 8);
+	pace(f.size());
+	size_t done = 0;
+	while (done < f.size()){
+		ssize_t n = write(master_fd, f.data() + done, f.size() - done);
+		if (n > 0){
+			done += n;
+			tx_bytes += n;
+		}
+		else if (n < 0 && errno == EAGAIN){
+			struct pollfd p = {master_fd, POLLOUT, 0};
+			poll(&p, 1, 100);
+		}
+		else if (!(n < 0 && errno == EINTR))
+			return;
+	}
+}
+
+/**
+* With -v, true for the commands the host asked to be left unanswered through HostClockShared::drop.
+* Counting starts again whenever drop changes.
+*/
+static int dropped(){
+	static uint32_t last = 0;
+	static uint32_t commands = 0;
+	if (!vclock)
+		return 0;
+	uint32_t every = vclock->drop.load();
+	if (every != last){
+		last = every;
+		commands = 0;
+	}
+	if (every && ++commands % every == 0){
+		vclock->dropped++;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+* With -v, create or join the clock segment. Returns -1 on error.
+*/
+static int join_clock(const char * name){
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0660);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, sizeof(HostClockShared)) != 0){
+		close(fd);
+		return -1;
+	}
+	void * map = mmap(NULL, sizeof(HostClockShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	vclock = (HostClockShared *)map;
+	vclock->peerTx.store(0);
+	vclock->peerRx.store(0);
+	vclock->dropped.store(0);
+	vclock->peer.store(getpid());
+	return 0;
+}
+
+static void push_addr(std::vector<uint8_t> & f, unsigned loc){
+	if (ea)
+		f.push_back(loc >> 8);
+	f.push_back(loc & 0xFF);
+}
+
+/**
+* Bytes following the opcode, before the CRC, or -1 if the count byte is needed first.
+*/
+static int body_length(uint8_t addr, uint8_t op, const std::vector<uint8_t> & f){
+	int a = 1 + ea;
+	if (addr == HOST_ADDRESS)  //acknowledgement from the host to our -d commands
+		return 0;
+	switch (op){
+		case 0x20: case 0x21: case 0x23: return a;
+		case 0x24: case 0x25: case 0x26: return a + 1;
+		case 0x30: return a + 1;
+		case 0x31: return a + 2;
+		case 0x33: return a + 4;
+		case 0x34: case 0x35: case 0x36:
+			if ((int)f.size() < 2 + a + 1)
+				return -1;
+			return a + 1 + f[2 + a] * ((op == 0x34) ? 1 : (op == 0x35) ? 2 : 4);
+		case 0x37: return 1;
+		case 0x52: {  //script name up to and including the null
+			for (size_t i = 2; i < f.size(); i++)
+				if (f[i] == 0)
+					return i - 1;
+			return -1;
+		}
+	}
+	return -2;
+}
+
+static void handle(const std::vector<uint8_t> & f){
+	uint8_t op = f[1];
+	unsigned loc = ea ? (f[2] << 8) | f[3] : (f.size() > 2 ? f[2] : 0);
+	const uint8_t * d = f.data() + 3 + ea;
+	std::vector<uint8_t> r;
+	pace(f.size());  //the pty delivers the command at once, a UART would still be receiving it
+	r.push_back(AMULET_ADDRESS);
+	r.push_back(op);
+	switch (op){
+		case 0x20: push_addr(r, loc); r.push_back(ram_bytes[loc]); break;
+		case 0x21: push_addr(r, loc); r.push_back(ram_words[loc] >> 8); r.push_back(ram_words[loc]); break;
+		case 0x23:
+			push_addr(r, loc);
+			for (int s = 24; s >= 0; s -= 8)
+				r.push_back(ram_colors[loc] >> s);
+			break;
+		case 0x24: case 0x25: case 0x26: {
+			uint8_t count = d[0];
+			push_addr(r, loc);
+			r.push_back(count);
+			for (unsigned i = loc; i < loc + count; i++){
+				if (op == 0x24)
+					r.push_back(ram_bytes[i & 0xFFFF]);
+				else if (op == 0x25){
+					r.push_back(ram_words[i & 0xFFFF] >> 8);
+					r.push_back(ram_words[i & 0xFFFF]);
+				}
+				else
+					for (int s = 24; s >= 0; s -= 8)
+						r.push_back(ram_colors[i & 0xFFFF] >> s);
+			}
+			break;
+		}
+		case 0x30: ram_bytes[loc] = d[0]; break;
+		case 0x31: ram_words[loc] = (d[0] << 8) | d[1]; break;
+		case 0x33: ram_colors[loc] = ((uint32_t)d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3]; break;
+		case 0x34: case 0x35: case 0x36: {
+			uint8_t count = d[0];
+			d++;
+			for (unsigned i = 0; i < count; i++){
+				unsigned k = (loc + i) & 0xFFFF;
+				if (op == 0x34)
+					ram_bytes[k] = d[i];
+				else if (op == 0x35)
+					ram_words[k] = (d[2*i] << 8) | d[2*i+1];
+				else
+					ram_colors[k] = ((uint32_t)d[4*i] << 24) | (d[4*i+1] << 16) | (d[4*i+2] << 8) | d[4*i+3];
+			}
+			break;
+		}
+		case 0x52: for (int i = 0; i < 4; i++) r.push_back(0); break;  //every script returns 0
+		default: return;
+	}
+	send_frame(r);
+}
+
+/**
+* Frame splitter for bytes from the host. Calls handle for commands, returns true for each ack.
+*/
+static int parse(const uint8_t * p, size_t n){
+	static std::vector<uint8_t> f;
+	int acks = 0;
+	for (size_t i = 0; i < n; i++){
+		uint8_t b = p[i];
+		if (f.empty() && b != AMULET_ADDRESS && b != HOST_ADDRESS)
+			continue;
+		f.push_back(b);
+		if (f.size() < 2)
+			continue;
+		int body = body_length(f[0], f[1], f);
+		if (body == -2){  //unknown opcode, resynchronise
+			f.clear();
+			continue;
+		}
+		if (body < 0 || (int)f.size() < 2 + body + 2)
+			continue;
+		uint16_t crc = crc16(f.data(), f.size() - 2);
+		if ((crc & 0xFF) == f[f.size()-2] && (crc >> 8) == f[f.size()-1]){
+			if (f[0] == HOST_ADDRESS)
+				acks++;
+			else if (!dropped())
+				handle(f);
+		}
+		f.clear();
+	}
+	return acks;
+}
+
+static int pump(int timeout_ms){
+	static uint32_t rx_bytes = 0;
+	uint8_t buf[4096];
+	struct pollfd p = {master_fd, POLLIN, 0};
+	if (poll(&p, 1, timeout_ms) <= 0)
+		return 0;
+	if (p.revents & POLLHUP)
+		return -1;
+	ssize_t n = read(master_fd, buf, sizeof(buf));
+	if (n <= 0)
+		return (n < 0 && errno == EAGAIN) ? 0 : -1;
+	int acks = parse(buf, n);
+	if (vclock){  //replies first, so a host that sees peerRx match also sees them in peerTx
+		rx_bytes += n;
+		vclock->peerTx.store(tx_bytes, std::memory_order_release);
+		vclock->peerRx.store(rx_bytes, std::memory_order_release);
+	}
+	return acks;
+}
+
+/**
+* Play the display as master: send count Set Word (or Set Word Array) commands, one at a time
+* like the display does, and report the acknowledgement latency.
+*/
+static void drive(long count, int array){
+	std::vector<double> lat;
+	uint64_t start = now_us();
+	long retries = 0;
+	for (long k = 0; k < count; k++){
+		std::vector<uint8_t> f;
+		f.push_back(HOST_ADDRESS);
+		if (array){
+			f.push_back(0x35);
+			push_addr(f, 0);
+			f.push_back(array);
+			for (int i = 0; i < array; i++){
+				f.push_back((k + i) >> 8);
+				f.push_back(k + i);
+			}
+		}
+		else{
+			f.push_back(0x31);
+			push_addr(f, k & 0x0F);
+			f.push_back(k >> 8);
+			f.push_back(k);
+		}
+		std::vector<uint8_t> copy = f;
+		uint64_t t0 = now_us();
+		send_frame(f);
+		int acked = 0;
+		while (!acked){
+			int r = pump(200);
+			if (r < 0)
+				return;
+			if (r > 0)
+				acked = 1;
+			else if (now_us() - t0 > 200000){  //display timeout, resend
+				retries++;
+				f = copy;
+				t0 = now_us();
+				send_frame(f);
+			}
+		}
+		lat.push_back((now_us() - t0) / 1.0);
+	}
+	double secs = (now_us() - start) / 1e6;
+	std::sort(lat.begin(), lat.end());
+	double sum = 0;
+	for (double v : lat)
+		sum += v;
+	size_t n = lat.size();
+	printf("drive: %zu commands in %.3f s, %.0f/s, %d words each, %ld retries\n",
+	       n, secs, n / secs, array ? array : 1, retries);
+	if (n)
+		printf("drive: ack latency us min %.0f avg %.1f p50 %.0f p99 %.0f max %.0f\n",
+		       lat[0], sum / n, lat[n / 2], lat[(n * 99) / 100], lat[n - 1]);
+	fflush(stdout);
+}
+
+int main(int argc, char ** argv){
+	const char * link = NULL;
+	const char * clock = NULL;
+	long drive_count = 0;
+	int array = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "l:eb:d:a:v:")) != -1){
+		switch (opt){
+			case 'l': link = optarg; break;
+			case 'e': ea = 1; break;
+			case 'b': baud = atol(optarg); break;
+			case 'd': drive_count = atol(optarg); break;
+			case 'a': array = atoi(optarg); break;
+			case 'v': clock = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-l link] [-e] [-b baud] [-d count] [-a words] [-v clock]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (clock && (drive_count || join_clock(clock) != 0)){
+		fprintf(stderr, "%s: -v %s: %s\n", argv[0], clock, drive_count ? "not with -d" : strerror(errno));
+		return 2;
+	}
+	master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master_fd < 0 || grantpt(master_fd) || unlockpt(master_fd)){
+		perror("posix_openpt");
+		return 1;
+	}
+	fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+	const char * slave = ptsname(master_fd);
+	struct termios tio;  //raw on the slave side too, until the host configures it
+	int sfd = open(slave, O_RDWR | O_NOCTTY);
+	if (sfd >= 0 && tcgetattr(sfd, &tio) == 0){
+		cfmakeraw(&tio);
+		tcsetattr(sfd, TCSANOW, &tio);
+	}
+	if (sfd >= 0)
+		close(sfd);
+	if (link){
+		unlink(link);
+		if (symlink(slave, link) != 0)
+			perror("symlink");
+	}
+	printf("%s\n", slave);
+	fflush(stdout);
+
+	while (1){  //POLLHUP until the host opens the slave
+		struct pollfd p = {master_fd, POLLIN, 0};
+		poll(&p, 1, 10);
+		if (!(p.revents & POLLHUP))
+			break;
+	}
+	if (drive_count){
+		usleep(200000);  //let the host finish begin(), which flushes the port
+		drive(drive_count, array);
+		if (link)
+			unlink(link);
+		return 0;  //the host sees the port hang up
+	}
+	while (pump(-1) >= 0)
+		;
+	if (vclock)
+		vclock->peer.store(0);
+	if (link)
+		unlink(link);
+	return 0;
+}
@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+"""
+  amulet_size.py - Flash and RAM cost of each AmuletLCD feature, see src/AmuletConfig.h.
+
+  Builds a sketch once with every feature, then once per AMULET_NO_* macro, and reports what
+  leaving each feature out saves. Macros the sketch can not be built without are marked as
+  needed. Finally builds with every macro the sketch does not need, which is the smallest
+  configuration that fits it.
+
+  Usage:
+    python3 amulet_size.py                                  (examples/Button_GUI on an Uno, ATmega328P)
+    python3 amulet_size.py examples/BlinkWithoutDelay
+    python3 amulet_size.py MySketch --fqbn arduino:avr:nano:cpu=atmega328old
+    python3 amulet_size.py --host                           (host compiler, no AVR toolchain)
+
+  The AVR build needs arduino-cli with the arduino:avr core installed. --host compiles
+  src/AmuletLCD.cpp against extras/host instead, checks that the sketch still compiles, and
+  reports the code size of the library object and sizeof(AmuletLCD). Those numbers only show
+  the relative cost of each feature.
+
+  Released under the same license as the AmuletLCD library.
+"""
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", ".."))
+
+FEATURES = (
+    "AMULET_NO_BYTES",
+    "AMULET_NO_WORDS",
+    "AMULET_NO_COLORS",
+    "AMULET_NO_ARRAYS",
+    "AMULET_NO_STRINGS",
+    "AMULET_NO_RPC",
+    "AMULET_NO_GEMSCRIPT",
+    "AMULET_NO_EXTENDED_ADDRESS",
+    "AMULET_NO_REPLY_CACHE",
+    "AMULET_NO_POLLING",
+    "AMULET_NO_FETCH",
+    "AMULET_NO_LINKTEST",
+    "AMULET_NO_IMAGE",
+    "AMULET_NO_IDLE",
+    "AMULET_NO_CLOCK",
+    "AMULET_NO_TX_BATCH",
+    "AMULET_NO_LINK_MONITOR",
+    "AMULET_NO_AUTOBAUD",
+    "AMULET_NO_BUILTIN_BUFFERS",
+)
+
+
+def flags(macros):
+    return ["-D" + m for m in macros]
+
+
+def build_avr(sketch, fqbn, macros, work):
+    """Build the sketch with arduino-cli. Returns (flash, ram) in bytes, or None if it does not build."""
+    out = os.path.join(work, "avr_" + str(abs(hash(tuple(macros)))))
+    cmd = ["arduino-cli", "compile", "--fqbn", fqbn, "--library", ROOT, "--build-path", out,
+           "--build-property", "compiler.cpp.extra_flags=" + " ".join(flags(macros)), sketch]
+    run = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    if run.returncode != 0:
+        return None
+    flash = re.search(r"Sketch uses (\d+) bytes", run.stdout)
+    ram = re.search(r"Global variables use (\d+) bytes", run.stdout)
+    if not flash or not ram:
+        sys.exit("error: could not read the size report of arduino-cli:\n" + run.stdout)
+    return int(flash.group(1)), int(ram.group(1))
+
+
+# Pin functions used by the examples, missing from the extras/host Arduino.h
+HOST_PRELUDE = """#include "Arduino.h"
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define LED_BUILTIN 13
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+int analogRead(uint8_t);
+void delay(unsigned long);
+"""
+
+
+def build_host(sketch, macros, work):
+    """Compile the library with the host compiler and check the sketch against its headers.
+    Returns (code size of the library, sizeof(AmuletLCD)) in bytes, or None if either does not compile."""
+    cxx = os.environ.get("CXX", "g++")
+    obj = os.path.join(work, "AmuletLCD.o")
+    probe = os.path.join(work, "probe")
+    prelude = os.path.join(work, "prelude.h")
+    src = os.path.join(ROOT, "src")
+    host = os.path.join(ROOT, "extras", "host")
+    common = [cxx, "-std=gnu++11", "-Os", "-w", "-I" + host, "-I" + src] + flags(macros)
+    with open(prelude, "w") as f:
+        f.write(HOST_PRELUDE)
+    for ino in sorted(n for n in os.listdir(sketch) if n.endswith(".ino")):
+        cmd = common + ["-fsyntax-only", "-include", prelude, "-x", "c++", os.path.join(sketch, ino)]
+        if subprocess.run(cmd, stderr=subprocess.DEVNULL).returncode != 0:
+            return None
+    if subprocess.run(common + ["-c", os.path.join(src, "AmuletLCD.cpp"), "-o", obj]).returncode != 0:
+        return None
+    with open(probe + ".cpp", "w") as f:
+        f.write('#include "AmuletLCD.h"\n#include <stdio.h>\nint main(){ printf("%u\\n", (unsigned)sizeof(AmuletLCD)); return 0; }\n')
+    if subprocess.run(common + [probe + ".cpp", "-o", probe]).returncode != 0:
+        return None
+    instance = int(subprocess.check_output([probe]).decode())
+    size = subprocess.check_output(["size", obj], universal_newlines=True).splitlines()[1].split()
+    return int(size[0]) + int(size[1]), instance
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report the flash and RAM each AmuletLCD feature costs.")
+    parser.add_argument("sketch", nargs="?", default=os.path.join(ROOT, "examples", "Button_GUI"),
+                        help="sketch directory, default examples/Button_GUI")
+    parser.add_argument("--fqbn", default="arduino:avr:uno", help="board to build for, default arduino:avr:uno (ATmega328P)")
+    parser.add_argument("--host", action="store_true", help="measure with the host compiler instead of arduino-cli")
+    args = parser.parse_args()
+
+    if args.host:
+        columns = ("code", "instance")
+        where = "%s, host compiler" % os.path.basename(os.path.normpath(args.sketch))
+    else:
+        if not shutil.which("arduino-cli"):
+            sys.exit("error: arduino-cli not found. Install it and the arduino:avr core, or use --host.")
+        columns = ("flash", "ram")
+        where = "%s, %s" % (os.path.basename(os.path.normpath(args.sketch)), args.fqbn)
+
+    work = tempfile.mkdtemp(prefix="amulet_size_")
+    try:
+        build = (lambda m: build_host(args.sketch, m, work)) if args.host else (lambda m: build_avr(args.sketch, args.fqbn, m, work))
+        full = build([])
+        if full is None:
+            sys.exit("error: %s does not build with every feature" % where)
+        print("%s" % where)
+        print("%-28s %8s %8s" % ("", columns[0], columns[1]))
+        print("%-28s %8d %8d" % ("all features", full[0], full[1]))
+        unneeded = []
+        for macro in FEATURES:
+            size = build([macro])
+            if size is None:
+                print("%-28s %8s %8s" % (macro, "needed", ""))
+                continue
+            unneeded.append(macro)
+            print("%-28s %+8d %+8d" % (macro, size[0] - full[0], size[1] - full[1]))
+        while unneeded:  #each macro alone builds, but a combination might not
+            size = build(unneeded)
+            if size is not None:
+                break
+            unneeded.pop()
+        if unneeded:
+            print("%-28s %8d %8d" % ("smallest", size[0], size[1]))
+            print("  " + " ".join(flags(unneeded)))
+    finally:
+        shutil.rmtree(work, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
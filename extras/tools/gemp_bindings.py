@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+"""
+  gemp_bindings.py - Generate AmuletLCD Virtual Dual Port bindings from a GEMstudio project.
+
+  Scans a .gemp project for every uartN.byte/word/color(x) the display touches and writes a
+  header with exactly sized local arrays, named constexpr addresses and per-bank size constants.
+
+  Usage:
+    python3 gemp_bindings.py Button_GUI.gemp                     (writes Button_GUI_VDP.h)
+    python3 gemp_bindings.py Button_GUI.gemp -o MySketch/VDP.h
+    python3 gemp_bindings.py Blinky_GUI.gemp --port uart1
+    python3 gemp_bindings.py BlinkWithoutDelay.gemp --internalram (Arduino as Master projects)
+
+  In the sketch:
+    #include "Button_GUI_VDP.h"
+    ...
+    amuletBindVDP(myModule);                    //instead of setBytePointer/setWordPointer/setColorPointer
+    value = AmuletBytes[AMULET_BYTE_LED_CONTROL];
+    myModule.requestWord(amuletWord<5>());      //compile error if word 5 is not used by the project
+
+  or with typed handles, declaring the module as AmuletVDPLink instead of AmuletLCD:
+    AmuletVDPLink::Byte<AMULET_BYTE_LED_CONTROL> led(myModule);
+    value = led.get();
+
+  Released under the same license as the AmuletLCD library.
+"""
+
+import argparse
+import os
+import re
+import sys
+import xml.etree.ElementTree as ET
+
+BANKS = (
+    # bank,    C type,     array name,     size constant,        pointer setter
+    ("byte",  "uint8_t",  "AmuletBytes",  "AMULET_BYTES_SIZE",  "setBytePointer"),
+    ("word",  "uint16_t", "AmuletWords",  "AMULET_WORDS_SIZE",  "setWordPointer"),
+    ("color", "uint32_t", "AmuletColors", "AMULET_COLORS_SIZE", "setColorPointer"),
+)
+
+UART_REF = re.compile(r"\b(uart[0-9]|usb)\.(byte|word|color|string)\(\s*(0x[0-9A-Fa-f]+|[0-9]+)\s*\)\.?(\w*)")
+RAM_REF = re.compile(r"\b([Ii]nternalRAM)\.(byte|word|color|string)\(\s*(0x[0-9A-Fa-f]+|[0-9]+)\s*\)\.?(\w*)")
+
+
+def identifier(name):
+    """Turn a GEMstudio widget name into a C identifier."""
+    ident = re.sub(r"\W", "_", name.strip())
+    if not ident or ident[0].isdigit():
+        ident = "_" + ident
+    return ident
+
+
+def scan(path, pattern):
+    """Return a list of (port, bank, index, access, owner) for every variable reference in the project."""
+    root = ET.parse(path).getroot()
+    refs = []
+
+    def walk(element, owner):
+        name = element.find("Name")
+        if name is not None and name.text:
+            owner = name.text
+        elif element.tag == "PAGE" and element.get("NAME"):
+            owner = element.get("NAME")
+        for text in (element.text, element.tail):
+            if not text:
+                continue
+            for match in pattern.finditer(text):
+                port, bank, index, access = match.groups()
+                refs.append((port, bank, int(index, 0), access or "value", owner))
+        for child in element:
+            walk(child, owner)
+
+    walk(root, os.path.splitext(os.path.basename(path))[0])
+    return refs
+
+
+def generate(path, refs, guard):
+    """Build the header text for the references found in one project."""
+    project = os.path.basename(path)
+    lines = [
+        "/*",
+        "  %s - Amulet Virtual Dual Port bindings for %s" % (guard[:-2] + ".h", project),
+        "  Generated by extras/tools/gemp_bindings.py. Do not edit, regenerate when the project changes.",
+        "*/",
+        "",
+        "#ifndef %s" % guard,
+        "#define %s" % guard,
+        "",
+        "#include <AmuletVar.h>",
+        "",
+    ]
+
+    for bank, ctype, array, size_name, setter in BANKS:
+        used = sorted(set(r[2] for r in refs if r[1] == bank))
+        size = (used[-1] + 1) if used else 0
+        lines.append("// %s variables: %d used, %d allocated" % (bank, len(used), size))
+        lines.append("constexpr uint16_t %s = %d;" % (size_name, size))
+        names = {}
+        for port, rbank, index, access, owner in refs:
+            if rbank != bank:
+                continue
+            const = "AMULET_%s_%s" % (bank.upper(), identifier(owner))
+            if const in names and names[const][0] != index:
+                const = "%s_%d" % (const, index)
+            names.setdefault(const, (index, []))[1].append("%s.%s(%d).%s()" % (port, bank, index, access))
+        for const, (index, uses) in sorted(names.items(), key=lambda item: (item[1][0], item[0])):
+            lines.append("constexpr uint16_t %s = %d; // %s" % (const, index, ", ".join(sorted(set(uses)))))
+        if size:
+            lines.append("%s %s[%s];" % (ctype, array, size_name))
+        lines.append("")
+        lines.append("/**")
+        lines.append("* Compile-time checked %s address. Fails to compile if the project never uses %s(loc)." % (bank, bank))
+        lines.append("*/")
+        lines.append("template <uint16_t loc> constexpr uint16_t amulet%s(){" % bank.capitalize())
+        lines.append("\tstatic_assert(loc < %s, \"%s address is not used by %s\");" % (size_name, bank, project))
+        lines.append("\treturn loc;")
+        lines.append("}")
+        lines.append("")
+
+    extended = any(r[2] > 0xFF for r in refs)
+    lines.append("// Nonzero if any address needs the extended_address option of AmuletLCD::begin")
+    lines.append("constexpr uint8_t AMULET_EXTENDED_ADDRESS = %d;" % (1 if extended else 0))
+    lines.append("")
+    lines.append("// Link sized for this project, for compile-time checked AmuletVar handles:")
+    lines.append("//   AmuletVDPLink::Word<AMULET_WORD_...> handle(myModule);")
+    lines.append("typedef AmuletLink<AMULET_EXTENDED_ADDRESS, AMULET_BYTES_SIZE, AMULET_WORDS_SIZE, AMULET_COLORS_SIZE> AmuletVDPLink;")
+    lines.append("")
+    lines.append("/**")
+    lines.append("* Register the generated arrays with the Amulet state machine.")
+    lines.append("*/")
+    lines.append("inline void amuletBindVDP(AmuletLCD & lcd){")
+    for bank, ctype, array, size_name, setter in BANKS:
+        if any(r[1] == bank for r in refs):
+            lines.append("\tlcd.%s(%s, %s);" % (setter, array, size_name))
+    lines.append("}")
+    lines.append("")
+    lines.append("#endif")
+    lines.append("")
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate AmuletLCD VDP bindings from a GEMstudio .gemp project.")
+    parser.add_argument("project", help="GEMstudio project file (.gemp)")
+    parser.add_argument("-o", "--output", help="header to write, default <project>_VDP.h next to the project")
+    parser.add_argument("-p", "--port", help="only use references to this port, e.g. uart0. Default: every port")
+    parser.add_argument("--internalram", action="store_true",
+                        help="bind InternalRAM variables instead, for sketches that request them as master")
+    args = parser.parse_args()
+
+    refs = scan(args.project, RAM_REF if args.internalram else UART_REF)
+    if args.internalram:
+        refs = [("InternalRAM",) + r[1:] for r in refs]  # GEMstudio projects spell it either way
+    if args.port:
+        refs = [r for r in refs if r[0] == args.port]
+    ports = sorted(set(r[0] for r in refs))
+    if len(ports) > 1:
+        sys.stderr.write("warning: %s uses %s, merging them. Use --port to pick one.\n" % (args.project, ", ".join(ports)))
+    for r in refs:
+        if r[1] == "string":
+            sys.stderr.write("warning: %s.string(%d) skipped, strings are not mirrored by AmuletLCD\n" % (r[0], r[2]))
+    refs = [r for r in refs if r[1] != "string"]
+    for r in refs:
+        if r[2] > 0xFFFF:
+            sys.exit("error: %s.%s(%d) is out of range" % r[:3])
+
+    base = os.path.splitext(os.path.basename(args.project))[0]
+    output = args.output or os.path.join(os.path.dirname(args.project), base + "_VDP.h")
+    guard = identifier(os.path.splitext(os.path.basename(output))[0]) + "_h"
+    with open(output, "w") as f:
+        f.write(generate(args.project, refs, guard))
+    print("%s: %d references -> %s" % (args.project, len(refs), output))
+
+
+if __name__ == "__main__":
+    main()
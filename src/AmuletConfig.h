@@ -0,0 +1,94 @@
+/*
+  AmuletConfig.h - Compile-time feature selection for the AmuletLCD library
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  Every feature is compiled in by default. Uncomment a line below, or pass the same
+  macro as a build flag (PlatformIO build_flags, arduino-cli compiler.cpp.extra_flags),
+  to leave a feature out. The sketch and the library must be built with the same set,
+  so editing this file is the safe choice in the Arduino IDE.
+
+  Methods of a feature that is left out are not declared, so using one is a compile error.
+  Commands from the display for a feature that is left out are ignored, as if the opcode
+  were invalid, and the display times out on them.
+
+  extras/tools/amulet_size.py reports the flash and RAM each feature costs.
+ */
+
+#ifndef AmuletConfig_h
+#define AmuletConfig_h
+
+// Variable banks: the local array, its Get/Set commands in both directions and its reply flags.
+//#define AMULET_NO_BYTES
+//#define AMULET_NO_WORDS
+//#define AMULET_NO_COLORS
+
+// Get/Set Byte/Word/Color Array commands. fetchRange and the polling scheduler then request
+// one variable at a time.
+//#define AMULET_NO_ARRAYS
+
+// Get/Set String commands, setString and requestString.
+//#define AMULET_NO_STRINGS
+
+// Invoke RPC commands from the display, setRPCPointer and registerRPC.
+//#define AMULET_NO_RPC
+
+// callScript, scriptReply and prepareScript.
+//#define AMULET_NO_GEMSCRIPT
+
+// 2 byte addresses. The address size is then a constant 1 byte, and begin ignores extended_address.
+//#define AMULET_NO_EXTENDED_ADDRESS
+
+// setReplyCachePointer and the reply cache behind Get commands from the display.
+//#define AMULET_NO_REPLY_CACHE
+
+// subscribe, pollUpdate and the rest of the polling scheduler.
+//#define AMULET_NO_POLLING
+
+// fetchByte/fetchWord/fetchColor, fetchRange and setStampPointers.
+//#define AMULET_NO_FETCH
+
+// linkTest.
+//#define AMULET_NO_LINKTEST
+
+// saveImage, restoreImage, pushRange and pullRange.
+//#define AMULET_NO_IMAGE
+
+// setIdleHook and setIdleSleep, run while blocking commands wait for their reply.
+//#define AMULET_NO_IDLE
+
+// setClock. Timeouts and ages then always come from millis() and micros().
+//#define AMULET_NO_CLOCK
+
+// setTxBatchPointer and flush. Every frame is then written to Serial on its own.
+//#define AMULET_NO_TX_BATCH
+
+// setLinkMonitor, checkLink and linkUp. Blocking commands then use every retry however long the
+// display has been gone. Also left out with AMULET_NO_IMAGE, as the resync uses pushRange.
+//#define AMULET_NO_LINK_MONITOR
+
+// negotiateBaud and the automatic fall back to a slower rate.
+//#define AMULET_NO_AUTOBAUD
+
+// The AMULET_RX_BUF_LEN/AMULET_TX_BUF_LEN arrays inside every AmuletLCD. Buffers are then passed
+// to begin, which is the only begin left.
+//#define AMULET_NO_BUILTIN_BUFFERS
+
+// Opt-in: time each command from the display through the parser and reply, see setLatencyHook
+// and setLatencyPointer. Costs a micros() call per stage and per serialEvent call.
+//#define AMULET_LATENCY
+
+#endif
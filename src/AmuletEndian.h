@@ -0,0 +1,243 @@
+/*
+  AmuletEndian.h - Bulk big-endian conversion of Amulet Word and Color arrays
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  Amulet sends Words and Colors MSB first. These kernels convert whole arrays between
+  the wire order and the local arrays. The backend is picked at compile time:
+    AVR                      byte at a time, the loads and stores are single bytes anyway
+    x86 with AVX2 or SSSE3   PSHUFB byte shuffles, 32 or 16 bytes per step (host builds)
+    other little endian      a word at a time with __builtin_bswap16/32 (ARM, ESP)
+    x86 without SSSE3        byte at a time, which the compiler vectorizes with SSE2
+    big endian               plain copy
+  Define AMULET_ENDIAN_SCALAR to force the byte at a time loop everywhere.
+
+  The Encode...CRC variants fold each encoded block into the Amulet CRC while it is still
+  in registers or cache, so a frame is built in one pass over the local array.
+ */
+
+#ifndef AmuletEndian_h
+#define AmuletEndian_h
+
+#include <stdint.h>
+#include <string.h>
+#include "AmuletLCD.h"
+
+#if !defined(AMULET_ENDIAN_SCALAR) && !defined(__AVR__)
+  #if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    #define AMULET_ENDIAN_COPY
+  #elif defined(__AVX2__)
+    #define AMULET_ENDIAN_AVX2
+    #define AMULET_ENDIAN_SSSE3
+    #include <immintrin.h>
+  #elif defined(__SSSE3__)
+    #define AMULET_ENDIAN_SSSE3
+    #include <tmmintrin.h>
+  #elif defined(__GNUC__) && !defined(__x86_64__) && !defined(__i386__)
+    #define AMULET_ENDIAN_BSWAP
+  #endif
+#endif
+
+/**
+* Byte-at-a-time Amulet CRC, the run-time loop over amuletCRCBit. AmuletLCD::updateCRC uses it too.
+*/
+static inline uint16_t amuletCRCUpdate(uint16_t crc, const uint8_t * ptr, uint16_t count){
+	while (count--){
+		crc ^= *ptr++;
+		for (uint8_t i = 8; i > 0; i--)
+			crc = amuletCRCBit(crc);
+	}
+	return crc;
+}
+
+#if defined(AMULET_ENDIAN_SSSE3) || defined(AMULET_ENDIAN_BSWAP)
+#define AMULET_ENDIAN_SWAP
+/**
+* Swap the bytes of count 16-bit values. Byte pointers with unaligned loads and stores,
+* so dest and src may sit at any offset inside a frame buffer.
+*/
+static inline void amuletSwap16(uint8_t * dest, const uint8_t * src, uint16_t count){
+  #if defined(AMULET_ENDIAN_AVX2)
+	const __m256i mask32 = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+	                                        1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+	for (; count >= 16; count -= 16, src += 32, dest += 32)
+		_mm256_storeu_si256((__m256i *)dest, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), mask32));
+  #endif
+  #if defined(AMULET_ENDIAN_SSSE3)
+	const __m128i mask16 = _mm_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+	for (; count >= 8; count -= 8, src += 16, dest += 16)
+		_mm_storeu_si128((__m128i *)dest, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), mask16));
+  #endif
+	for (; count; count--, src += 2, dest += 2){
+		uint16_t w;
+		memcpy(&w, src, 2);
+		w = __builtin_bswap16(w);
+		memcpy(dest, &w, 2);
+	}
+}
+
+/**
+* Swap the bytes of count 32-bit values, see amuletSwap16.
+*/
+static inline void amuletSwap32(uint8_t * dest, const uint8_t * src, uint16_t count){
+  #if defined(AMULET_ENDIAN_AVX2)
+	const __m256i mask32 = _mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+	                                        3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	for (; count >= 8; count -= 8, src += 32, dest += 32)
+		_mm256_storeu_si256((__m256i *)dest, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), mask32));
+  #endif
+  #if defined(AMULET_ENDIAN_SSSE3)
+	const __m128i mask16 = _mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	for (; count >= 4; count -= 4, src += 16, dest += 16)
+		_mm_storeu_si128((__m128i *)dest, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), mask16));
+  #endif
+	for (; count; count--, src += 4, dest += 4){
+		uint32_t c;
+		memcpy(&c, src, 4);
+		c = __builtin_bswap32(c);
+		memcpy(dest, &c, 4);
+	}
+}
+#endif
+
+/**
+* Convert count big-endian words from the wire into native words.
+* @param dest uint16_t* local array, may not overlap src
+* @param src const uint8_t* 2*count bytes, MSB first
+* @param count uint16_t number of words
+*/
+static inline void amuletDecodeWords(uint16_t * dest, const uint8_t * src, uint16_t count){
+#if defined(AMULET_ENDIAN_COPY)
+	memcpy(dest, src, 2 * (uint32_t)count);
+#elif defined(AMULET_ENDIAN_SWAP)
+	amuletSwap16((uint8_t *)dest, src, count);
+#else
+	for (; count; count--, src += 2)
+		*dest++ = ((uint16_t)src[0] << 8) | src[1];
+#endif
+}
+
+/**
+* Convert count big-endian colors from the wire into native colors.
+* @param dest uint32_t* local array, may not overlap src
+* @param src const uint8_t* 4*count bytes, MSB first
+* @param count uint16_t number of colors
+*/
+static inline void amuletDecodeColors(uint32_t * dest, const uint8_t * src, uint16_t count){
+#if defined(AMULET_ENDIAN_COPY)
+	memcpy(dest, src, 4 * (uint32_t)count);
+#elif defined(AMULET_ENDIAN_SWAP)
+	amuletSwap32((uint8_t *)dest, src, count);
+#elif defined(__AVR__)
+	uint8_t * d = (uint8_t *)dest;
+	for (; count; count--, src += 4, d += 4){  //byte stores, no 32-bit shifts on an 8-bit core
+		d[0] = src[3];
+		d[1] = src[2];
+		d[2] = src[1];
+		d[3] = src[0];
+	}
+#else
+	for (; count; count--, src += 4)
+		*dest++ = ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+#endif
+}
+
+/**
+* Convert count native words into big-endian bytes for the wire.
+* @param dest uint8_t* 2*count bytes, may not overlap src
+* @param src const uint16_t* local array
+* @param count uint16_t number of words
+*/
+static inline void amuletEncodeWords(uint8_t * dest, const uint16_t * src, uint16_t count){
+#if defined(AMULET_ENDIAN_COPY)
+	memcpy(dest, src, 2 * (uint32_t)count);
+#elif defined(AMULET_ENDIAN_SWAP)
+	amuletSwap16(dest, (const uint8_t *)src, count);
+#else
+	for (; count; count--, dest += 2){
+		uint16_t w = *src++;
+		dest[0] = (uint8_t)(w >> 8);
+		dest[1] = (uint8_t)w;
+	}
+#endif
+}
+
+/**
+* Convert count native colors into big-endian bytes for the wire.
+* @param dest uint8_t* 4*count bytes, may not overlap src
+* @param src const uint32_t* local array
+* @param count uint16_t number of colors
+*/
+static inline void amuletEncodeColors(uint8_t * dest, const uint32_t * src, uint16_t count){
+#if defined(AMULET_ENDIAN_COPY)
+	memcpy(dest, src, 4 * (uint32_t)count);
+#elif defined(AMULET_ENDIAN_SWAP)
+	amuletSwap32(dest, (const uint8_t *)src, count);
+#elif defined(__AVR__)
+	const uint8_t * s = (const uint8_t *)src;
+	for (; count; count--, s += 4, dest += 4){
+		dest[0] = s[3];
+		dest[1] = s[2];
+		dest[2] = s[1];
+		dest[3] = s[0];
+	}
+#else
+	for (; count; count--, dest += 4){
+		uint32_t c = *src++;
+		dest[0] = (uint8_t)(c >> 24);
+		dest[1] = (uint8_t)(c >> 16);
+		dest[2] = (uint8_t)(c >> 8);
+		dest[3] = (uint8_t)c;
+	}
+#endif
+}
+
+/**
+* amuletEncodeWords, folding the encoded bytes into crc as they are produced.
+* Blocks of 8 words are encoded and then CRC'd while they are still hot.
+* @param crc uint16_t CRC of the frame bytes in front of dest
+* @return uint16_t CRC including the 2*count encoded bytes
+*/
+static inline uint16_t amuletEncodeWordsCRC(uint8_t * dest, const uint16_t * src, uint16_t count, uint16_t crc){
+	while (count){
+		uint8_t n = (count > 8) ? 8 : count;
+		amuletEncodeWords(dest, src, n);
+		crc = amuletCRCUpdate(crc, dest, 2 * n);
+		dest += 2 * n;
+		src += n;
+		count -= n;
+	}
+	return crc;
+}
+
+/**
+* amuletEncodeColors, folding the encoded bytes into crc as they are produced.
+* @param crc uint16_t CRC of the frame bytes in front of dest
+* @return uint16_t CRC including the 4*count encoded bytes
+*/
+static inline uint16_t amuletEncodeColorsCRC(uint8_t * dest, const uint32_t * src, uint16_t count, uint16_t crc){
+	while (count){
+		uint8_t n = (count > 4) ? 4 : count;
+		amuletEncodeColors(dest, src, n);
+		crc = amuletCRCUpdate(crc, dest, 4 * n);
+		dest += 4 * n;
+		src += n;
+		count -= n;
+	}
+	return crc;
+}
+
+#endif
@@ -6,6 +6,39 @@
 
 #include "Arduino.h"
 #include "AmuletLCD.h"
+#include "AmuletEndian.h"
+#if defined(__AVR__) && !defined(AMULET_NO_IDLE)
+#include <avr/sleep.h>
+#endif
+#if defined(__AVR__) && !defined(AMULET_NO_IMAGE)
+#include <avr/eeprom.h>
+#endif
+
+/**
+* Latency timestamps, see setLatencyHook. Nothing is left of them unless AMULET_LATENCY is defined.
+*/
+#ifdef AMULET_LATENCY
+#define AMULET_STAMP(n)  _stamps[n] = clockMicros()
+#else
+#define AMULET_STAMP(n)
+#endif
+
+/**
+* Replies to Set commands never change: Host ID, opcode, then the CRC of those two bytes.
+* The CRC is folded at compile time. Opcodes _SET_BYTE through _INVOKE_RPC are contiguous.
+*/
+#define _ACK_CRC(OPCODE)   amuletCRCByte(amuletCRCByte(_CRC_SEED, _HOST_ADDRESS), OPCODE)
+#define _ACK_FRAME(OPCODE) {_HOST_ADDRESS, OPCODE, (uint8_t)(_ACK_CRC(OPCODE) & 0xFF), (uint8_t)(_ACK_CRC(OPCODE) >> 8)}
+static const uint8_t _AckFrames[8][4] PROGMEM = {
+	_ACK_FRAME(_SET_BYTE),
+	_ACK_FRAME(_SET_WORD),
+	_ACK_FRAME(_SET_STRING),
+	_ACK_FRAME(_SET_COLOR),
+	_ACK_FRAME(_SET_BYTE_ARRAY),
+	_ACK_FRAME(_SET_WORD_ARRAY),
+	_ACK_FRAME(_SET_COLOR_ARRAY),
+	_ACK_FRAME(_INVOKE_RPC)
+};
 
 /**
 * Constructor. Initializes state machine variables
@@ -14,16 +47,103 @@
 AmuletLCD::AmuletLCD(){
 	_baud = 115200;      //default baud;
 	_UART_State = 0;
+	_RxBufferLength = 0;
+	#ifndef AMULET_NO_BUILTIN_BUFFERS
+	_RxBuffer = _RxStorage;
+	_RxBufferSize = AMULET_RX_BUF_LEN;
+	_TxBuffer = _TxStorage;
+	_TxBufferSize = AMULET_TX_BUF_LEN;
+	#else
+	_RxBuffer = NULL;    //everything received is dropped until begin gets buffers
+	_RxBufferSize = 0;
+	_TxBuffer = NULL;
+	_TxBufferSize = 0;
+	#endif
+	#ifndef AMULET_NO_BYTES
 	_BytesLength = 0;
+	#endif
+	#ifndef AMULET_NO_WORDS
 	_WordsLength = 0;
+	#endif
+	#ifndef AMULET_NO_COLORS
 	_ColorsLength = 0;
+	#endif
+	#ifndef AMULET_NO_RPC
+	_RPCsLength = 0;
+	#endif
 	_errorCount = 0;
+	_retryCount = 0;
+	_crcErrors = 0;
+	_rxFrames = 0;
 	_retries = 11;
 	_Timeout_ms = 200;
 	_config = SERIAL_8N1;
+	#ifndef AMULET_NO_EXTENDED_ADDRESS
     _ea = 0;
+	#endif
+	#ifndef AMULET_NO_REPLY_CACHE
+	_ReplyCacheLength = 0;
+	_replyCacheHits = 0;
+	_replyCacheMisses = 0;
+	#endif
+	#ifndef AMULET_NO_POLLING
+	_PollsLength = 0;
+	_pollBudget = 50;
+	_pollTokens = 0;
+	_pollRefill = 0;
+	#endif
+	#ifndef AMULET_NO_FETCH
+	_ByteStamps = NULL;
+	_WordStamps = NULL;
+	_ColorStamps = NULL;
+	#endif
+	_seqs[0] = 0;
+	_seqs[1] = 0;
+	_seqs[2] = 0;
+	setSeqPointers(NULL, NULL, NULL);
+	#ifndef AMULET_NO_AUTOBAUD
+	_baseBaud = _baud;
+	_baudRateCount = 0;
+	_baudChange = NULL;
+	_baudFallback = 10;
+	_baudStepDown = false;
+	_blockingDepth = 0;
+	_linkFrames = 0;
+	_linkTimeouts = 0;
+	#endif
+	#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+	_linkFailLimit = 0;
+	_linkFailures = 0;
+	_linkDown = false;
+	_linkHeard = false;
+	_linkChecking = false;
+	_heartbeatMs = 0;
+	_linkActive = 0;
+	_linkHook = NULL;
+	#endif
+	#ifndef AMULET_NO_IDLE
+	_idleHook = NULL;
+	_idleSleep = false;
+	_inIdle = false;
+	#endif
+	#ifndef AMULET_NO_CLOCK
+	setClock(NULL, NULL);
+	#endif
+	#ifndef AMULET_NO_TX_BATCH
+	_TxBatch = NULL;
+	_TxBatchSize = 0;
+	_TxBatchLength = 0;
+	_TxBatchDelay = 0;
+	_TxBatchStart = 0;
+	#endif
+	#ifdef AMULET_LATENCY
+	memset(_stamps, 0, sizeof(_stamps));
+	_LatencyLength = 0;
+	_latencyHook = NULL;
+	#endif
 }
 
+#ifndef AMULET_NO_BUILTIN_BUFFERS
 /**
 * Start communication at specified baud rate with default configuration (SERIAL_8N1)
 * @param baud uint32_t the communications rate specified in bits per second, default 115200
@@ -39,23 +159,218 @@ void AmuletLCD::begin(uint32_t baud){
 * @param baud uint32_t the communications rate specified in bits per second, default 115200
 * @param config uint8_t Macro that sets data, parity, and stop bits, default SERIAL_8N1
 * @param extended_address uint8_t controls number of address bytes in messages. 0 for 1 address byte, nonzero for 2 bytes. set nonzero to support >256 byte, word, or color variables.
+* Built with AMULET_NO_EXTENDED_ADDRESS, a nonzero value is counted as an error and 1 address byte is used.
 */
 void AmuletLCD::begin(uint32_t baud, uint8_t config, uint8_t extended_address){
+	begin(baud, config, extended_address, _RxStorage, AMULET_RX_BUF_LEN, _TxStorage, AMULET_TX_BUF_LEN);
+}
+#endif
+
+/**
+* Start communication with receive and transmit buffers owned by the caller, instead of the
+* AMULET_RX_BUF_LEN/AMULET_TX_BUF_LEN arrays inside the instance.
+* The receive buffer holds one incoming frame, so it bounds the largest array reply, see AMULET_ARRAY_LEN.
+* Longer frames from the display are dropped and counted as errors.
+* The transmit buffer holds the master frames too long for the stack: arrays, strings and GEMscript calls.
+* Instances that never transmit at the same time may share one transmit buffer. A frame stays in it
+* until its reply arrives, so an RPC or other callback must not use another instance sharing it.
+* If either buffer is too short, nothing is changed, Serial is not started, and the error is counted.
+* @param baud uint32_t the communications rate specified in bits per second, default 115200
+* @param config uint8_t Macro that sets data, parity, and stop bits, default SERIAL_8N1
+* @param extended_address uint8_t controls number of address bytes in messages. 0 for 1 address byte, nonzero for 2 bytes.
+* Built with AMULET_NO_EXTENDED_ADDRESS, a nonzero value is counted as an error and 1 address byte is used.
+* @param rxBuffer uint8_t* receive buffer, used by this instance only
+* @param rxLength uint16_t at least AMULET_MIN_RX_LEN
+* @param txBuffer uint8_t* transmit buffer, may be shared
+* @param txLength uint16_t at least AMULET_MIN_TX_LEN. May be 0 if that is 0.
+* @return uint8_t true if the buffers are long enough and communication started, false otherwise
+*/
+uint8_t AmuletLCD::begin(uint32_t baud, uint8_t config, uint8_t extended_address, uint8_t * rxBuffer, uint16_t rxLength, uint8_t * txBuffer, uint16_t txLength){
+	if ((rxBuffer == NULL) || (rxLength < AMULET_MIN_RX_LEN) || ((txBuffer == NULL) && (AMULET_MIN_TX_LEN > 0)) || (txLength < AMULET_MIN_TX_LEN)){
+		setError();
+		return false;
+	}
+	_RxBuffer = rxBuffer;
+	_RxBufferSize = rxLength;
+	_RxBufferLength = 0;
+	_UART_State = _RECIEVE_BEGIN;
+	_TxBuffer = txBuffer;
+	_TxBufferSize = txLength;
 	_baud = baud;
 	_config = config;
-    if (extended_address)
-        _ea = 1; //only 1 and 0 are valid.
-    else
-        _ea = 0;
+	#ifdef AMULET_NO_EXTENDED_ADDRESS
+	if (extended_address)
+		setError();
+	#else
+	if (extended_address)
+		_ea = 1; //only 1 and 0 are valid.
+	else
+		_ea = 0;
+	#endif
+	invalidateReplies(0, 0, 0xFFFF); //cached replies were built with the previous address size
+	AMULET_STAMP(AMULET_STAMP_IDLE);
 	#ifdef ESP8266
 	Serial.begin(baud, (SerialConfig)config);
 	#else
 	Serial.begin(baud, config);
 	#endif
+	return true;
+}
+
+
+
+#ifndef AMULET_NO_AUTOBAUD
+/**
+* Find the fastest rate the link to the display runs at without errors. Call after begin.
+* The link is first verified at the rate begin started with. Then each faster rate in rates is tried
+* in turn: change asks the display to switch, this side follows, and AMULET_BAUD_PROBES array reads
+* of the local Color, Word or Byte array from variable 0 must all succeed. Set one of them up first.
+* The first rate that fails is switched back from and ends the search.
+* Afterwards, if more than setBaudFallback percent of the blocking commands in AMULET_BAUD_WINDOW
+* time out, the link steps down to the next slower rate in rates, then to the starting rate.
+* A switch the display can not be told to undo is left to the display: it should go back to its
+* previous rate by itself if no valid command arrives within AMULET_BAUD_REVERT_MS of a switch.
+* @param rates const uint32_t* candidate baud rates, ascending. Kept for the fallback, so it must stay valid.
+* @param rateCount uint8_t the number of rates
+* @param change baudCallback tells the display to switch, see baudCallback
+* @return uint32_t the rate the link settled on, or 0 if the display did not answer at the starting rate
+*/
+uint32_t AmuletLCD::negotiateBaud(const uint32_t * rates, uint8_t rateCount, baudCallback change){
+	_baudRates = rates;
+	_baudRateCount = rateCount;
+	_baudChange = NULL;   //no fallback while searching
+	_baudStepDown = false;
+	_baseBaud = _baud;
+	if (!verifyLink()){
+		setError();
+		return 0;
+	}
+	for (uint8_t i = 0; i < rateCount; i++){
+		if (rates[i] <= _baud)
+			continue;
+		if (!tryBaud(change, rates[i]))
+			break;
+	}
+	_baudChange = change;
+	_linkFrames = 0;
+	_linkTimeouts = 0;
+	return _baud;
+}
+
+/**
+* Set how many blocking commands may time out before the link steps down to a slower rate.
+* @param percent uint8_t percent of the commands in AMULET_BAUD_WINDOW, default 10. 100 disables the fallback.
+*/
+void AmuletLCD::setBaudFallback(uint8_t percent){
+	_baudFallback = percent;
+}
+
+/**
+* @return uint32_t the baud rate in use, after negotiateBaud and any fallback
+*/
+uint32_t AmuletLCD::linkBaud(){
+	return _baud;
+}
+
+/**
+* Utility function moving this side of the link to a new rate. Whatever was half received is dropped.
+* @param baud uint32_t the new rate
+*/
+void AmuletLCD::setRate(uint32_t baud){
+	#ifndef AMULET_NO_TX_BATCH
+	flush();
+	#endif
+	Serial.flush();               //let the last command leave at the old rate
+	_baud = baud;
+	#ifdef ESP8266
+	Serial.begin(baud, (SerialConfig)_config);
+	#else
+	Serial.begin(baud, _config);
+	#endif
+	delay(AMULET_BAUD_SETTLE_MS);
+	while (Serial.available() > 0)
+		Serial.read();
+	_UART_State = _RECIEVE_BEGIN;
+	_RxBufferLength = 0;
 }
 
+/**
+* Utility function checking the link at the current rate with AMULET_BAUD_PROBES array reads.
+* Only one try each, so a bad rate is given up on quickly.
+* @return uint8_t true if every read was answered, false otherwise
+*/
+uint8_t AmuletLCD::verifyLink(){
+	uint8_t bank = bankLength(_GET_COLOR) ? _GET_COLOR : bankLength(_GET_WORD) ? _GET_WORD : bankLength(_GET_BYTE) ? _GET_BYTE : 0;
+	uint8_t retries = _retries;
+	uint8_t ok = true;
+	uint16_t count;
+	if (bank == 0)
+		return false;
+	count = bankLength(bank);
+	if (count > maxArrayCount(bank))
+		count = maxArrayCount(bank);  //the longest frame that fits, the most likely to show errors
+	_retries = 0;
+	for (uint8_t i = 0; ok && (i < AMULET_BAUD_PROBES); i++)
+		ok = requestRange(bank, 0, count);
+	_retries = retries;
+	return ok;
+}
+
+/**
+* Utility function switching the link to a faster rate, and back again if it does not work there.
+* @param baud uint32_t the rate to try
+* @return uint8_t true if the link now runs at baud, false if it is back at the previous rate
+*/
+uint8_t AmuletLCD::tryBaud(baudCallback change, uint32_t baud){
+	uint32_t previous = _baud;
+	if (!change(baud))
+		return false;     //refused, still at the previous rate
+	setRate(baud);
+	if (verifyLink())
+		return true;
+	change(previous);     //may not get through at this rate
+	setRate(previous);
+	if (!verifyLink()){
+		delay(AMULET_BAUD_REVERT_MS);  //then the display reverts on its own
+		if (!verifyLink())
+			setError();
+	}
+	return false;
+}
 
+/**
+* Utility function run when too many commands timed out at the current rate.
+* Steps down through the slower rates in the list, then to the starting rate, until the link answers.
+* Commands from the display are not reliable at this rate, so the switch is verified either way.
+*/
+void AmuletLCD::stepDownBaud(){
+	baudCallback change = _baudChange;
+	uint8_t ok = false;
+	_baudStepDown = false;
+	_baudChange = NULL;   //no fallback from inside the fallback
+	while (!ok && (_baud > _baseBaud)){
+		uint32_t lower = _baseBaud;
+		for (uint8_t i = 0; i < _baudRateCount; i++){
+			if ((_baudRates[i] < _baud) && (_baudRates[i] > lower))
+				lower = _baudRates[i];
+		}
+		change(lower);
+		setRate(lower);
+		ok = verifyLink();
+		if (!ok && (_baud == _baseBaud)){
+			delay(AMULET_BAUD_REVERT_MS);  //the display may still be at a faster rate, waiting to revert
+			ok = verifyLink();
+		}
+	}
+	if (!ok)
+		setError();
+	_baudChange = change;
+	_linkFrames = 0;
+	_linkTimeouts = 0;
+}
+#endif
 
+#ifndef AMULET_NO_BYTES
 /**
 * Set up array for use with Amulet commands: Amulet:UARTn.byte(x).value()/setValue()
 * @param ptr uint8_t* The memory used for the virtual dual port Byte array.
@@ -65,7 +380,9 @@ void AmuletLCD::setBytePointer(uint8_t * ptr, uint16_t ptrSize){
 	_Bytes = ptr;
 	_BytesLength = ptrSize;	
 }
+#endif
 
+#ifndef AMULET_NO_WORDS
 /**
 * Set up array for use with Amulet commands: Amulet:UARTn.word(x).value()/setValue()
 * @param ptr uint16_t* The memory used for the virtual dual port Word array.
@@ -75,7 +392,9 @@ void AmuletLCD::setWordPointer(uint16_t * ptr, uint16_t ptrSize){
 	_Words = ptr;
 	_WordsLength = ptrSize;
 }
+#endif
 
+#ifndef AMULET_NO_COLORS
 /**
 * Set up array for use with Amulet commands: Amulet:UARTn.color(x).value()/setValue()
 * @param ptr uint32_t* The memory used for the virtual dual port Word array.
@@ -85,7 +404,9 @@ void AmuletLCD::setColorPointer(uint32_t * ptr, uint16_t ptrSize){
 	_Colors = ptr;
 	_ColorsLength = ptrSize;
 }
+#endif
 
+#ifndef AMULET_NO_RPC
 /**
 * Set up memory for  function callbacks for use with Amulet commands: Amulet:UARTn.invokeRPC(index)
 * @param ptr functionPointer * The array used to store the function addresses
@@ -95,7 +416,60 @@ void AmuletLCD::setRPCPointer(RPC_Entry * ptr, uint16_t ptrSize){
 	_RPCs = ptr;
 	_RPCsLength = ptrSize;
 }
+#endif
+
+#ifndef AMULET_NO_REPLY_CACHE
+/**
+* Set up memory for caching replies to Amulet commands: Amulet:UARTn.byte/word/color(x).value()
+* The display typically polls the same few variables many times per second. A cached reply is sent
+* without rebuilding the frame or recalculating its CRC. Each cache entry holds one address.
+* @param ptr AmuletReply * The array used to store the prebuilt replies
+* @param ptrSize uint8_t The number of entries in the array. 0 disables the cache.
+*/
+void AmuletLCD::setReplyCachePointer(AmuletReply * ptr, uint8_t ptrSize){
+	_ReplyCache = ptr;
+	_ReplyCacheLength = ptrSize;
+	invalidateReplies(0, 0, 0xFFFF);
+}
+#endif
+
+#ifndef AMULET_NO_POLLING
+/**
+* Set up memory for the polling scheduler. See subscribe and pollUpdate.
+* @param ptr AmuletPoll * The array used to store the subscriptions
+* @param ptrSize uint8_t The maximum number of subscriptions
+*/
+void AmuletLCD::setPollPointer(AmuletPoll * ptr, uint8_t ptrSize){
+	_Polls = ptr;
+	_PollsLength = ptrSize;
+	memset(ptr, 0, ptrSize * sizeof(AmuletPoll));
+}
+#endif
+
+#ifndef AMULET_NO_FETCH
+/**
+* Set up memory for the last-refreshed time of each local variable, used by fetchByte/fetchWord/fetchColor.
+* Each array must be as long as the matching local array, so call this after setBytePointer/setWordPointer/setColorPointer.
+* Pass NULL for a bank that is not fetched, fetches from it will then always request the value.
+* @param byteStamps uint32_t* one entry per Byte variable, or NULL
+* @param wordStamps uint32_t* one entry per Word variable, or NULL
+* @param colorStamps uint32_t* one entry per Color variable, or NULL
+*/
+void AmuletLCD::setStampPointers(uint32_t * byteStamps, uint32_t * wordStamps, uint32_t * colorStamps){
+	uint32_t never = clockMillis() - 0x80000000UL;  //older than any maxAgeMs
+	_ByteStamps = byteStamps;
+	_WordStamps = wordStamps;
+	_ColorStamps = colorStamps;
+	for (uint16_t i = 0; byteStamps && i < bankLength(_GET_BYTE); i++)
+		byteStamps[i] = never;
+	for (uint16_t i = 0; wordStamps && i < bankLength(_GET_WORD); i++)
+		wordStamps[i] = never;
+	for (uint16_t i = 0; colorStamps && i < bankLength(_GET_COLOR); i++)
+		colorStamps[i] = never;
+}
+#endif
 
+#ifndef AMULET_NO_RPC
 /**
 * Set up a single function callback for use with Amulet commands: Amulet:UARTn.invokeRPC(index)
 * @param index uint8_t The index to store the RPC function. Amulet RPC max index is 255
@@ -114,7 +488,9 @@ void AmuletLCD::callRPC(uint8_t index){
 	if (index < _RPCsLength)
 		(_RPCs[index].function)();
 }
+#endif
 
+#ifndef AMULET_NO_BYTES
 /**
 * Read the Byte from the local array, which may or may not match the state of Amulet InternalRAM.Byte memory
 * Expecting either the Amulet Display to send a master command to set this value, or you can use requestByte or requestBytes to update the values before reading.
@@ -160,6 +536,7 @@ uint8_t AmuletLCD::requestByte(uint16_t loc)
 	}
 }
 
+#ifndef AMULET_NO_ARRAYS
 /**
 * Request the Byte Array from Amulet Display, and wait for a response.
 * Copy the response into the local array at the same indices.
@@ -190,6 +567,7 @@ uint8_t AmuletLCD::requestBytes(uint16_t start, uint8_t count){
 		return false;
 	}
 }
+#endif
 
 /**
 * Send out a serial command to set the Byte in the Amulet InternalRAM.Byte memory and wait for the response
@@ -230,7 +608,7 @@ int8_t AmuletLCD::setByte(uint16_t loc, uint8_t value, uint8_t waitForResponse){
             return send_command_blocking(command, i);
         }
         else{
-            Serial.write(command,i);
+            writeFrame(command, i, false);
             return true;
         }
     }
@@ -239,7 +617,9 @@ int8_t AmuletLCD::setByte(uint16_t loc, uint8_t value, uint8_t waitForResponse){
         return false;
     }
 }
+#endif
 
+#ifndef AMULET_NO_WORDS
 /**
 * Read the Word from the local array, which may or may not match the state of Amulet InternalRAM.Word memory
 * Expecting either the Amulet Display to send a master command to set this value, or you can use requestWord or requestWords to update the values before reading.
@@ -247,8 +627,15 @@ int8_t AmuletLCD::setByte(uint16_t loc, uint8_t value, uint8_t waitForResponse){
 * @return uint16_t the indexed value of local buffer, if loc < _WordsLength. Otherwise, 0;
 */
 uint16_t AmuletLCD::getWord(uint16_t loc){
-	if (loc < _WordsLength)
-		return _Words[loc];
+	if (loc < _WordsLength){
+		uint16_t value;
+		amulet_seq_t seq;
+		do {  //a word takes more than one access on 8-bit MCUs, so it can tear if the parser runs from an interrupt
+			seq = readBegin(_GET_WORD);
+			value = _Words[loc];
+		} while (readRetry(_GET_WORD, seq));
+		return value;
+	}
 	else{
 		setError();
 		return 0;
@@ -280,6 +667,7 @@ uint8_t AmuletLCD::requestWord(uint16_t loc){
 	}
 }
 
+#ifndef AMULET_NO_ARRAYS
 /**
 * Request the Word Array from Amulet Display, and wait for a response.
 * Copy the response into the local array at the same indices.
@@ -307,6 +695,7 @@ uint8_t AmuletLCD::requestWords(uint16_t start, uint8_t count){
 		return send_command_blocking(command, i);
 	}
 }
+#endif
 
 /**
 * Send out a serial command to set the Word in the Amulet InternalRAM.Word memory and wait for a response
@@ -349,7 +738,7 @@ int8_t AmuletLCD::setWord(uint16_t loc, uint16_t value, uint8_t waitForResponse)
 			return send_command_blocking(command, i);
 		}
 		else{
-			Serial.write(command,i);
+			writeFrame(command, i, false);
 			return true;
 		}
 	}
@@ -359,7 +748,9 @@ int8_t AmuletLCD::setWord(uint16_t loc, uint16_t value, uint8_t waitForResponse)
 		return false;
 	}
 }
+#endif
 
+#ifndef AMULET_NO_COLORS
 /**
 * Send out a serial command to set the Color in the Amulet InternalRAM.Color memory and wait for a response
 * @param loc uint16_t the index into the Amulet color array
@@ -402,7 +793,7 @@ int8_t AmuletLCD::setColor(uint16_t loc, uint32_t value, uint8_t waitForResponse
 			return send_command_blocking(command, i);
 		}
 		else{
-			Serial.write(command,i);
+			writeFrame(command, i, false);
 			return true;
 		}
 	}
@@ -411,8 +802,103 @@ int8_t AmuletLCD::setColor(uint16_t loc, uint32_t value, uint8_t waitForResponse
 		return false;
 	}
 }
+#endif
+
+
+#if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_BYTES)
+/**
+* Send the local Byte array from start to start+count-1 to Amulet InternalRAM.Byte memory in one Set Byte Array command.
+* @param start uint16_t the first index into the Amulet and local array
+* @param count uint8_t the number of variables to send. The frame must fit in the transmit buffer, see AMULET_ARRAY_LEN.
+* @param waitForResponse uint8_t true will block until response is received or timeout occurs
+* @return int8_t true if correct response was received or skipped, false otherwise
+*/
+int8_t AmuletLCD::setBytes(uint16_t start, uint8_t count, uint8_t waitForResponse){
+	return sendArray(_SET_BYTE_ARRAY, start, count, waitForResponse);
+}
+#endif
+
+#if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_WORDS)
+/**
+* Send the local Word array from start to start+count-1 to Amulet InternalRAM.Word memory in one Set Word Array command.
+* @param start uint16_t the first index into the Amulet and local array
+* @param count uint8_t the number of variables to send. The frame must fit in the transmit buffer, see AMULET_ARRAY_LEN.
+* @param waitForResponse uint8_t true will block until response is received or timeout occurs
+* @return int8_t true if correct response was received or skipped, false otherwise
+*/
+int8_t AmuletLCD::setWords(uint16_t start, uint8_t count, uint8_t waitForResponse){
+	return sendArray(_SET_WORD_ARRAY, start, count, waitForResponse);
+}
+#endif
+
+#if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_COLORS)
+/**
+* Send the local Color array from start to start+count-1 to Amulet InternalRAM.Color memory in one Set Color Array command.
+* @param start uint16_t the first index into the Amulet and local array
+* @param count uint8_t the number of variables to send. The frame must fit in the transmit buffer, see AMULET_ARRAY_LEN.
+* @param waitForResponse uint8_t true will block until response is received or timeout occurs
+* @return int8_t true if correct response was received or skipped, false otherwise
+*/
+int8_t AmuletLCD::setColors(uint16_t start, uint8_t count, uint8_t waitForResponse){
+	return sendArray(_SET_COLOR_ARRAY, start, count, waitForResponse);
+}
+#endif
 
+#ifndef AMULET_NO_ARRAYS
+/**
+* Build a Set Byte/Word/Color Array frame from the local array and send it.
+* The payload is byte swapped and CRC'd in one pass, see AmuletEndian.h.
+* If the parser changes the range while it is being encoded, it is encoded again.
+* @param opcode uint8_t _SET_BYTE_ARRAY, _SET_WORD_ARRAY or _SET_COLOR_ARRAY
+* @return int8_t true if correct response was received or skipped, false otherwise
+*/
+int8_t AmuletLCD::sendArray(uint8_t opcode, uint16_t start, uint8_t count, uint8_t waitForResponse){
+	uint8_t bank = (opcode == _SET_BYTE_ARRAY) ? _GET_BYTE : (opcode == _SET_WORD_ARRAY) ? _GET_WORD : _GET_COLOR;
+	uint16_t length = 6 + _ea + count * bankWidth(bank);
+	uint8_t * command = _TxBuffer;
+	uint8_t i = 0;
+	uint16_t prefixCRC, CRC = 0;
+	amulet_seq_t seq;
+	if ((length > _TxBufferSize) || ((uint32_t)start + count > bankLength(bank)) || (Serial.availableForWrite() < length)){
+		setError();
+		return false;
+	}
+	command[i++] = _AMULET_ADDRESS;
+	command[i++] = opcode;
+	if (_ea)
+		command[i++] = (uint8_t)(start >> 8);
+	command[i++] = (uint8_t)(start & 0xFF);
+	command[i++] = count;
+	prefixCRC = calcCRC(command, i);
+	do {
+		seq = readBegin(bank);
+		#ifndef AMULET_NO_BYTES
+		if (bank == _GET_BYTE){
+			memcpy(command + i, _Bytes + start, count);
+			CRC = updateCRC(prefixCRC, command + i, count);
+		}
+		#endif
+		#ifndef AMULET_NO_WORDS
+		if (bank == _GET_WORD)
+			CRC = amuletEncodeWordsCRC(command + i, _Words + start, count, prefixCRC);
+		#endif
+		#ifndef AMULET_NO_COLORS
+		if (bank == _GET_COLOR)
+			CRC = amuletEncodeColorsCRC(command + i, _Colors + start, count, prefixCRC);
+		#endif
+	} while (readRetry(bank, seq));
+	command[length-2] = CRC & 0xFF;             //LSB first for CRC
+	command[length-1] = (CRC >> 8) & 0xFF;
+	if (waitForResponse){
+		resetReply(opcode);
+		return send_command_blocking(command, length);
+	}
+	writeFrame(command, length, false);
+	return true;
+}
+#endif
 
+#ifndef AMULET_NO_COLORS
 /**
 * Read the Color from the local array, which may or may not match the state of Amulet InternalRAM.Color memory
 * Expecting either the Amulet Display to send a master command to set this value, or you can use requestColor or requestColors to update the values before reading.
@@ -420,8 +906,15 @@ int8_t AmuletLCD::setColor(uint16_t loc, uint32_t value, uint8_t waitForResponse
 * @return uint16_t the indexed value of local buffer, if loc < _ColorsLength. Otherwise, 0;
 */
 uint32_t AmuletLCD::getColor(uint16_t loc){
-	if (loc < _ColorsLength)
-		return _Colors[loc];
+	if (loc < _ColorsLength){
+		uint32_t value;
+		amulet_seq_t seq;
+		do {  //a color takes more than one access on 8/16-bit MCUs, so it can tear if the parser runs from an interrupt
+			seq = readBegin(_GET_COLOR);
+			value = _Colors[loc];
+		} while (readRetry(_GET_COLOR, seq));
+		return value;
+	}
 	else{
 		setError();
 		return 0;
@@ -455,6 +948,7 @@ uint8_t AmuletLCD::requestColor(uint16_t loc){
 }
 
 
+#ifndef AMULET_NO_ARRAYS
 /**
 * Request the Color Array from Amulet Display, and wait for a response.
 * Copy the response into the local array at the same indices.
@@ -481,7 +975,10 @@ uint8_t AmuletLCD::requestColors(uint16_t start, uint8_t count){
 		return send_command_blocking(command, i);
 	}
 }
+#endif
+#endif
 
+#ifndef AMULET_NO_STRINGS
 /**
 * Send out a serial command to set a String in the Amulet InternalRAM.String memory
 * can optionally wait for response or just get out as soon as serial buffer populated
@@ -495,8 +992,10 @@ int8_t AmuletLCD::setString(uint16_t loc, const char * str, uint8_t waitForRespo
     if(Serial.availableForWrite() >= MAX_STRING_LENGTH+5+_ea){
         _SetStringReply = false;
         uint16_t i, j = 0;
-        //command = slave address + opcode + 8/16bit address + string + null + CRC
-        uint8_t command[MAX_STRING_LENGTH+6] = {_AMULET_ADDRESS, _SET_STRING, 0};
+        //command = slave address + opcode + 8/16bit address + string + null + CRC, up to AMULET_STRING_FRAME_LEN
+        uint8_t * command = _TxBuffer;
+        command[0] = _AMULET_ADDRESS;
+        command[1] = _SET_STRING;
         if (_ea) {
             command[2] = (uint8_t)(loc >> 8);
             i=3;
@@ -521,7 +1020,7 @@ int8_t AmuletLCD::setString(uint16_t loc, const char * str, uint8_t waitForRespo
             return send_command_blocking(command, i);
         }
         else{
-            Serial.write(command,i);
+            writeFrame(command, i, false);
             return true;
         }
     }
@@ -558,8 +1057,10 @@ uint8_t AmuletLCD::requestString(uint16_t loc, uint8_t * destination_buffer, uin
 		return send_command_blocking(command, i);
 	}
 }
+#endif
 
 
+#ifndef AMULET_NO_GEMSCRIPT
 /**
 * Send out a serial command to call a GEMscript public function that exists on the current page.
 * This includes "@" functions like "@load" and "@init" that do not require a parameter.
@@ -573,10 +1074,12 @@ int8_t AmuletLCD::callScript(const char* fname, uint8_t waitForResponse){
         _scriptReply = INVALID_SCRIPT_REPLY;
         _InvokeGEMscriptReply = false;
         //longest GEMscript method name is 32 bytes,  + null, slave addr, opcode and 2-byte CRC = 37
-        uint8_t command[37] = {_AMULET_ADDRESS, _INVOKE_GEMSCRIPT, 0}; 
+        uint8_t * command = _TxBuffer;
         uint8_t i=2;
         if (strlen(fname) > 32)
             return -1;
+        command[0] = _AMULET_ADDRESS;
+        command[1] = _INVOKE_GEMSCRIPT;
         while(*fname !=0)
             command[i++] = *fname++;
         
@@ -587,7 +1090,7 @@ int8_t AmuletLCD::callScript(const char* fname, uint8_t waitForResponse){
             return send_command_blocking(command, i);
         }
         else{
-            Serial.write(command,i);
+            writeFrame(command, i, false);
             return true;
         }
     }
@@ -616,183 +1119,1457 @@ int8_t AmuletLCD::callScript(const char* fname){
 int32_t AmuletLCD::scriptReply(){
     return _scriptReply;
 }
+#endif
 
+#ifndef AMULET_NO_BYTES
 /**
-* Utility function for all blocking master messages.
-* Will handle timeouts and retries.
-* @param command uint8_t * the array containing the command to send.
-* @param length uint16_t the number of bytes to send
-* @return int8_t true if correct response was received, false otherwise
+* Build a Set Byte frame for a fixed address once, to be sent many times with sendPreparedValue(cmd, value, waitForResponse).
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param loc uint16_t the index into the Amulet Byte array
+* @return uint8_t true if the frame was prepared, false otherwise
 */
-uint8_t AmuletLCD::send_command_blocking(uint8_t * command, uint16_t length)
-{
-	uint8_t tryNumber = 0;
-	while (1){
-		Serial.write(command,length);
-		uint32_t startTime = millis();
-		while (millis() - startTime < _Timeout_ms){
-			serialEvent();
-			switch (command[1])
-			{
-				case _GET_BYTE:
-					if (_GetByteReply)
-						return true;
-					break;
-				case _GET_WORD:
-					if (_GetWordReply)
-						return true;
-					break;
-				case _GET_STRING:
-				if (_GetStringReply)
-						return true;
-					break;
-				case _GET_COLOR:
-					if (_GetColorReply)
-						return true;
-					break;
-				case _GET_BYTE_ARRAY:
-					if (_GetBytesReply)
-						return true;
-					break;
-				case _GET_WORD_ARRAY:
-					if (_GetWordsReply)
-						return true;
-					break;
-				case _GET_COLOR_ARRAY:
-					if (_GetColorsReply)
-						return true;
-					break;
-//				case _GET_RPC:
-//				case _GET_LABEL:
-				case _SET_BYTE:
-					if (_SetByteReply)
-						return true;
-					break;
-				case _SET_WORD:
-					if (_SetWordReply)
-						return true;
-					break;
-				case _SET_STRING:
-                    if (_SetStringReply)
-						return true;
-					break;
-				case _SET_COLOR:
-					if (_SetColorReply)
-						return true;
-					break;
-				case _SET_BYTE_ARRAY:
-					if (_SetBytesReply)
-						return true;
-					break;
-				case _SET_WORD_ARRAY:
-					if (_SetWordsReply)
-						return true;
-					break;
-				case _SET_COLOR_ARRAY:
-					if (_SetColorsReply)
-						return true;
-					break;
-                case _INVOKE_GEMSCRIPT:
-					if (_InvokeGEMscriptReply)
-						return true;
-					break;
-				default:
-					return false;
-			}
-		}
-		if (tryNumber < _retries){
-			tryNumber++;
-		}
-		else{
-			setError();
-			return false;
-		}
-	}
+uint8_t AmuletLCD::prepareSetByte(AmuletCommand * cmd, uint16_t loc){
+	return prepareFrame(cmd, _SET_BYTE, loc, -1, 1);
 }
+#endif
 
+#ifndef AMULET_NO_WORDS
 /**
-* Utility function to calculate the MODBUS CRC of the given array.
-* @param ptr uint8_t* the array to calculate
-* @param count uint16_t the length of the array
-* @return uint16_t The calculated CRC value.
+* Build a Set Word frame for a fixed address once, to be sent many times with sendPreparedValue(cmd, value, waitForResponse).
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param loc uint16_t the index into the Amulet Word array
+* @return uint8_t true if the frame was prepared, false otherwise
 */
-uint16_t AmuletLCD::calcCRC(uint8_t *ptr, uint16_t count){
-   word crc = _CRC_SEED;    // initialize CRC
-   uint16_t i;
-   while (count-- > 0){
-       crc = crc ^ *ptr++;
-       for (i=8; i>0; i--){
-           if (crc & 0x0001){
-               crc = (crc >> 1) ^ _CRC_POLY;
-           }
-           else{
-               crc >>= 1;
-           }
-       }
-   }
-   return crc;
+uint8_t AmuletLCD::prepareSetWord(AmuletCommand * cmd, uint16_t loc){
+	return prepareFrame(cmd, _SET_WORD, loc, -1, 2);
 }
+#endif
 
-void AmuletLCD::appendCRC(uint8_t *ptr, uint16_t count){
-	uint16_t CRC = calcCRC(ptr, count);
-	ptr[count] = CRC & 0xFF;
-	ptr[count+1] = (CRC >> 8) & 0xFF;
+#ifndef AMULET_NO_COLORS
+/**
+* Build a Set Color frame for a fixed address once, to be sent many times with sendPreparedValue(cmd, value, waitForResponse).
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param loc uint16_t the index into the Amulet Color array
+* @return uint8_t true if the frame was prepared, false otherwise
+*/
+uint8_t AmuletLCD::prepareSetColor(AmuletCommand * cmd, uint16_t loc){
+	return prepareFrame(cmd, _SET_COLOR, loc, -1, 4);
 }
+#endif
 
+#ifndef AMULET_NO_BYTES
 /**
-* Heartbeat function that manages the state machine with incoming serial data. This should be called periodically
-* in your main loop or your own serialEvent() if supported by your board.
-* https://www.arduino.cc/en/Tutorial/SerialEvent
-* If arrays longer than the serial buffer are requested and you have blocking code, then consider peppering this command within your block
-* Alternatively, call UART_State_Machine from a real UART interrupt 
-*(advanced topic, additional libraries may be required, plus you need to make UART_State_Machine public)
+* Build a complete Get Byte frame, including CRC, to be sent many times with sendPrepared(cmd, waitForResponse).
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param loc uint16_t the index into the Amulet and local array.
+* @return uint8_t true if the frame was prepared, false otherwise
 */
-void AmuletLCD::serialEvent(){
-	while(Serial.available() > 0){
-		CRC_State_Machine(Serial.read());
-  	}
+uint8_t AmuletLCD::prepareRequestByte(AmuletCommand * cmd, uint16_t loc){
+	return prepareFrame(cmd, _GET_BYTE, loc, -1, 0);
 }
+#endif
 
+#ifndef AMULET_NO_WORDS
 /**
-* Main state machine of the Amulet CRC protocol handler.
-* @param b uint8_t the next serial byte to process.
+* Build a complete Get Word frame, including CRC, to be sent many times with sendPrepared(cmd, waitForResponse).
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param loc uint16_t the index into the Amulet and local array.
+* @return uint8_t true if the frame was prepared, false otherwise
 */
-void AmuletLCD::CRC_State_Machine(uint8_t b){  
-  static uint16_t i;     //remaining bytes before CRC for known length commands (non-string)
-  static int16_t count; //count of bytes left
-  switch(_UART_State){
-    case _RECIEVE_BEGIN:   //begin - look for a valid address
-        if ((b == _HOST_ADDRESS)||(b == _AMULET_ADDRESS)) {
-            _UART_State = _PARSE_OPCODE;
-            _RxBuffer[_RxBufferLength++] = b;
-            i = 1;
-        if (b == _AMULET_ADDRESS)
-            _reply = true;  //this is a reply to a previous Arduino-as-master Get or Set command.
-        else
-            _reply = false; //this is a new Amulet-as-master command
-        }  
-        //else{} //stay in this state
-        break;
-    case _PARSE_OPCODE:               //parse opcode to determine next state
-        count = recieve_OpcodeParser(b);  	  
-        if (count == -1) {               //invalid opcode, reset state machine
-            _RxBufferLength = 0;
+uint8_t AmuletLCD::prepareRequestWord(AmuletCommand * cmd, uint16_t loc){
+	return prepareFrame(cmd, _GET_WORD, loc, -1, 0);
+}
+#endif
+
+#ifndef AMULET_NO_COLORS
+/**
+* Build a complete Get Color frame, including CRC, to be sent many times with sendPrepared(cmd, waitForResponse).
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param loc uint16_t the index into the Amulet and local array.
+* @return uint8_t true if the frame was prepared, false otherwise
+*/
+uint8_t AmuletLCD::prepareRequestColor(AmuletCommand * cmd, uint16_t loc){
+	return prepareFrame(cmd, _GET_COLOR, loc, -1, 0);
+}
+#endif
+
+#if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_BYTES)
+/**
+* Build a complete Get Byte Array frame, including CRC, to be sent many times with sendPrepared(cmd, waitForResponse).
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param start uint16_t the first index into the Amulet and local array.
+* @param count uint8_t the number of variables requested.
+* @return uint8_t true if the frame was prepared, false otherwise
+*/
+uint8_t AmuletLCD::prepareRequestBytes(AmuletCommand * cmd, uint16_t start, uint8_t count){
+	return prepareFrame(cmd, _GET_BYTE_ARRAY, start, count, 0);
+}
+#endif
+
+#if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_WORDS)
+/**
+* Build a complete Get Word Array frame, including CRC, to be sent many times with sendPrepared(cmd, waitForResponse).
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param start uint16_t the first index into the Amulet and local array.
+* @param count uint8_t the number of variables requested.
+* @return uint8_t true if the frame was prepared, false otherwise
+*/
+uint8_t AmuletLCD::prepareRequestWords(AmuletCommand * cmd, uint16_t start, uint8_t count){
+	return prepareFrame(cmd, _GET_WORD_ARRAY, start, count, 0);
+}
+#endif
+
+#if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_COLORS)
+/**
+* Build a complete Get Color Array frame, including CRC, to be sent many times with sendPrepared(cmd, waitForResponse).
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param start uint16_t the first index into the Amulet and local array.
+* @param count uint8_t the number of variables requested.
+* @return uint8_t true if the frame was prepared, false otherwise
+*/
+uint8_t AmuletLCD::prepareRequestColors(AmuletCommand * cmd, uint16_t start, uint8_t count){
+	return prepareFrame(cmd, _GET_COLOR_ARRAY, start, count, 0);
+}
+#endif
+
+#ifndef AMULET_NO_GEMSCRIPT
+/**
+* Build a complete GEMscript call frame, including CRC, to be sent many times with sendPrepared(cmd, waitForResponse).
+* Saves rebuilding and re-CRCing up to 37 bytes each time a script such as "@load" is called.
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param fname const char * the name of the script to call, max 32 characters
+* @return uint8_t true if the frame was prepared, false otherwise
+*/
+uint8_t AmuletLCD::prepareScript(AmuletCommand * cmd, const char * fname){
+	uint16_t len = strlen(fname);
+	if ((len > 32) || (len + 5 > AMULET_PREPARED_LEN)){
+		setError();
+		return false;
+	}
+	uint8_t i = 0;
+	cmd->frame[i++] = _AMULET_ADDRESS;
+	cmd->frame[i++] = _INVOKE_GEMSCRIPT;
+	while(*fname != 0)
+		cmd->frame[i++] = *fname++;
+	cmd->frame[i++] = 0;
+	cmd->prefixCRC = calcCRC(cmd->frame, i);
+	cmd->payload = i;
+	cmd->frame[i++] = cmd->prefixCRC & 0xFF;
+	cmd->frame[i++] = (cmd->prefixCRC >> 8) & 0xFF;
+	cmd->length = i;
+	return true;
+}
+#endif
+
+/**
+* Utility function shared by the prepare methods.
+* Lays out address, opcode, 8/16bit address and optional count, then CRCs the fixed part of the frame.
+* The payload is zero filled, so the frame is valid as soon as it is prepared.
+* @param cmd AmuletCommand* the storage for the prepared frame
+* @param opcode uint8_t the command opcode
+* @param loc uint16_t the (first) index into the Amulet array
+* @param count int16_t the array count byte, or -1 if the command has none
+* @param payloadLength uint8_t the number of variable payload bytes following the fixed part
+* @return uint8_t true if the frame was prepared, false otherwise
+*/
+uint8_t AmuletLCD::prepareFrame(AmuletCommand * cmd, uint8_t opcode, uint16_t loc, int16_t count, uint8_t payloadLength){
+	uint8_t i = 0;
+	if (6 + _ea + payloadLength > AMULET_PREPARED_LEN){
+		setError();
+		return false;
+	}
+	cmd->frame[i++] = _AMULET_ADDRESS;
+	cmd->frame[i++] = opcode;
+	if (_ea)
+		cmd->frame[i++] = (uint8_t)(loc >> 8);
+	cmd->frame[i++] = (uint8_t)(loc & 0xFF);
+	if (count >= 0)
+		cmd->frame[i++] = (uint8_t)count;
+	cmd->prefixCRC = calcCRC(cmd->frame, i);
+	cmd->payload = i;
+	memset(cmd->frame + i, 0, payloadLength);
+	i += payloadLength;
+	appendCRC(cmd->frame, i);
+	cmd->length = i + 2;
+	return true;
+}
+
+/**
+* Send a frame built by one of the prepare methods, exactly as it was prepared.
+* @param cmd AmuletCommand* the prepared frame
+* @param waitForResponse uint8_t true will block until response is received or timeout occurs
+* @return int8_t true if correct response was received or skipped, false otherwise
+*/
+int8_t AmuletLCD::sendPrepared(AmuletCommand * cmd, uint8_t waitForResponse){
+	if(Serial.availableForWrite() >= cmd->length){
+		if (waitForResponse){
+			resetReply(cmd->frame[1]);
+			return send_command_blocking(cmd->frame, cmd->length);
+		}
+		else{
+			writeFrame(cmd->frame, cmd->length, false);
+			return true;
+		}
+	}
+	else{
+		setError();
+		return false;
+	}
+}
+
+/**
+* Patch the payload of a prepared Set frame with a new value and send it.
+* Only the payload bytes are run through the CRC, starting from the CRC saved when the frame was prepared.
+* Named apart from sendPrepared, so a value can never be taken for waitForResponse or the other way round.
+* @param cmd AmuletCommand* the frame prepared by prepareSetByte, prepareSetWord or prepareSetColor
+* @param value uint32_t the value to set, truncated to the payload size of the frame
+* @param waitForResponse uint8_t true will block until response is received or timeout occurs
+* @return int8_t true if correct response was received or skipped, false otherwise
+*/
+int8_t AmuletLCD::sendPreparedValue(AmuletCommand * cmd, uint32_t value, uint8_t waitForResponse){
+	uint8_t crcLoc = cmd->length - 2;
+	uint8_t i = crcLoc;
+	while (i > cmd->payload){  //MSB first for data
+		cmd->frame[--i] = (uint8_t)(value & 0xFF);
+		value >>= 8;
+	}
+	uint16_t CRC = updateCRC(cmd->prefixCRC, cmd->frame + cmd->payload, crcLoc - cmd->payload);
+	cmd->frame[crcLoc] = CRC & 0xFF;
+	cmd->frame[crcLoc+1] = (CRC >> 8) & 0xFF;
+	return sendPrepared(cmd, waitForResponse);
+}
+
+/**
+* Clear the reply flag that send_command_blocking will wait on for the given opcode.
+* @param opcode uint8_t the opcode of the command about to be sent
+*/
+void AmuletLCD::resetReply(uint8_t opcode){
+	switch (opcode)
+	{
+		#ifndef AMULET_NO_BYTES
+		case _GET_BYTE:         _GetByteReply = false;   break;
+		case _SET_BYTE:         _SetByteReply = false;   break;
+		#ifndef AMULET_NO_ARRAYS
+		case _GET_BYTE_ARRAY:   _GetBytesReply = false;  break;
+		case _SET_BYTE_ARRAY:   _SetBytesReply = false;  break;
+		#endif
+		#endif
+		#ifndef AMULET_NO_WORDS
+		case _GET_WORD:         _GetWordReply = false;   break;
+		case _SET_WORD:         _SetWordReply = false;   break;
+		#ifndef AMULET_NO_ARRAYS
+		case _GET_WORD_ARRAY:   _GetWordsReply = false;  break;
+		case _SET_WORD_ARRAY:   _SetWordsReply = false;  break;
+		#endif
+		#endif
+		#ifndef AMULET_NO_COLORS
+		case _GET_COLOR:        _GetColorReply = false;  break;
+		case _SET_COLOR:        _SetColorReply = false;  break;
+		#ifndef AMULET_NO_ARRAYS
+		case _GET_COLOR_ARRAY:  _GetColorsReply = false; break;
+		case _SET_COLOR_ARRAY:  _SetColorsReply = false; break;
+		#endif
+		#endif
+		#ifndef AMULET_NO_GEMSCRIPT
+		case _INVOKE_GEMSCRIPT:
+			_scriptReply = INVALID_SCRIPT_REPLY;
+			_InvokeGEMscriptReply = false;
+			break;
+		#endif
+	}
+}
+
+#if !defined(AMULET_NO_FETCH) && !defined(AMULET_NO_BYTES)
+/**
+* Read the Byte from the local array, requesting it from the Amulet Display first if the local copy is older than maxAgeMs.
+* Stale neighbours of loc are refreshed in the same array request. See setStampPointers.
+* @param loc uint16_t the index into the Amulet and local array.
+* @param maxAgeMs uint16_t how old the local copy may be
+* @return uint8_t the value of the local copy after any refresh. 0 if loc is out of range.
+*/
+uint8_t AmuletLCD::fetchByte(uint16_t loc, uint16_t maxAgeMs){
+	if (loc >= _BytesLength){
+		setError();
+		return 0;
+	}
+	refreshStale(_GET_BYTE, loc, 1, maxAgeMs, AMULET_FETCH_SPAN);
+	return getByte(loc);
+}
+#endif
+
+#if !defined(AMULET_NO_FETCH) && !defined(AMULET_NO_WORDS)
+/**
+* Read the Word from the local array, requesting it from the Amulet Display first if the local copy is older than maxAgeMs.
+* Stale neighbours of loc are refreshed in the same array request. See setStampPointers.
+* @param loc uint16_t the index into the Amulet and local array.
+* @param maxAgeMs uint16_t how old the local copy may be
+* @return uint16_t the value of the local copy after any refresh, read like getWord so it can not tear. 0 if loc is out of range.
+*/
+uint16_t AmuletLCD::fetchWord(uint16_t loc, uint16_t maxAgeMs){
+	if (loc >= _WordsLength){
+		setError();
+		return 0;
+	}
+	refreshStale(_GET_WORD, loc, 1, maxAgeMs, AMULET_FETCH_SPAN);
+	return getWord(loc);
+}
+#endif
+
+#if !defined(AMULET_NO_FETCH) && !defined(AMULET_NO_COLORS)
+/**
+* Read the Color from the local array, requesting it from the Amulet Display first if the local copy is older than maxAgeMs.
+* Stale neighbours of loc are refreshed in the same array request. See setStampPointers.
+* @param loc uint16_t the index into the Amulet and local array.
+* @param maxAgeMs uint16_t how old the local copy may be
+* @return uint32_t the value of the local copy after any refresh, read like getColor so it can not tear. 0 if loc is out of range.
+*/
+uint32_t AmuletLCD::fetchColor(uint16_t loc, uint16_t maxAgeMs){
+	if (loc >= _ColorsLength){
+		setError();
+		return 0;
+	}
+	refreshStale(_GET_COLOR, loc, 1, maxAgeMs, AMULET_FETCH_SPAN);
+	return getColor(loc);
+}
+#endif
+
+#ifndef AMULET_NO_FETCH
+/**
+* Make sure a range of the local array is no older than maxAgeMs.
+* Only the stale part of the range is requested, as array requests, instead of one request per variable.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param start uint16_t the first index into the Amulet and local array.
+* @param count uint16_t the number of variables
+* @param maxAgeMs uint16_t how old the local copies may be
+* @return uint8_t true if the whole range is fresh, false if a request failed
+*/
+uint8_t AmuletLCD::fetchRange(uint8_t bank, uint16_t start, uint16_t count, uint16_t maxAgeMs){
+	if ((uint32_t)start + count > bankLength(bank)){
+		setError();
+		return false;
+	}
+	return refreshStale(bank, start, count, maxAgeMs, 0);
+}
+
+/**
+* Utility function behind the fetch methods. Requests the stale part of a range in as few array requests as possible.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param start uint16_t the first index that must be fresh
+* @param count uint16_t the number of variables that must be fresh
+* @param maxAgeMs uint16_t how old the local copies may be
+* @param spread uint8_t the largest request to grow to by adding stale neighbours, 0 for none
+* @return uint8_t true if the range is fresh, false if a request failed
+*/
+uint8_t AmuletLCD::refreshStale(uint8_t bank, uint16_t start, uint16_t count, uint16_t maxAgeMs, uint8_t spread){
+	uint32_t * stamps = bankStamps(bank);
+	uint16_t length = bankLength(bank);
+	uint16_t lo = start;
+	uint16_t hi = start + count;
+	if (stamps){
+		uint32_t now = clockMillis();
+		while ((lo < hi) && (now - stamps[lo] <= maxAgeMs))      //skip fresh values at either end
+			lo++;
+		while ((hi > lo) && (now - stamps[hi-1] <= maxAgeMs))
+			hi--;
+		if (lo == hi)
+			return true;
+		if (spread > maxArrayCount(bank))
+			spread = maxArrayCount(bank);
+		uint8_t grown = true;
+		while (grown && (hi - lo < spread)){  //batch stale neighbours, growing both ways
+			grown = false;
+			if ((hi < length) && (now - stamps[hi] > maxAgeMs)){
+				hi++;
+				grown = true;
+			}
+			if ((hi - lo < spread) && (lo > 0) && (now - stamps[lo-1] > maxAgeMs)){
+				lo--;
+				grown = true;
+			}
+		}
+	}
+	while (lo < hi){
+		uint16_t n = hi - lo;
+		if (n > maxArrayCount(bank))
+			n = maxArrayCount(bank);
+		if (!requestRange(bank, lo, n))
+			return false;
+		lo += n;
+	}
+	return true;
+}
+
+/**
+* Utility function returning the last-refreshed times of a bank, see setStampPointers.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @return uint32_t* the stamps, or NULL if the bank has none
+*/
+uint32_t * AmuletLCD::bankStamps(uint8_t bank){
+	if (bank == _GET_BYTE)
+		return _ByteStamps;
+	if (bank == _GET_WORD)
+		return _WordStamps;
+	return _ColorStamps;
+}
+#endif
+
+/**
+* Utility function to request a range of one bank, as a single variable or as an array request.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param start uint16_t the first index into the Amulet and local array.
+* @param count uint8_t the number of variables, no more than maxArrayCount(bank)
+* @return uint8_t true if correct response was received, false otherwise
+*/
+uint8_t AmuletLCD::requestRange(uint8_t bank, uint16_t start, uint8_t count){
+	#ifdef AMULET_NO_ARRAYS
+	//maxArrayCount is 1, so count is too
+	#ifndef AMULET_NO_BYTES
+	if (bank == _GET_BYTE)
+		return requestByte(start);
+	#endif
+	#ifndef AMULET_NO_WORDS
+	if (bank == _GET_WORD)
+		return requestWord(start);
+	#endif
+	#ifndef AMULET_NO_COLORS
+	if (bank == _GET_COLOR)
+		return requestColor(start);
+	#endif
+	#else
+	#ifndef AMULET_NO_BYTES
+	if (bank == _GET_BYTE)
+		return (count == 1) ? requestByte(start) : requestBytes(start, count);
+	#endif
+	#ifndef AMULET_NO_WORDS
+	if (bank == _GET_WORD)
+		return (count == 1) ? requestWord(start) : requestWords(start, count);
+	#endif
+	#ifndef AMULET_NO_COLORS
+	if (bank == _GET_COLOR)
+		return (count == 1) ? requestColor(start) : requestColors(start, count);
+	#endif
+	#endif
+	setError();
+	return false;
+}
+
+#ifndef AMULET_NO_POLLING
+/**
+* Subscribe to a range of Amulet variables that pollUpdate keeps fresh in the local array.
+* Ranges of the same bank that are due in the same pollUpdate call and overlap or touch
+* are requested together in a single array request.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param start uint16_t the first index into the Amulet and local array.
+* @param count uint8_t the number of variables, limited by what fits into the receive buffer and the local array
+* @param period_ms uint16_t how often the range should be refreshed
+* @return int8_t the subscription index, used by pollInterval and unsubscribe, or -1 if it could not be added
+*/
+int8_t AmuletLCD::subscribe(uint8_t bank, uint16_t start, uint8_t count, uint16_t period_ms){
+	if ((bank != _GET_BYTE) && (bank != _GET_WORD) && (bank != _GET_COLOR)){  //bank 0 marks a free slot
+		setError();
+		return -1;
+	}
+	if ((count == 0) || (count > maxArrayCount(bank)) || ((uint32_t)start + count > bankLength(bank))){
+		setError();
+		return -1;
+	}
+	for (uint8_t i = 0; i < _PollsLength; i++){
+		if (_Polls[i].bank == 0){
+			_Polls[i].start = start;
+			_Polls[i].count = count;
+			_Polls[i].period = period_ms;
+			_Polls[i].interval = 0;
+			_Polls[i].due = clockMillis();
+			_Polls[i].last = 0;
+			_Polls[i].merged = false;
+			_Polls[i].bank = bank;
+			return i;
+		}
+	}
+	setError();
+	return -1;
+}
+
+/**
+* Remove a subscription added by subscribe.
+* @param index uint8_t the subscription index
+*/
+void AmuletLCD::unsubscribe(uint8_t index){
+	if (index < _PollsLength)
+		_Polls[index].bank = 0;
+}
+
+/**
+* Limit how much of the link the polling scheduler may use, requests and replies included.
+* The link rate is estimated as _baud / 10 bytes per second (start + 8 data + stop bits).
+* @param percent uint8_t the share of the link, 1 to 100. Default 50.
+*/
+void AmuletLCD::setPollBudget(uint8_t percent){
+	if (percent == 0)
+		percent = 1;
+	if (percent > 100)
+		percent = 100;
+	_pollBudget = percent;
+}
+
+/**
+* Run the polling scheduler. Call periodically from loop().
+* Every due subscription is merged with the due subscriptions of the same bank that overlap or touch it,
+* and the merged range is fetched with one blocking request. See requestRange.
+* Frames that would exceed the budget set by setPollBudget are deferred to a later call.
+* @return uint8_t the number of array requests sent
+*/
+uint8_t AmuletLCD::pollUpdate(){
+	uint32_t now = clockMillis();
+	#ifndef AMULET_NO_TX_BATCH
+	flushIfDue();
+	#endif
+	uint32_t rate = (_baud / 10) * _pollBudget / 100;  //bytes per second the scheduler may use
+	uint32_t cap = rate * 100;                          //allow bursts of up to 100ms worth of traffic
+	uint8_t frames = 0;
+	if (cap < 1000UL * (_RxBufferSize + 7))
+		cap = 1000UL * (_RxBufferSize + 7);             //but always at least one full frame
+	uint32_t elapsed = now - _pollRefill;
+	if (rate && (elapsed > cap / rate))
+		_pollTokens = cap;                              //a long idle gap, where elapsed * rate could wrap
+	else
+		_pollTokens += elapsed * rate;                  //rate is bytes/s, so this is bytes x 1000
+	if (_pollTokens > cap)
+		_pollTokens = cap;
+	_pollRefill = now;
+
+	for (uint8_t first = 0; first < _PollsLength; first++){
+		AmuletPoll * p = &_Polls[first];
+		if ((p->bank == 0) || ((int32_t)(now - p->due) < 0))
+			continue;
+		//start a new frame at the lowest due start address of this bank
+		for (uint8_t i = first + 1; i < _PollsLength; i++){
+			if ((_Polls[i].bank == p->bank) && ((int32_t)(now - _Polls[i].due) >= 0) && (_Polls[i].start < p->start))
+				p = &_Polls[i];
+		}
+		uint8_t bank = p->bank;
+		uint16_t start = p->start;
+		uint16_t end = p->start + p->count;
+		uint16_t limit = start + maxArrayCount(bank);
+		uint8_t grown = true;
+		p->merged = true;
+		while (grown){  //keep absorbing due ranges that overlap or touch the frame
+			grown = false;
+			for (uint8_t i = 0; i < _PollsLength; i++){
+				AmuletPoll * q = &_Polls[i];
+				if (q->merged || (q->bank != bank) || ((int32_t)(now - q->due) < 0))
+					continue;
+				if ((q->start >= start) && (q->start <= end) && (q->start + q->count <= limit)){
+					q->merged = true;
+					if (q->start + q->count > end)
+						end = q->start + q->count;
+					grown = true;
+				}
+			}
+		}
+		uint16_t count = end - start;
+		uint32_t cost = 1000UL * (10 + 2*_ea + count * bankWidth(bank));  //request + reply
+		uint8_t ok = false;
+		uint8_t sent = false;
+		if (_pollTokens >= cost){
+			_pollTokens -= cost;
+			sent = true;
+			frames++;
+			ok = requestRange(bank, start, count);
+			now = clockMillis();
+		}
+		for (uint8_t i = 0; i < _PollsLength; i++){
+			AmuletPoll * q = &_Polls[i];
+			if (!q->merged)
+				continue;
+			q->merged = false;
+			if (!sent)  //out of budget, leave it due for the next call
+				continue;
+			if (ok){
+				if (q->last != 0){
+					uint32_t actual = now - q->last;
+					if (actual > 0xFFFF)
+						actual = 0xFFFF;
+					if (q->interval == 0)
+						q->interval = actual;
+					else
+						q->interval = (int32_t)q->interval + ((int32_t)actual - (int32_t)q->interval) / 4;
+				}
+				q->last = now;
+			}
+			q->due = now + q->period;
+		}
+		if (!sent)  //stop here so later, smaller frames can not starve this one
+			break;
+	}
+	return frames;
+}
+
+/**
+* The achieved refresh period of a subscription. The achieved rate is 1000 / pollInterval(index) Hz.
+* Longer than the requested period when the link budget or blocking requests can not keep up.
+* @param index uint8_t the subscription index
+* @return uint16_t the smoothed period in ms between successful refreshes, 0 until refreshed twice.
+*/
+uint16_t AmuletLCD::pollInterval(uint8_t index){
+	if (index < _PollsLength)
+		return _Polls[index].interval;
+	return 0;
+}
+#endif
+
+#ifndef AMULET_NO_IMAGE
+/**
+* Send a range of the local array to Amulet InternalRAM in as few Set Array commands as fit the transmit
+* buffer, waiting for each reply. Use it to bring the display in sync with values changed locally.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param start uint16_t the first index into the Amulet and local array
+* @param count uint16_t the number of variables, any number
+* @return uint8_t true if every command was acknowledged, false otherwise
+*/
+uint8_t AmuletLCD::pushRange(uint8_t bank, uint16_t start, uint16_t count){
+	if ((uint32_t)start + count > bankLength(bank)){
+		setError();
+		return false;
+	}
+	Serial.flush();  //every frame can then use the whole UART transmit buffer
+	while (count){
+		uint16_t n = 1;
+		#ifndef AMULET_NO_ARRAYS
+		uint16_t room = Serial.availableForWrite();
+		if (room > _TxBufferSize)
+			room = _TxBufferSize;
+		if (room > 6 + _ea)
+			n = (room - 6 - _ea) / bankWidth(bank);
+		if (n > 0xFF)
+			n = 0xFF;
+		if (n > count)
+			n = count;
+		if (n == 0)
+			n = 1;
+		#endif
+		if (!sendRange(bank, start, n))
+			return false;
+		start += n;
+		count -= n;
+	}
+	return true;
+}
+
+/**
+* Request a range of Amulet InternalRAM into the local array in as few array requests as fit the receive
+* buffer, e.g. to seed the local array from the display at startup.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param start uint16_t the first index into the Amulet and local array
+* @param count uint16_t the number of variables, any number
+* @return uint8_t true if every request was answered, false otherwise
+*/
+uint8_t AmuletLCD::pullRange(uint8_t bank, uint16_t start, uint16_t count){
+	if ((uint32_t)start + count > bankLength(bank)){
+		setError();
+		return false;
+	}
+	while (count){
+		uint16_t n = maxArrayCount(bank);
+		if (n > count)
+			n = count;
+		if (n == 0)
+			n = 1;
+		if (!requestRange(bank, start, n))
+			return false;
+		start += n;
+		count -= n;
+	}
+	return true;
+}
+
+/**
+* Save the local Byte, Word and Color arrays as an image that restoreImage can bring back after a reset.
+* The arrays are copied in consistent AMULET_IMAGE_CHUNK byte pieces, and the header is written last, at
+* offset 0, so an image cut short by a reset fails its CRC instead of being restored.
+* @param write imageWrite the function writing to the storage, e.g. amuletEepromWrite
+* @return uint8_t true if the image was written, false if write failed
+*/
+uint8_t AmuletLCD::saveImage(imageWrite write){
+	static const uint8_t banks[3] = {_GET_BYTE, _GET_WORD, _GET_COLOR};
+	AmuletImageHeader header;
+	uint8_t chunk[AMULET_IMAGE_CHUNK];
+	uint32_t offset = sizeof(header);
+	uint16_t crc = _CRC_SEED;
+	for (uint8_t b = 0; b < 3; b++){
+		uint8_t width = bankWidth(banks[b]);
+		uint16_t length = bankLength(banks[b]);
+		for (uint16_t i = 0; i < length; ){
+			uint16_t n = AMULET_IMAGE_CHUNK / width;
+			if (n > length - i)
+				n = length - i;
+			snapshot(banks[b], i, n, chunk);
+			crc = updateCRC(crc, chunk, n * width);
+			if (!write(offset, chunk, n * width)){
+				setError();
+				return false;
+			}
+			offset += n * width;
+			i += n;
+		}
+	}
+	header.magic = AMULET_IMAGE_MAGIC;
+	header.byteCount = bankLength(_GET_BYTE);
+	header.wordCount = bankLength(_GET_WORD);
+	header.colorCount = bankLength(_GET_COLOR);
+	header.crc = crc;
+	if (!write(0, (const uint8_t *)&header, sizeof(header))){
+		setError();
+		return false;
+	}
+	return true;
+}
+
+/**
+* Load an image written by saveImage into the local arrays and push them to the display, so it is back in
+* sync after a reset of the Arduino with one Set Array command per transmit buffer full, instead of one
+* command per variable. Call it after setBytePointer, setWordPointer and setColorPointer.
+* The local arrays are left alone if there is no valid image, e.g. on first boot, or if it was saved with
+* arrays of other lengths.
+* @param read imageRead the function reading from the storage, e.g. amuletEepromRead
+* @return uint8_t true if the image was restored and acknowledged by the display, false otherwise
+*/
+uint8_t AmuletLCD::restoreImage(imageRead read){
+	static const uint8_t banks[3] = {_GET_BYTE, _GET_WORD, _GET_COLOR};
+	AmuletImageHeader header;
+	uint32_t offset = sizeof(header);
+	if (!imageMatches(read, &header))
+		return false;
+	for (uint8_t b = 0; b < 3; b++){
+		uint16_t length = bankLength(banks[b]);
+		uint32_t size = (uint32_t)length * bankWidth(banks[b]);
+		uint8_t * data = bankData(banks[b]);
+		uint8_t ok = true;
+		if (length == 0)
+			continue;
+		beginWrite(banks[b]);
+		for (uint32_t i = 0; ok && (i < size); i += 0x8000)
+			ok = read(offset + i, data + i, (size - i > 0x8000) ? 0x8000 : size - i);
+		valuesChanged(banks[b], 0, length);
+		if (!ok){
+			setError();
+			return false;
+		}
+		offset += size;
+	}
+	for (uint8_t b = 0; b < 3; b++){
+		if (!pushRange(banks[b], 0, bankLength(banks[b])))
+			return false;
+	}
+	return true;
+}
+
+/**
+* Utility function checking the header and CRC of an image against the local arrays, before they are overwritten.
+* @param read imageRead the function reading from the storage
+* @param header AmuletImageHeader* where to read the header
+* @return uint8_t true if the image is valid and fits the local arrays
+*/
+uint8_t AmuletLCD::imageMatches(imageRead read, AmuletImageHeader * header){
+	uint8_t chunk[AMULET_IMAGE_CHUNK];
+	uint32_t offset = sizeof(*header);
+	uint32_t end;
+	uint16_t crc = _CRC_SEED;
+	if (!read(0, (uint8_t *)header, sizeof(*header)))
+		return false;
+	if ((header->magic != AMULET_IMAGE_MAGIC) || (header->byteCount != bankLength(_GET_BYTE)) ||
+		(header->wordCount != bankLength(_GET_WORD)) || (header->colorCount != bankLength(_GET_COLOR)))
+		return false;
+	end = offset + header->byteCount + 2UL * header->wordCount + 4UL * header->colorCount;
+	while (offset < end){
+		uint16_t n = (end - offset > AMULET_IMAGE_CHUNK) ? AMULET_IMAGE_CHUNK : end - offset;
+		if (!read(offset, chunk, n))
+			return false;
+		crc = updateCRC(crc, chunk, n);
+		offset += n;
+	}
+	return crc == header->crc;
+}
+
+/**
+* Utility function behind pushRange. Sends a range of the local array as one Set command.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param start uint16_t the first index into the Amulet and local array.
+* @param count uint8_t the number of variables, 1 when built with AMULET_NO_ARRAYS
+* @return uint8_t true if correct response was received, false otherwise
+*/
+uint8_t AmuletLCD::sendRange(uint8_t bank, uint16_t start, uint8_t count){
+	#ifndef AMULET_NO_BYTES
+	if (bank == _GET_BYTE)
+		#ifdef AMULET_NO_ARRAYS
+		return setByte(start, getByte(start), true);
+		#else
+		return (count == 1) ? setByte(start, getByte(start), true) : setBytes(start, count, true);
+		#endif
+	#endif
+	#ifndef AMULET_NO_WORDS
+	if (bank == _GET_WORD)
+		#ifdef AMULET_NO_ARRAYS
+		return setWord(start, getWord(start), true);
+		#else
+		return (count == 1) ? setWord(start, getWord(start), true) : setWords(start, count, true);
+		#endif
+	#endif
+	#ifndef AMULET_NO_COLORS
+	if (bank == _GET_COLOR)
+		#ifdef AMULET_NO_ARRAYS
+		return setColor(start, getColor(start), true);
+		#else
+		return (count == 1) ? setColor(start, getColor(start), true) : setColors(start, count, true);
+		#endif
+	#endif
+	setError();
+	return false;
+}
+
+#if defined(__AVR__)
+/**
+* imageRead for the AVR EEPROM, starting at AMULET_IMAGE_EEPROM_ADDR.
+*/
+uint8_t amuletEepromRead(uint32_t offset, uint8_t * data, uint16_t length){
+	if (AMULET_IMAGE_EEPROM_ADDR + offset + length > E2END + 1UL)
+		return false;
+	eeprom_read_block(data, (const void *)(uint16_t)(AMULET_IMAGE_EEPROM_ADDR + offset), length);
+	return true;
+}
+
+/**
+* imageWrite for the AVR EEPROM, starting at AMULET_IMAGE_EEPROM_ADDR. Bytes that did not change are not
+* written again, which spares the EEPROM when the same values are saved over and over.
+*/
+uint8_t amuletEepromWrite(uint32_t offset, const uint8_t * data, uint16_t length){
+	if (AMULET_IMAGE_EEPROM_ADDR + offset + length > E2END + 1UL)
+		return false;
+	eeprom_update_block(data, (void *)(uint16_t)(AMULET_IMAGE_EEPROM_ADDR + offset), length);
+	return true;
+}
+#endif
+#endif
+
+/**
+* Utility function returning the size of one variable in the bank.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @return uint8_t the number of bytes per variable
+*/
+uint8_t AmuletLCD::bankWidth(uint8_t bank){
+	if (bank == _GET_BYTE)
+		return 1;
+	if (bank == _GET_WORD)
+		return 2;
+	return 4;
+}
+
+/**
+* Utility function returning the length of the local array of a bank.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @return uint16_t the length set by setBytePointer, setWordPointer or setColorPointer, 0 if the bank is compiled out
+*/
+uint16_t AmuletLCD::bankLength(uint8_t bank){
+	#ifndef AMULET_NO_BYTES
+	if (bank == _GET_BYTE)
+		return _BytesLength;
+	#endif
+	#ifndef AMULET_NO_WORDS
+	if (bank == _GET_WORD)
+		return _WordsLength;
+	#endif
+	#ifndef AMULET_NO_COLORS
+	if (bank == _GET_COLOR)
+		return _ColorsLength;
+	#endif
+	return 0;
+}
+
+/**
+* Utility function returning the local array of a bank.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @return uint8_t* the array set by setBytePointer, setWordPointer or setColorPointer, NULL if the bank is compiled out
+*/
+uint8_t * AmuletLCD::bankData(uint8_t bank){
+	#ifndef AMULET_NO_BYTES
+	if (bank == _GET_BYTE)
+		return _Bytes;
+	#endif
+	#ifndef AMULET_NO_WORDS
+	if (bank == _GET_WORD)
+		return (uint8_t *)_Words;
+	#endif
+	#ifndef AMULET_NO_COLORS
+	if (bank == _GET_COLOR)
+		return (uint8_t *)_Colors;
+	#endif
+	return NULL;
+}
+
+/**
+* Utility function returning the largest array request whose reply fits into the receive buffer.
+* The reply is host addr + opcode + 8/16bit address + count + data + 2-byte CRC.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @return uint8_t the maximum count for the bank. 1 when built with AMULET_NO_ARRAYS.
+*/
+uint8_t AmuletLCD::maxArrayCount(uint8_t bank){
+	#ifdef AMULET_NO_ARRAYS
+	return 1;
+	#else
+	uint16_t count = (_RxBufferSize > 6 + _ea) ? (_RxBufferSize - 6 - _ea) / bankWidth(bank) : 0;
+	if (count > 0xFF)
+		count = 0xFF;
+	return count;
+	#endif
+}
+
+#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+/**
+* Watch the link to the display. Once failures tries of blocking commands in a row have timed out, the
+* link is down: the command gives up without its remaining retries, hook is called with false, and every
+* blocking command fails at once without being sent. Commands that do not wait for a reply still go out.
+* checkLink then tries the link every heartbeatMs, or AMULET_LINK_PROBE_MS without a heartbeat. When it
+* answers, or the display sends a valid frame on its own, every local array is pushed to the display
+* again with pushRange, and hook is called with true.
+* While the link is up and nothing has been heard for heartbeatMs, checkLink sends a heartbeat, so a
+* quiet link is found down within heartbeatMs plus failures timeouts. Heartbeats and tries request variable 0
+* of the first bank with a local array (Byte, Word, then Color), and only check that the reply arrives: the
+* local copy is not overwritten and nothing on the display changes.
+* @param failures uint8_t tries in a row that time out before the link is down, 0 to stop watching
+* @param heartbeatMs uint16_t how long the link may be quiet before a heartbeat, 0 for none
+* @param hook linkHook called when the link goes down or comes back, or NULL
+*/
+void AmuletLCD::setLinkMonitor(uint8_t failures, uint16_t heartbeatMs, linkHook hook){
+	_linkFailLimit = failures;
+	_heartbeatMs = heartbeatMs;
+	_linkHook = hook;
+	_linkFailures = 0;
+	_linkDown = false;
+	_linkActive = clockMillis();
+}
+
+/**
+* Send a heartbeat or try a link that is down, if one is due, and bring the display back in sync once
+* the link answers again. See setLinkMonitor. Call from loop(), not from an idle hook.
+* @return uint8_t true if the link is up
+*/
+uint8_t AmuletLCD::checkLink(){
+	static const uint8_t banks[3] = {_GET_BYTE, _GET_WORD, _GET_COLOR};
+	uint32_t now = clockMillis();
+	if (!_linkFailLimit || _linkChecking)
+		return !_linkDown;
+	if (!_linkDown){
+		if (_heartbeatMs && (now - _linkActive >= _heartbeatMs))
+			linkProbe();          //a timeout counts towards failures like any other
+		return !_linkDown;
+	}
+	if (!_linkHeard && (now - _linkActive < (_heartbeatMs ? _heartbeatMs : AMULET_LINK_PROBE_MS)))
+		return false;
+	_linkActive = now;
+	if (!linkProbe())
+		return false;
+	_linkDown = false;
+	_linkFailures = 0;
+	for (uint8_t b = 0; b < 3; b++){
+		if (bankLength(banks[b]) && !pushRange(banks[b], 0, bankLength(banks[b]))){
+			if (!_linkDown)
+				linkLost();
+			return false;
+		}
+	}
+	if (_linkHook)
+		_linkHook(true);
+	return true;
+}
+
+/**
+* @return uint8_t false while the link is down, see setLinkMonitor
+*/
+uint8_t AmuletLCD::linkUp(){
+	return !_linkDown;
+}
+
+/**
+* Utility function marking the link down and telling the application.
+*/
+void AmuletLCD::linkLost(){
+	_linkDown = true;
+	_linkHeard = false;
+	_linkActive = clockMillis();
+	if (_linkHook)
+		_linkHook(false);
+}
+
+/**
+* Utility function sending one heartbeat, or one try while the link is down, as a Get whose reply is not stored.
+* @return uint8_t true if the display answered. Without a local array, true if it sent a frame on its own.
+*/
+uint8_t AmuletLCD::linkProbe(){
+	uint8_t bank = bankLength(_GET_BYTE) ? _GET_BYTE : bankLength(_GET_WORD) ? _GET_WORD : bankLength(_GET_COLOR) ? _GET_COLOR : 0;
+	uint8_t ok;
+	if (bank == 0)
+		return _linkHeard;
+	_linkChecking = true;
+	ok = requestRange(bank, 0, 1);
+	_linkChecking = false;
+	return ok;
+}
+#endif
+
+/**
+* Utility function for all blocking master messages.
+* Will handle timeouts and retries. Once the outermost blocking command is done, the command
+* buffer is free again, so this is where the link steps down to a slower rate, see negotiateBaud.
+* @param command uint8_t * the array containing the command to send.
+* @param length uint16_t the number of bytes to send
+* @return int8_t true if correct response was received, false otherwise
+*/
+uint8_t AmuletLCD::send_command_blocking(uint8_t * command, uint16_t length)
+{
+	#ifdef AMULET_NO_AUTOBAUD
+	return send_command_attempts(command, length);
+	#else
+	uint8_t ok;
+	_blockingDepth++;
+	ok = send_command_attempts(command, length);
+	_blockingDepth--;
+	if (_baudStepDown && (_blockingDepth == 0))
+		stepDownBaud();
+	return ok;
+	#endif
+}
+
+#ifndef AMULET_NO_TX_BATCH
+/**
+* Collect the frames of non-blocking commands in a buffer and write them to Serial together, instead
+* of one write per frame. The buffer is written when the next frame does not fit, on flush(), before
+* any blocking command or reply to the display, and by serialEvent, poll and pollUpdate once the
+* first frame has waited maxDelayUs. Frames longer than the buffer are written on their own.
+* ptrSize should not be more than Serial's transmit buffer (64 bytes on AVR), or writing it blocks.
+* @param ptr uint8_t* the buffer, NULL to write every frame at once again
+* @param ptrSize uint16_t the length of the buffer
+* @param maxDelayUs uint32_t how long a frame may wait for others, 0 for no limit
+*/
+void AmuletLCD::setTxBatchPointer(uint8_t * ptr, uint16_t ptrSize, uint32_t maxDelayUs){
+	flush();
+	_TxBatch = ptr;
+	_TxBatchSize = ptr ? ptrSize : 0;
+	_TxBatchDelay = maxDelayUs;
+}
+
+/**
+* Write the frames collected since the last write, see setTxBatchPointer.
+*/
+void AmuletLCD::flush(){
+	if (_TxBatchLength > 0){
+		Serial.write(_TxBatch, _TxBatchLength);
+		_TxBatchLength = 0;
+	}
+}
+
+/**
+* Utility function writing the batch once its first frame has waited long enough.
+*/
+void AmuletLCD::flushIfDue(){
+	if ((_TxBatchLength > 0) && _TxBatchDelay && (clockMicros() - _TxBatchStart >= _TxBatchDelay))
+		flush();
+}
+#endif
+
+/**
+* Utility function writing a frame to Serial, or adding it to the batch set with setTxBatchPointer.
+* @param frame uint8_t* the frame, including CRC
+* @param length uint16_t the length of the frame
+* @param now uint8_t true to write it and the batch before it right away, e.g. when a reply is awaited
+*/
+void AmuletLCD::writeFrame(uint8_t * frame, uint16_t length, uint8_t now){
+	#ifndef AMULET_NO_TX_BATCH
+	if (_TxBatch){
+		flushIfDue();
+		if (_TxBatchLength + length > _TxBatchSize)
+			flush();
+		if (length <= _TxBatchSize){
+			if (_TxBatchLength == 0)
+				_TxBatchStart = clockMicros();
+			memcpy(_TxBatch + _TxBatchLength, frame, length);
+			_TxBatchLength += length;
+			if (now)
+				flush();
+			return;
+		}
+	}
+	#endif
+	Serial.write(frame, length);
+}
+
+/**
+* Utility function sending a command until the reply arrives or the retries run out.
+* @param command uint8_t * the array containing the command to send.
+* @param length uint16_t the number of bytes to send
+* @return int8_t true if correct response was received, false otherwise
+*/
+uint8_t AmuletLCD::send_command_attempts(uint8_t * command, uint16_t length)
+{
+	uint8_t tryNumber = 0;
+	#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+	if (_linkDown && !_linkChecking){
+		setError();
+		return false;             //fail at once until checkLink finds the link back
+	}
+	#endif
+	while (1){
+		writeFrame(command, length, true);
+		#ifndef AMULET_NO_AUTOBAUD
+		if (_linkFrames >= AMULET_BAUD_WINDOW){
+			if (_baudChange && (_baud > _baseBaud) && ((uint32_t)_linkTimeouts * 100 > (uint32_t)_linkFrames * _baudFallback))
+				_baudStepDown = true;
+			_linkFrames = 0;
+			_linkTimeouts = 0;
+		}
+		_linkFrames++;
+		#endif
+		uint32_t startTime = clockMillis();
+		while (clockMillis() - startTime < _Timeout_ms){
+			serialEvent();
+			switch (command[1])
+			{
+				#ifndef AMULET_NO_BYTES
+				case _GET_BYTE:
+					if (_GetByteReply)
+						return true;
+					break;
+				case _SET_BYTE:
+					if (_SetByteReply)
+						return true;
+					break;
+				#ifndef AMULET_NO_ARRAYS
+				case _GET_BYTE_ARRAY:
+					if (_GetBytesReply)
+						return true;
+					break;
+				case _SET_BYTE_ARRAY:
+					if (_SetBytesReply)
+						return true;
+					break;
+				#endif
+				#endif
+				#ifndef AMULET_NO_WORDS
+				case _GET_WORD:
+					if (_GetWordReply)
+						return true;
+					break;
+				case _SET_WORD:
+					if (_SetWordReply)
+						return true;
+					break;
+				#ifndef AMULET_NO_ARRAYS
+				case _GET_WORD_ARRAY:
+					if (_GetWordsReply)
+						return true;
+					break;
+				case _SET_WORD_ARRAY:
+					if (_SetWordsReply)
+						return true;
+					break;
+				#endif
+				#endif
+				#ifndef AMULET_NO_COLORS
+				case _GET_COLOR:
+					if (_GetColorReply)
+						return true;
+					break;
+				case _SET_COLOR:
+					if (_SetColorReply)
+						return true;
+					break;
+				#ifndef AMULET_NO_ARRAYS
+				case _GET_COLOR_ARRAY:
+					if (_GetColorsReply)
+						return true;
+					break;
+				case _SET_COLOR_ARRAY:
+					if (_SetColorsReply)
+						return true;
+					break;
+				#endif
+				#endif
+				#ifndef AMULET_NO_STRINGS
+				case _GET_STRING:
+				if (_GetStringReply)
+						return true;
+					break;
+				case _SET_STRING:
+                    if (_SetStringReply)
+						return true;
+					break;
+				#endif
+//				case _GET_RPC:
+//				case _GET_LABEL:
+				#ifndef AMULET_NO_GEMSCRIPT
+                case _INVOKE_GEMSCRIPT:
+					if (_InvokeGEMscriptReply)
+						return true;
+					break;
+				#endif
+				default:
+					return false;
+			}
+			#ifndef AMULET_NO_IDLE
+			idle();
+			#endif
+		}
+		#ifndef AMULET_NO_AUTOBAUD
+		_linkTimeouts++;
+		#endif
+		#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+		if (_linkFailLimit && !_linkDown && (++_linkFailures >= _linkFailLimit))
+			linkLost();
+		if (_linkDown){
+			setError();
+			return false;         //no retries while the link is down
+		}
+		#endif
+		if (tryNumber < _retries){
+			tryNumber++;
+			_retryCount++;
+		}
+		else{
+			setError();
+			return false;
+		}
+	}
+}
+
+/**
+* Utility function to calculate the MODBUS CRC of the given array.
+* @param ptr uint8_t* the array to calculate
+* @param count uint16_t the length of the array
+* @return uint16_t The calculated CRC value.
+*/
+uint16_t AmuletLCD::calcCRC(uint8_t *ptr, uint16_t count){
+   return updateCRC(_CRC_SEED, ptr, count);
+}
+
+/**
+* Utility function to continue a MODBUS CRC over more bytes.
+* Used by sendPreparedValue to only run the CRC over the payload of a prepared frame.
+* @param crc uint16_t the CRC of the bytes preceding ptr, or _CRC_SEED to start a new CRC
+* @param ptr uint8_t* the array to calculate
+* @param count uint16_t the length of the array
+* @return uint16_t The calculated CRC value.
+*/
+uint16_t AmuletLCD::updateCRC(uint16_t crc, uint8_t *ptr, uint16_t count){
+   return amuletCRCUpdate(crc, ptr, count);
+}
+
+void AmuletLCD::appendCRC(uint8_t *ptr, uint16_t count){
+	uint16_t CRC = calcCRC(ptr, count);
+	ptr[count] = CRC & 0xFF;
+	ptr[count+1] = (CRC >> 8) & 0xFF;
+}
+
+/**
+* Heartbeat function that manages the state machine with incoming serial data. This should be called periodically
+* in your main loop or your own serialEvent() if supported by your board.
+* https://www.arduino.cc/en/Tutorial/SerialEvent
+* If arrays longer than the serial buffer are requested and you have blocking code, then consider peppering this command within your block
+* Alternatively, call UART_State_Machine from a real UART interrupt 
+*(advanced topic, additional libraries may be required, plus you need to make UART_State_Machine public)
+*/
+void AmuletLCD::serialEvent(){
+	while(Serial.available() > 0){
+		CRC_State_Machine(Serial.read());
+  	}
+	AMULET_STAMP(AMULET_STAMP_IDLE);
+	#ifndef AMULET_NO_TX_BATCH
+	flushIfDue();
+	#endif
+}
+
+/**
+* Bounded version of serialEvent, for loops with tight timing. Parses input until maxMicros have
+* passed or maxFrames complete frames were handled, including their replies and RPC callbacks.
+* The parser keeps its state between bytes, so the next call picks up exactly where this one stopped,
+* even in the middle of a frame. Call it often enough that Serial's receive buffer does not overflow,
+* see backlog. Blocking commands still drain the input themselves while they wait.
+* @param maxMicros uint32_t time budget, checked after each frame and every AMULET_POLL_CHECK bytes. 0 for no limit.
+* @param maxFrames uint8_t frames to handle at most. 0 for no limit.
+* @return uint8_t the number of frames handled
+*/
+uint8_t AmuletLCD::poll(uint32_t maxMicros, uint8_t maxFrames){
+	uint32_t start = clockMicros();
+	uint32_t first = _rxFrames;
+	uint8_t bytes = 0;
+	while (Serial.available() > 0){
+		uint32_t frames = _rxFrames;
+		CRC_State_Machine(Serial.read());
+		if (_rxFrames != frames){
+			if (maxFrames && (_rxFrames - first >= maxFrames))
+				break;
+			bytes = AMULET_POLL_CHECK;  //a frame was handled, check the time now
+		}
+		if (maxMicros && (++bytes >= AMULET_POLL_CHECK)){
+			bytes = 0;
+			if (clockMicros() - start >= maxMicros)
+				break;
+		}
+	}
+	#ifdef AMULET_LATENCY
+	if (Serial.available() == 0)
+		AMULET_STAMP(AMULET_STAMP_IDLE);  //bytes left for the next call have been waiting already
+	#endif
+	#ifndef AMULET_NO_TX_BATCH
+	flushIfDue();
+	#endif
+	return _rxFrames - first;
+}
+
+/**
+* The number of received bytes poll has not parsed yet. A growing backlog means poll's budget is too small.
+* @return int the bytes waiting in Serial's receive buffer
+*/
+int AmuletLCD::backlog(){
+	return Serial.available();
+}
+
+#ifndef AMULET_NO_IDLE
+/**
+* Register a function to run while a blocking command (setWord(..., true), requestWord, callScript...)
+* waits for its reply, e.g. to kick a watchdog or sample a sensor. It is called after every check for the
+* reply, so it should return quickly. It must not wait for replies itself; setWord(loc, value, false) and the
+* like are fine.
+* @param hook idleHook the function to call, or NULL to stop calling one
+*/
+void AmuletLCD::setIdleHook(idleHook hook){
+	_idleHook = hook;
+}
+
+/**
+* Let the CPU sleep in idle mode between checks for a reply, instead of spinning on millis(). Any interrupt
+* wakes it: the UART with the reply, or Timer0 once per millisecond, which keeps millis() and the timeout
+* running. PWM keeps running too. Only AVR boards sleep; elsewhere this has no effect.
+* @param enable uint8_t true to sleep while waiting, default false
+*/
+void AmuletLCD::setIdleSleep(uint8_t enable){
+	_idleSleep = enable;
+}
+
+/**
+* Utility function called while send_command_attempts waits for a reply.
+*/
+void AmuletLCD::idle(){
+	if (_idleHook && !_inIdle){
+		_inIdle = true;
+		_idleHook();
+		_inIdle = false;
+	}
+	#if defined(__AVR__)
+	if (_idleSleep){
+		set_sleep_mode(SLEEP_MODE_IDLE);
+		cli();
+		if (Serial.available() == 0){  //a byte arriving after this check still wakes the sleep below
+			sleep_enable();
+			sei();                       //the instruction after sei always runs before any interrupt
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
+	}
+	#endif
+}
+#endif
+
+#ifndef AMULET_NO_CLOCK
+/**
+* Read the time from other sources than millis() and micros(), e.g. a virtual clock that lets tests
+* run the timeouts and retries of blocking commands without waiting for them. Every timeout, age and
+* latency the library measures uses these. The delays negotiateBaud gives the UARTs to settle do not.
+* @param millisSource clockSource milliseconds, or NULL for millis()
+* @param microsSource clockSource microseconds on the same time line, or NULL for micros()
+*/
+void AmuletLCD::setClock(clockSource millisSource, clockSource microsSource){
+	_millis = millisSource ? millisSource : millis;
+	_micros = microsSource ? microsSource : micros;
+}
+#endif
+
+/**
+* Utility function returning the time in milliseconds, from millis() or the source given to setClock.
+*/
+uint32_t AmuletLCD::clockMillis(){
+	#ifndef AMULET_NO_CLOCK
+	return _millis();
+	#else
+	return millis();
+	#endif
+}
+
+/**
+* Utility function returning the time in microseconds, from micros() or the source given to setClock.
+*/
+uint32_t AmuletLCD::clockMicros(){
+	#ifndef AMULET_NO_CLOCK
+	return _micros();
+	#else
+	return micros();
+	#endif
+}
+
+/**
+* Append a received byte to the receive buffer. Once it is full, the rest of the frame is only
+* counted, so the state machine stays in step and the frame is dropped when it ends.
+* @param b uint8_t the next serial byte to process.
+*/
+void AmuletLCD::storeRx(uint8_t b){
+	if (_RxBufferLength < _RxBufferSize)
+		_RxBuffer[_RxBufferLength] = b;
+	_RxBufferLength++;
+}
+
+/**
+* Main state machine of the Amulet CRC protocol handler.
+* @param b uint8_t the next serial byte to process.
+*/
+void AmuletLCD::CRC_State_Machine(uint8_t b){  
+  static uint16_t i;     //remaining bytes before CRC for known length commands (non-string)
+  static int16_t count; //count of bytes left
+  switch(_UART_State){
+    case _RECIEVE_BEGIN:   //begin - look for a valid address
+        if ((b == _HOST_ADDRESS)||(b == _AMULET_ADDRESS)) {
+            _UART_State = _PARSE_OPCODE;
+            storeRx(b);
+            i = 1;
+            AMULET_STAMP(AMULET_STAMP_START);
+        if (b == _AMULET_ADDRESS)
+            _reply = true;  //this is a reply to a previous Arduino-as-master Get or Set command.
+        else
+            _reply = false; //this is a new Amulet-as-master command
+        }  
+        //else{} //stay in this state
+        break;
+    case _PARSE_OPCODE:               //parse opcode to determine next state
+        count = recieve_OpcodeParser(b);  	  
+        if (count == -1) {               //invalid opcode, reset state machine
+            _RxBufferLength = 0;
             _UART_State = _RECIEVE_BEGIN;
         }
         else if (count == -2) {           //Reply to SET cmd
             count = 0; //there is no data
-            _RxBuffer[_RxBufferLength++] = b;
+            storeRx(b);
             _UART_State = _GET_CRC1;
         }
         else if (count == 0) {           //variable length array or string
-            _RxBuffer[_RxBufferLength++] = b;
+            storeRx(b);
+            #ifndef AMULET_NO_STRINGS
             if ((b == _SET_STRING) || (b == _GET_STRING)) {
                 if (_ea)
                     _UART_State = _VARIABLE_LENGTH_STRING_ADDR1;
                 else
                     _UART_State = _VARIABLE_LENGTH_STRING_ADDR2;
             }
-            else{
+            else
+            #endif
+            {
                 if (_ea)
                     _UART_State = _VARIABLE_LENGTH_ARRAY_ADDR1;
                 else
@@ -800,49 +2577,54 @@ void AmuletLCD::CRC_State_Machine(uint8_t b){
             }      
         }
         else if (count > 0) {            //static length command
-            _RxBuffer[_RxBufferLength++] = b;
+            storeRx(b);
             _UART_State = _STATIC_LENGTH;
         }   
         break;
     case _STATIC_LENGTH:              //fixed length command. increment i until count bytes received, then get CRC
         if (i < count) {
-            _RxBuffer[_RxBufferLength++] = b;
+            storeRx(b);
             i++;
         }
         else {
-            _RxBuffer[_RxBufferLength++] = b;
+            storeRx(b);
             _UART_State = _GET_CRC1;
         }
         break;
+    #ifndef AMULET_NO_ARRAYS
     case _VARIABLE_LENGTH_ARRAY_ADDR1:  //array command, next byte contains starting address
-        _RxBuffer[_RxBufferLength++] = b;
+        storeRx(b);
         _UART_State = _VARIABLE_LENGTH_ARRAY_ADDR2;
         break;
     case _VARIABLE_LENGTH_ARRAY_ADDR2:  //array command, next byte contains starting address
-        _RxBuffer[_RxBufferLength++] = b;
+        storeRx(b);
         _UART_State = _ARRAY_START;
         break;
+    #endif
+    #ifndef AMULET_NO_STRINGS
     case _VARIABLE_LENGTH_STRING_ADDR1:
-        _RxBuffer[_RxBufferLength++] = b;
+        storeRx(b);
         _UART_State = _VARIABLE_LENGTH_STRING_ADDR2;
         break;
     case _VARIABLE_LENGTH_STRING_ADDR2:
-        _RxBuffer[_RxBufferLength++] = b;
+        storeRx(b);
         _UART_State = _VARIABLE_LENGTH_STRING;
         break;
     case _VARIABLE_LENGTH_STRING:
         if (b != 0x00 || count == 0) {
-            _RxBuffer[_RxBufferLength++] = b;
+            storeRx(b);
             count++;
         }
         else {
-            _RxBuffer[_RxBufferLength++] = b;
+            storeRx(b);
             count++;
             _UART_State = _GET_CRC1;
         }
         break;
+    #endif
+    #ifndef AMULET_NO_ARRAYS
     case _ARRAY_START:
-      _RxBuffer[_RxBufferLength++] = b;
+      storeRx(b);
       switch(_RxBuffer[1]) {              //calc # of bytes before CRC
         case _SET_BYTE_ARRAY:
 		case _GET_BYTE_ARRAY:  //should only get here when receiving a reply, not a master message from Amulet.
@@ -866,22 +2648,27 @@ void AmuletLCD::CRC_State_Machine(uint8_t b){
       break;
     case _ARRAY_DATA:
       if (i < count) {
-        _RxBuffer[_RxBufferLength++] = b;
+        storeRx(b);
         i++;
       }
       else{
-        _RxBuffer[_RxBufferLength++] = b;
+        storeRx(b);
         _UART_State = _GET_CRC1;
       }    
       break;
+    #endif
     case _GET_CRC1:
-      _RxBuffer[_RxBufferLength++] = b;
+      storeRx(b);
       _UART_State = _GET_CRC2;
       break;
     case _GET_CRC2:
-      _RxBuffer[_RxBufferLength++] = b;
+      storeRx(b);
       _UART_State = _RECIEVE_BEGIN;
-      processUARTCommand(_RxBuffer,_RxBufferLength);
+      AMULET_STAMP(AMULET_STAMP_COMPLETE);
+      if (_RxBufferLength > _RxBufferSize)
+        setError();  //frame did not fit, drop it. The sender times out and retries.
+      else
+        processUARTCommand(_RxBuffer,_RxBufferLength);
 	  _RxBufferLength = 0;
       break;
     default:
@@ -902,48 +2689,99 @@ int8_t AmuletLCD::recieve_OpcodeParser(uint8_t b){
     {
         switch (b)
         {
+            #ifndef AMULET_NO_BYTES
             case _GET_BYTE:
                 return 2+_ea;
+            #endif
+            #ifndef AMULET_NO_WORDS
             case _GET_WORD:
                 return 3+_ea;
+            #endif
+            #ifndef AMULET_NO_COLORS
             case _GET_COLOR:
                 return 5+_ea;
+            #endif
+            #ifndef AMULET_NO_ARRAYS
             case _GET_BYTE_ARRAY:
             case _GET_WORD_ARRAY:
             case _GET_COLOR_ARRAY:
+            #endif
+            #ifndef AMULET_NO_STRINGS
 			case _GET_STRING:
+            #endif
+            #if !defined(AMULET_NO_ARRAYS) || !defined(AMULET_NO_STRINGS)
                 return 0;
+            #endif
             case _SET_BYTE:
             case _SET_WORD:
             case _SET_COLOR:
             case _SET_STRING:
+            case _SET_BYTE_ARRAY:
+            case _SET_WORD_ARRAY:
+            case _SET_COLOR_ARRAY:
                 return -2; //No packet data follows opcode in a reply to a SET command, just CRC 
+            #ifndef AMULET_NO_GEMSCRIPT
             case _INVOKE_GEMSCRIPT:
                 return 4;
+            #endif
         }
     }
     //else - not a reply
-    if (b==_GET_BYTE || b==_GET_WORD || b==_GET_STRING || b==_GET_COLOR || b==_GET_LABEL) {
-        return 1+_ea;
-    }
-    if (b==_INVOKE_RPC){ 
-        return 1;
-    }
-    else if (b==_SET_BYTE || b==_GET_BYTE_ARRAY ||  b==_GET_WORD_ARRAY || b==_GET_COLOR_ARRAY){ //set: Byte. getarray: byte, word, color.
-        return 2+_ea;
-    }
-    else if (b==_SET_WORD){
-        return 3+_ea;
-    }
-    else if (b==_SET_COLOR){
-        return 5+_ea;
-    }
-    else if (b==_SET_STRING || b==_SET_BYTE_ARRAY || b==_SET_WORD_ARRAY || b==_SET_COLOR_ARRAY){  // variable length array
-        return 0;
-    }
-    else {   //invalid opcode. 
-        return -1; 
+    switch (b)
+    {
+        #ifndef AMULET_NO_BYTES
+        case _GET_BYTE:
+        #endif
+        #ifndef AMULET_NO_WORDS
+        case _GET_WORD:
+        #endif
+        #ifndef AMULET_NO_COLORS
+        case _GET_COLOR:
+        #endif
+        #ifndef AMULET_NO_STRINGS
+        case _GET_STRING:
+        #endif
+        case _GET_LABEL:
+            return 1+_ea;
+        #ifndef AMULET_NO_RPC
+        case _INVOKE_RPC:
+            return 1;
+        #endif
+        #ifndef AMULET_NO_BYTES
+        case _SET_BYTE:
+        #endif
+        #ifndef AMULET_NO_ARRAYS
+        case _GET_BYTE_ARRAY:  //getarray: byte, word, color.
+        case _GET_WORD_ARRAY:
+        case _GET_COLOR_ARRAY:
+        #endif
+            return 2+_ea;
+        #ifndef AMULET_NO_WORDS
+        case _SET_WORD:
+            return 3+_ea;
+        #endif
+        #ifndef AMULET_NO_COLORS
+        case _SET_COLOR:
+            return 5+_ea;
+        #endif
+        #ifndef AMULET_NO_STRINGS
+        case _SET_STRING:  // variable length string
+            return 0;
+        #endif
+        #ifndef AMULET_NO_ARRAYS
+        #ifndef AMULET_NO_BYTES
+        case _SET_BYTE_ARRAY:  // variable length array
+        #endif
+        #ifndef AMULET_NO_WORDS
+        case _SET_WORD_ARRAY:
+        #endif
+        #ifndef AMULET_NO_COLORS
+        case _SET_COLOR_ARRAY:
+        #endif
+            return 0;
+        #endif
     }
+    return -1;  //invalid opcode, or one that was compiled out
 }
 
 
@@ -976,7 +2814,7 @@ boolean AmuletLCD::checkCRC(uint8_t *buf, uint16_t bufLen){
 * @param bufLen uint16_t The length of the command in the buffer
 */
 void AmuletLCD::processUARTCommand(uint8_t *buf, uint16_t bufLen){
-	uint8_t _TxBufferLength = 0;
+	uint8_t reply[sizeof(AmuletReply::frame)];  //not _TxBuffer, which may hold a master frame waiting for its reply
 	uint16_t returnCRC = 0;
 	uint8_t i = 0;
 	uint16_t start;
@@ -984,23 +2822,52 @@ void AmuletLCD::processUARTCommand(uint8_t *buf, uint16_t bufLen){
 	uint8_t * arrayPtr;
 	uint8_t * strPtr;
 	uint8_t * srcPtr;
-	uint8_t temp1, temp2, temp3;
     if (_ea)
         start = (buf[2] << 8) + buf[3];
     else
         start = buf[2];
 	//Serial.write(buf,bufLen); //DEBUG
+  _rxFrames++;
   if(checkCRC(buf,bufLen)){ //first verify the CRC is good.
+	#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+	if (_linkFailLimit){
+		_linkFailures = 0;
+		_linkActive = clockMillis();
+		if (_linkDown)
+			_linkHeard = true;
+	}
+	#endif
 	if (_reply){  
 		switch(buf[1]){
+		  #ifndef AMULET_NO_BYTES
 		  case _GET_BYTE:
+			#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+			if (_linkChecking){
+				_GetByteReply = true;  //a heartbeat or try, see linkProbe. The local copy is left alone.
+				break;
+			}
+			#endif
+			beginWrite(_GET_BYTE);
 			_Bytes[start] = buf[3+_ea];
+			valuesChanged(_GET_BYTE, start, 1);
 			_GetByteReply = true;
 			break;
+		  #endif
+		  #ifndef AMULET_NO_WORDS
 		  case _GET_WORD:
+			#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+			if (_linkChecking){
+				_GetWordReply = true;  //a heartbeat or try, see linkProbe. The local copy is left alone.
+				break;
+			}
+			#endif
+			beginWrite(_GET_WORD);
 			_Words[start] = word(buf[3+_ea],buf[4+_ea]);
+			valuesChanged(_GET_WORD, start, 1);
 			_GetWordReply = true;
 			break;
+		  #endif
+		  #ifndef AMULET_NO_STRINGS
 		  case _GET_STRING:
 			strPtr = _GetStringDest;
 			srcPtr = buf+3+_ea;
@@ -1011,191 +2878,230 @@ void AmuletLCD::processUARTCommand(uint8_t *buf, uint16_t bufLen){
 			_GetStringReply = true;
 			
 			break;
+		  #endif
+		  #ifndef AMULET_NO_COLORS
 		  case _GET_COLOR:
+			#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+			if (_linkChecking){
+				_GetColorReply = true;  //a heartbeat or try, see linkProbe. The local copy is left alone.
+				break;
+			}
+			#endif
+			beginWrite(_GET_COLOR);
 			_Colors[start] = ((long(buf[3+_ea]) << 24) | (long(buf[4+_ea]) << 16) | (long(buf[5+_ea]) << 8) | buf[6+_ea]);
+			valuesChanged(_GET_COLOR, start, 1);
 			_GetColorReply = true;
 			break;
+		  #endif
+		  #if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_BYTES)
 		  case _GET_BYTE_ARRAY:
 		    //start = buf[2]; already done above
 			//count = buf[3]; already done above
 			buf += (4+_ea);//increment the buffer pointer to the first valid data
 			arrayPtr = _Bytes + start;
-			if (((uint16_t)start + count) < _BytesLength){ //make sure new array fits into local buffer.
-				while(count){
+			if (((uint16_t)start + count) <= _BytesLength){ //make sure new array fits into local buffer.
+				beginWrite(_GET_BYTE);
+				for (uint16_t n = count; n; n--){
 					*arrayPtr++ = *buf++;
-					count--;
 				}
+				valuesChanged(_GET_BYTE, start, count);
 			}
 			else{
 				setError();//TODO Array overflow error
 			}
 			_GetBytesReply = true;
 			break;
+		  #endif
+		  #if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_WORDS)
 		  case _GET_WORD_ARRAY:
 			//start = buf[2]; already done above
 			//count = buf[3]; already done above
 			buf += (4+_ea);//increment the buffer pointer to the first valid data
-			arrayPtr = ((uint8_t *)_Words) + (start*2);  //words are 2 bytes each
-			if (((uint16_t)start + count) < _WordsLength){ //make sure new array fits into local buffer.
-				while(count){  //copy array, swapping byte order
-					temp1 = *buf++;
-					*arrayPtr++ = *buf++;
-					*arrayPtr++ = temp1;
-					count--;
-				}
+			if (((uint16_t)start + count) <= _WordsLength){ //make sure new array fits into local buffer.
+				beginWrite(_GET_WORD);
+				amuletDecodeWords(_Words + start, buf, count);  //copy array, swapping byte order
+				valuesChanged(_GET_WORD, start, count);
 			}
 			else{
 				setError();//TODO Array overflow error
 			}
 			_GetWordsReply = true;
 			break;
+		  #endif
+		  #if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_COLORS)
 		  case _GET_COLOR_ARRAY:
 			//start = buf[2]; already done above
 			//count = buf[3]; already done above
 			buf += (4+_ea);//increment the buffer pointer to the first valid data
-			arrayPtr = ((uint8_t *)_Colors) + (start*4);  //colors are 4 bytes each
-			if (((uint16_t)start + count) < _ColorsLength){ //make sure new array fits into local buffer.
-				while(count){  //copy array, swapping byte order
-					temp1 = *buf++;
-					temp2 = *buf++;
-					temp3 = *buf++;
-					*arrayPtr++ = *buf++;
-					*arrayPtr++ = temp3;
-					*arrayPtr++ = temp2;
-					*arrayPtr++ = temp1;
-					count--;
-				}
+			if (((uint16_t)start + count) <= _ColorsLength){ //make sure new array fits into local buffer.
+				beginWrite(_GET_COLOR);
+				amuletDecodeColors(_Colors + start, buf, count);  //copy array, swapping byte order
+				valuesChanged(_GET_COLOR, start, count);
 			}
 			else{
 				setError();//TODO Array overflow error
 			}
 			_GetColorsReply = true;
 			break;
+		  #endif
+		  #ifndef AMULET_NO_BYTES
 		  case _SET_BYTE:
 			_SetByteReply = true;
 			break;
+		  #endif
+		  #ifndef AMULET_NO_WORDS
 		  case _SET_WORD:
 		    _SetWordReply = true;
 			break;
+		  #endif
+		  #ifndef AMULET_NO_STRINGS
 		  case _SET_STRING:
 			_SetStringReply = true;
 			break;
+		  #endif
+		  #ifndef AMULET_NO_COLORS
 		  case _SET_COLOR:
 		    _SetColorReply = true;
 			break;
+		  #endif
+		  #if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_BYTES)
 		  case _SET_BYTE_ARRAY:
 		    _SetBytesReply = true;
 			break;
+		  #endif
+		  #if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_WORDS)
 		  case _SET_WORD_ARRAY:
 		    _SetWordsReply = true;
 			break;
+		  #endif
+		  #if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_COLORS)
 		  case _SET_COLOR_ARRAY:
 		    _SetColorsReply = true;
 			break;
+		  #endif
+          #ifndef AMULET_NO_GEMSCRIPT
           case _INVOKE_GEMSCRIPT:
             _InvokeGEMscriptReply = true;
             _scriptReply = ((long(buf[2]) << 24) | (long(buf[3]) << 16) | (long(buf[4]) << 8) | buf[5]);
             break;
+          #endif
 		}
 	}
     else{
-	  _TxBuffer[0] = _HOST_ADDRESS; //all slave commands start with Host ID, then Opcode
-	  _TxBuffer[1] =  buf[1]; //the reply opcode is the same as the initial command
+	  AMULET_STAMP(AMULET_STAMP_VERIFIED);
+	  reply[0] = _HOST_ADDRESS; //all slave commands start with Host ID, then Opcode
+	  reply[1] =  buf[1]; //the reply opcode is the same as the initial command
 	
 		switch(buf[1]){
+		  #ifndef AMULET_NO_BYTES
 		  case _GET_BYTE:
-			//_TxBuffer[0] = _HOST_ADDRESS;  //already set above, put here for clarity
-			//_TxBuffer[1] = _GET_BYTE;      //already set above, put here for clarity
+			//reply[0] = _HOST_ADDRESS;  //already set above, put here for clarity
+			//reply[1] = _GET_BYTE;      //already set above, put here for clarity
+			if (sendCachedReply(_GET_BYTE, start))
+				break;
             i=2;
             if (_ea){
-                _TxBuffer[i++] = buf[2];
-                _TxBuffer[i++] = buf[3];
+                reply[i++] = buf[2];
+                reply[i++] = buf[3];
             }
             else {
-                _TxBuffer[i++] = buf[2];
+                reply[i++] = buf[2];
             }
-            _TxBuffer[i++] = _Bytes[start];
-			returnCRC= calcCRC(_TxBuffer,i);
-			_TxBuffer[i++] = returnCRC & 0xFF;
-			_TxBuffer[i++] = (returnCRC >> 8) & 0xFF;
-			Serial.write(_TxBuffer,i);
+            reply[i++] = _Bytes[start];
+			returnCRC= calcCRC(reply,i);
+			reply[i++] = returnCRC & 0xFF;
+			reply[i++] = (returnCRC >> 8) & 0xFF;
+			writeReply(reply,i);
+			cacheReply(reply, i, start);
 			break;
+		  #endif
+		  #ifndef AMULET_NO_WORDS
 		  case _GET_WORD:
-			//_TxBuffer[0] = _HOST_ADDRESS;  //already set above, put here for clarity
-			//_TxBuffer[1] = _GET_WORD;      //already set above, put here for clarity
+			//reply[0] = _HOST_ADDRESS;  //already set above, put here for clarity
+			//reply[1] = _GET_WORD;      //already set above, put here for clarity
+			if (sendCachedReply(_GET_WORD, start))
+				break;
 			i=2;
             if (_ea){
-                _TxBuffer[i++] = buf[2];
-                _TxBuffer[i++] = buf[3];
+                reply[i++] = buf[2];
+                reply[i++] = buf[3];
                 
             }
             else {
-                _TxBuffer[i++] = buf[2];
+                reply[i++] = buf[2];
             }
-            _TxBuffer[i++] = (_Words[start] >> 8) & 0xFF;//MSB first for data
-			_TxBuffer[i++] = _Words[start] & 0xFF;
-			returnCRC= calcCRC(_TxBuffer,i);
-			_TxBuffer[i++] = returnCRC & 0xFF;             //LSB first for CRC
-			_TxBuffer[i++] = (returnCRC >> 8) & 0xFF;
-			Serial.write(_TxBuffer,i);
+            reply[i++] = (_Words[start] >> 8) & 0xFF;//MSB first for data
+			reply[i++] = _Words[start] & 0xFF;
+			returnCRC= calcCRC(reply,i);
+			reply[i++] = returnCRC & 0xFF;             //LSB first for CRC
+			reply[i++] = (returnCRC >> 8) & 0xFF;
+			writeReply(reply,i);
+			cacheReply(reply, i, start);
 			break;
 			
+		  #endif
+		  #ifndef AMULET_NO_STRINGS
 		  case _GET_STRING:
 		  /*  STRINGS commented out for now. Want to rework from multi- to single-dimentional array to match Amulet InternalRAM structure.
-			_TxBuffer[0] = _HOST_ADDRESS;
-			_TxBuffer[1] = _GET_STRING;
-			_TxBuffer[2] = buf[2];
+			reply[0] = _HOST_ADDRESS;
+			reply[1] = _GET_STRING;
+			reply[2] = buf[2];
 			_TxBufferLength = 3;
 			while(_Strings[buf[2]][i] != 0x00){               //append UTF-8 string
-			  _TxBuffer[_TxBufferLength++] = Strings[buf[2]][i];
+			  reply[_TxBufferLength++] = Strings[buf[2]][i];
 			  i++;
 			}
-			_TxBuffer[_TxBufferLength++] = 0x00; //append  NULL terminator
-			returnCRC= calcCRC(_TxBuffer,_TxBufferLength);
-			_TxBuffer[_TxBufferLength++] = returnCRC & 0xFF;
-			_TxBuffer[_TxBufferLength++] = (returnCRC >> 8) & 0xFF;
-			Serial.write(_TxBuffer,_TxBufferLength);
+			reply[_TxBufferLength++] = 0x00; //append  NULL terminator
+			returnCRC= calcCRC(reply,_TxBufferLength);
+			reply[_TxBufferLength++] = returnCRC & 0xFF;
+			reply[_TxBufferLength++] = (returnCRC >> 8) & 0xFF;
+			writeReply(reply,_TxBufferLength);
 			break;
 			*/
 			//Just reply with blank string for now
 			i=2;
             if (_ea){
-                _TxBuffer[i++] = buf[2];
-                _TxBuffer[i++] = buf[3];
+                reply[i++] = buf[2];
+                reply[i++] = buf[3];
                 
             }
             else {
-                _TxBuffer[i++] = buf[2];
+                reply[i++] = buf[2];
             }
-			_TxBuffer[i++] = 0;
-			returnCRC= calcCRC(_TxBuffer,i);
-			_TxBuffer[i++] = returnCRC & 0xFF;
-			_TxBuffer[i++] = (returnCRC >> 8) & 0xFF;
-			Serial.write(_TxBuffer,i);
+			reply[i++] = 0;
+			returnCRC= calcCRC(reply,i);
+			reply[i++] = returnCRC & 0xFF;
+			reply[i++] = (returnCRC >> 8) & 0xFF;
+			writeReply(reply,i);
 			break;
+		  #endif
+		  #ifndef AMULET_NO_COLORS
 		  case _GET_COLOR:
-			//_TxBuffer[0] = _HOST_ADDRESS;  //already set above, put here for clarity
-			//_TxBuffer[1] = _GET_COLOR;     //already set above, put here for clarity
+			//reply[0] = _HOST_ADDRESS;  //already set above, put here for clarity
+			//reply[1] = _GET_COLOR;     //already set above, put here for clarity
+			if (sendCachedReply(_GET_COLOR, start))
+				break;
 			i=2;
             if (_ea){
-                _TxBuffer[i++] = buf[2];
-                _TxBuffer[i++] = buf[3];
+                reply[i++] = buf[2];
+                reply[i++] = buf[3];
                 
             }
             else {
-                _TxBuffer[i++] = buf[2];
+                reply[i++] = buf[2];
             }
-            _TxBuffer[i++] = (_Colors[start] >> 24) & 0xFF;//MSB first for data
-            _TxBuffer[i++] = (_Colors[start] >> 16) & 0xFF;
-            _TxBuffer[i++] = (_Colors[start] >>  8) & 0xFF;
-			_TxBuffer[i++] =  _Colors[start]        & 0xFF;
-
-			returnCRC= calcCRC(_TxBuffer,i);
-			_TxBuffer[i++] = returnCRC & 0xFF;             //LSB first for CRC
-			_TxBuffer[i++] = (returnCRC >> 8) & 0xFF;
-			Serial.write(_TxBuffer,i);
-			
+            reply[i++] = (_Colors[start] >> 24) & 0xFF;//MSB first for data
+            reply[i++] = (_Colors[start] >> 16) & 0xFF;
+            reply[i++] = (_Colors[start] >>  8) & 0xFF;
+			reply[i++] =  _Colors[start]        & 0xFF;
+
+			returnCRC= calcCRC(reply,i);
+			reply[i++] = returnCRC & 0xFF;             //LSB first for CRC
+			reply[i++] = (returnCRC >> 8) & 0xFF;
+			writeReply(reply,i);
+			cacheReply(reply, i, start);
 			break;
+		  #endif
 		  case _GET_BYTE_ARRAY:
 			//TODO: Implement _GET_BYTE_ARRAY
 			break;
@@ -1205,57 +3111,595 @@ void AmuletLCD::processUARTCommand(uint8_t *buf, uint16_t bufLen){
 		  case _GET_COLOR_ARRAY:
 			//TODO: Implement _GET_COLOR_ARRAY
 			break;
+		  #ifndef AMULET_NO_BYTES
 		  case _SET_BYTE:
+			beginWrite(_GET_BYTE);
 			_Bytes[start] = buf[3+_ea];
+			valuesChanged(_GET_BYTE, start, 1);
 			SetCmd_Reply(_SET_BYTE);
 			break;
+		  #endif
+		  #ifndef AMULET_NO_WORDS
 		  case _SET_WORD:
+			beginWrite(_GET_WORD);
 			_Words[start] = word(buf[3+_ea],buf[4+_ea]);
+			valuesChanged(_GET_WORD, start, 1);
 			SetCmd_Reply(_SET_WORD);
 			break;
+		  #endif
+		  #ifndef AMULET_NO_STRINGS
 		  case _SET_STRING:
 			//TODO: need to actually write string to memory, see getString comments above
 			SetCmd_Reply(_SET_STRING);
 			break;
+		  #endif
+		  #ifndef AMULET_NO_COLORS
 		  case _SET_COLOR:
+			beginWrite(_GET_COLOR);
 			_Colors[start] = ((long(buf[3+_ea]) << 24) | (long(buf[4+_ea]) << 16) | (buf[5+_ea] << 8) | buf[6+_ea]);        
+			valuesChanged(_GET_COLOR, start, 1);
 			SetCmd_Reply(_SET_COLOR);
 			break;
+		  #endif
+		  #if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_BYTES)
 		  case _SET_BYTE_ARRAY:
-				  //TODO: need to actually write array to memory
+			if ((start + count) <= _BytesLength){
+				beginWrite(_GET_BYTE);
+				memcpy(_Bytes + start, buf+4+_ea, count);
+				valuesChanged(_GET_BYTE, start, count);
+			}
+			else{
+				setError();  //past the end of the local array, nothing is stored
+			}
 			SetCmd_Reply(_SET_BYTE_ARRAY);
 			break;
+		  #endif
+		  #if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_WORDS)
 		  case _SET_WORD_ARRAY:
-				  //TODO: need to actually write array to memory
+			if ((start + count) <= _WordsLength){
+				beginWrite(_GET_WORD);
+				amuletDecodeWords(_Words + start, buf+4+_ea, count);
+				valuesChanged(_GET_WORD, start, count);
+			}
+			else{
+				setError();  //past the end of the local array, nothing is stored
+			}
 			SetCmd_Reply(_SET_WORD_ARRAY);
 			break;
+		  #endif
+		  #if !defined(AMULET_NO_ARRAYS) && !defined(AMULET_NO_COLORS)
 		  case _SET_COLOR_ARRAY:
-				  //TODO: need to actually write array to memory
+			if ((start + count) <= _ColorsLength){
+				beginWrite(_GET_COLOR);
+				amuletDecodeColors(_Colors + start, buf+4+_ea, count);
+				valuesChanged(_GET_COLOR, start, count);
+			}
+			else{
+				setError();  //past the end of the local array, nothing is stored
+			}
 			SetCmd_Reply(_SET_COLOR_ARRAY);
 			break;
+		  #endif
+		  #ifndef AMULET_NO_RPC
 		  case _INVOKE_RPC:
 			SetCmd_Reply(_INVOKE_RPC);
 			callRPC(buf[2]);
 			break;
+		  #endif
 		}
 	  }
   }
+  else{
+	_crcErrors++;
+  }
   //else for Receive master command - CRC mismatch: do nothing. Amulet will resend after timeout
 }
 
 /**
 * Send reply to a Set command, which all have a similar structure
-* @param OPCODE uint8_t The type of message that was received
+* The reply is a constant frame taken from _AckFrames.
+* @param OPCODE uint8_t The type of message that was received, _SET_BYTE through _INVOKE_RPC
 */
 void AmuletLCD::SetCmd_Reply(uint8_t OPCODE){
   uint8_t buffer[4];
-  buffer[0] = _HOST_ADDRESS;
-  buffer[1] = OPCODE;
-  uint16_t returnCRC = calcCRC(buffer,2);
-  buffer[2] = returnCRC & 0xFF;
-  buffer[3] = (returnCRC >> 8) & 0xFF;
-  Serial.write(buffer,4);
+  memcpy_P(buffer, _AckFrames[OPCODE - _SET_BYTE], 4);
+  writeReply(buffer,4);
+}
+
+/**
+* Send a reply to a command from the display. Every reply goes through here, so this is where
+* the latency of the command is recorded, after the reply is on its way.
+* @param frame uint8_t* the reply, including CRC
+* @param length uint8_t the length of the reply
+*/
+void AmuletLCD::writeReply(uint8_t * frame, uint8_t length){
+	AMULET_STAMP(AMULET_STAMP_HANDLED);
+	writeFrame(frame, length, true);
+	AMULET_STAMP(AMULET_STAMP_QUEUED);
+	#ifdef AMULET_LATENCY
+	recordLatency(frame[1]);  //the reply opcode is the same as the command
+	#endif
+}
+
+/**
+* Send the cached reply to a Get Byte/Word/Color command, if there is one.
+* The local arrays can be written directly by the application, so the data bytes of the cached
+* frame are compared against the local array before it is sent. A stale entry counts as a miss.
+* @param opcode uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param loc uint16_t the index into the local array
+* @return uint8_t true if the reply was sent from the cache, false if it needs to be built
+*/
+uint8_t AmuletLCD::sendCachedReply(uint8_t opcode, uint16_t loc){
+	#ifdef AMULET_NO_REPLY_CACHE
+	return false;
+	#else
+	if (_ReplyCacheLength == 0)
+		return false;
+	AmuletReply * entry = &_ReplyCache[(loc + opcode) % _ReplyCacheLength];
+	if ((entry->opcode == opcode) && (entry->loc == loc)){
+		uint32_t value = 0;
+		uint8_t match = true;
+		uint8_t i = entry->length - 2;   //data ends right before the CRC
+		uint8_t first = 3 + _ea;         //data starts after host addr, opcode and address
+		#ifndef AMULET_NO_BYTES
+		if (opcode == _GET_BYTE)
+			value = _Bytes[loc];
+		#endif
+		#ifndef AMULET_NO_WORDS
+		if (opcode == _GET_WORD)
+			value = _Words[loc];
+		#endif
+		#ifndef AMULET_NO_COLORS
+		if (opcode == _GET_COLOR)
+			value = _Colors[loc];
+		#endif
+		while (match && (i > first)){    //data is MSB first, so compare from the end
+			match = (entry->frame[--i] == (uint8_t)(value & 0xFF));
+			value >>= 8;
+		}
+		if (match){
+			writeReply(entry->frame, entry->length);
+			_replyCacheHits++;
+			return true;
+		}
+	}
+	_replyCacheMisses++;
+	return false;
+	#endif
+}
+
+/**
+* Store a freshly built Get Byte/Word/Color reply in the reply cache, replacing whatever shared its slot.
+* @param buf uint8_t* the complete reply frame, including CRC
+* @param length uint8_t the length of the reply frame
+* @param loc uint16_t the index into the local array
+*/
+void AmuletLCD::cacheReply(uint8_t *buf, uint8_t length, uint16_t loc){
+	#ifndef AMULET_NO_REPLY_CACHE
+	if (_ReplyCacheLength == 0)
+		return;
+	AmuletReply * entry = &_ReplyCache[(loc + buf[1]) % _ReplyCacheLength];
+	memcpy(entry->frame, buf, length);
+	entry->length = length;
+	entry->loc = loc;
+	entry->opcode = buf[1];
+	#endif
+}
+
+/**
+* Start writing to the local array of a bank from the parser. Must be followed by valuesChanged.
+* The bank's sequence number is odd while the write is in progress, see snapshotWords.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+*/
+void AmuletLCD::beginWrite(uint8_t bank){
+	(*bankSeq(bank))++;
+	AMULET_BARRIER();
+}
+
+/**
+* Bookkeeping for local variables that were just written by a reply or a Set command from the display:
+* ends the write started by beginWrite, drops their cached replies and marks them as fresh for the fetch methods.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param start uint16_t the first index that changed
+* @param count uint16_t the number of indices that changed
+*/
+void AmuletLCD::valuesChanged(uint8_t bank, uint16_t start, uint16_t count){
+	AMULET_BARRIER();
+	(*bankSeq(bank))++;
+	invalidateReplies(bank, start, count);
+	#ifndef AMULET_NO_FETCH
+	uint32_t * stamps = bankStamps(bank);
+	if (stamps){
+		uint32_t now = clockMillis();
+		while (count--)
+			stamps[start++] = now;
+	}
+	#endif
+}
+
+/**
+* Utility function returning the sequence number of a bank.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @return volatile amulet_seq_t* the sequence number, incremented before and after every write by the parser
+*/
+volatile amulet_seq_t * AmuletLCD::bankSeq(uint8_t bank){
+	if (bank == _GET_BYTE)
+		return _ByteSeq;
+	if (bank == _GET_WORD)
+		return _WordSeq;
+	return _ColorSeq;
+}
+
+/**
+* Utility function to start a lock-free read of a bank. Waits out a write in progress on another thread.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @return amulet_seq_t the sequence number to pass to readRetry
+*/
+amulet_seq_t AmuletLCD::readBegin(uint8_t bank){
+	amulet_seq_t seq;
+	while ((seq = *bankSeq(bank)) & 1)
+		;
+	AMULET_BARRIER();
+	return seq;
+}
+
+/**
+* Utility function to finish a lock-free read of a bank.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param seq amulet_seq_t the value returned by readBegin
+* @return uint8_t true if the parser wrote to the bank during the read, which must then be repeated
+*/
+uint8_t AmuletLCD::readRetry(uint8_t bank, amulet_seq_t seq){
+	AMULET_BARRIER();
+	return *bankSeq(bank) != seq;
+}
+
+/**
+* Move the sequence numbers guarding the local arrays, e.g. into memory shared with other processes that
+* read the arrays the same way snapshotBytes does. Call it before any traffic, while the counters are even.
+* @param byteSeq volatile amulet_seq_t* the Byte array counter, or NULL for the one inside AmuletLCD
+* @param wordSeq volatile amulet_seq_t* the Word array counter, or NULL
+* @param colorSeq volatile amulet_seq_t* the Color array counter, or NULL
+*/
+void AmuletLCD::setSeqPointers(volatile amulet_seq_t * byteSeq, volatile amulet_seq_t * wordSeq, volatile amulet_seq_t * colorSeq){
+	_ByteSeq = byteSeq ? byteSeq : &_seqs[0];
+	_WordSeq = wordSeq ? wordSeq : &_seqs[1];
+	_ColorSeq = colorSeq ? colorSeq : &_seqs[2];
+}
+
+#ifndef AMULET_NO_BYTES
+/**
+* Copy a consistent snapshot of a range of the local Byte array.
+* The copy is repeated if the parser, running from an interrupt or another thread, writes to the array meanwhile.
+* Neither side disables interrupts or waits on a lock held by the other.
+* @param start uint16_t the first index into the local array
+* @param count uint16_t the number of variables to copy
+* @param dest uint8_t* where to copy them
+* @return uint8_t true if the range is valid, false otherwise
+*/
+uint8_t AmuletLCD::snapshotBytes(uint16_t start, uint16_t count, uint8_t * dest){
+	return snapshot(_GET_BYTE, start, count, dest);
+}
+#endif
+
+#ifndef AMULET_NO_WORDS
+/**
+* Copy a consistent snapshot of a range of the local Word array. See snapshotBytes.
+* @param start uint16_t the first index into the local array
+* @param count uint16_t the number of variables to copy
+* @param dest uint16_t* where to copy them
+* @return uint8_t true if the range is valid, false otherwise
+*/
+uint8_t AmuletLCD::snapshotWords(uint16_t start, uint16_t count, uint16_t * dest){
+	return snapshot(_GET_WORD, start, count, dest);
+}
+#endif
+
+#ifndef AMULET_NO_COLORS
+/**
+* Copy a consistent snapshot of a range of the local Color array. See snapshotBytes.
+* @param start uint16_t the first index into the local array
+* @param count uint16_t the number of variables to copy
+* @param dest uint32_t* where to copy them
+* @return uint8_t true if the range is valid, false otherwise
+*/
+uint8_t AmuletLCD::snapshotColors(uint16_t start, uint16_t count, uint32_t * dest){
+	return snapshot(_GET_COLOR, start, count, dest);
+}
+#endif
+
+/**
+* Utility function behind the snapshot methods.
+* @param bank uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR
+* @param start uint16_t the first index into the local array
+* @param count uint16_t the number of variables to copy
+* @param dest void* where to copy them
+* @return uint8_t true if the range is valid, false otherwise
+*/
+uint8_t AmuletLCD::snapshot(uint8_t bank, uint16_t start, uint16_t count, void * dest){
+	uint8_t width = bankWidth(bank);
+	uint8_t * src;
+	amulet_seq_t seq;
+	if ((uint32_t)start + count > bankLength(bank)){
+		setError();
+		return false;
+	}
+	src = bankData(bank) + start * width;
+	do {
+		seq = readBegin(bank);
+		memcpy(dest, src, count * width);
+	} while (readRetry(bank, seq));
+	return true;
+}
+
+/**
+* Drop cached replies whose value has been changed by a Set command or a reply from the display.
+* @param opcode uint8_t _GET_BYTE, _GET_WORD or _GET_COLOR, or 0 to match every bank
+* @param start uint16_t the first index that changed
+* @param count uint16_t the number of indices that changed
+*/
+void AmuletLCD::invalidateReplies(uint8_t opcode, uint16_t start, uint16_t count){
+	#ifndef AMULET_NO_REPLY_CACHE
+	for (uint8_t i = 0; i < _ReplyCacheLength; i++){
+		if (((opcode == 0) || (_ReplyCache[i].opcode == opcode)) &&
+		    (_ReplyCache[i].loc >= start) && (_ReplyCache[i].loc - start < count))
+			_ReplyCache[i].opcode = 0;
+	}
+	#endif
+}
+
+#ifndef AMULET_NO_REPLY_CACHE
+/**
+* The number of Get Byte/Word/Color commands from the display answered from the reply cache.
+* The hit rate is replyCacheHits() / (replyCacheHits() + replyCacheMisses()).
+* @return uint32_t the hit count since startup
+*/
+uint32_t AmuletLCD::replyCacheHits(){
+	return _replyCacheHits;
+}
+
+/**
+* The number of Get Byte/Word/Color commands from the display that had to build a new reply.
+* @return uint32_t the miss count since startup
+*/
+uint32_t AmuletLCD::replyCacheMisses(){
+	return _replyCacheMisses;
+}
+#endif
+
+#ifdef AMULET_LATENCY
+/**
+* Set up memory for timing commands from the display, one entry per opcode.
+* Each reply sent updates min/avg/max and a log2 histogram of every stage, see AMULET_STAGE_WAIT.
+* Opcodes get an entry the first time they are answered, later opcodes are not recorded once all are taken.
+* @param ptr AmuletLatency * The array used to store the statistics
+* @param ptrSize uint8_t The number of entries in the array. 0 disables the statistics.
+*/
+void AmuletLCD::setLatencyPointer(AmuletLatency * ptr, uint8_t ptrSize){
+	_Latency = ptr;
+	_LatencyLength = ptrSize;
+	resetLatency();
+}
+
+/**
+* Set a function called with the raw timestamps of every command from the display that was answered.
+* It runs from serialEvent right after the reply is written, so keep it short.
+* @param hook latencyHook called with the opcode and AMULET_STAMPS micros() values, NULL for none
+*/
+void AmuletLCD::setLatencyHook(latencyHook hook){
+	_latencyHook = hook;
+}
+
+/**
+* Summary of one stage for one opcode.
+* The 99th percentile is the upper end of the histogram bucket it falls in, so it is within a factor of 2.
+* @param opcode uint8_t the command from the display, e.g. _GET_WORD
+* @param stage uint8_t AMULET_STAGE_WAIT through AMULET_STAGE_TURNAROUND
+* @return uint8_t true if the opcode has been timed, false otherwise. The outputs are only set on true.
+*/
+uint8_t AmuletLCD::latencyStats(uint8_t opcode, uint8_t stage, uint32_t * minUs, uint32_t * avgUs, uint32_t * maxUs, uint32_t * p99Us){
+	if (stage >= AMULET_STAGES)
+		return false;
+	for (uint8_t k = 0; k < _LatencyLength; k++){
+		AmuletLatency * entry = &_Latency[k];
+		if ((entry->opcode != opcode) || (entry->count == 0))
+			continue;
+		uint32_t total = 0, seen = 0, rank;
+		uint8_t b;
+		for (b = 0; b < AMULET_LATENCY_BUCKETS; b++)
+			total += entry->stage[stage].hist[b];
+		rank = total - total / 100;  //99% of the samples are at or below this one
+		for (b = 0; b < AMULET_LATENCY_BUCKETS - 1; b++){
+			seen += entry->stage[stage].hist[b];
+			if (seen >= rank)
+				break;
+		}
+		*minUs = entry->stage[stage].min;
+		*maxUs = entry->stage[stage].max;
+		*avgUs = entry->stage[stage].sum / entry->count;
+		*p99Us = (b == AMULET_LATENCY_BUCKETS - 1) ? *maxUs : (1UL << b) - 1;
+		if (*p99Us > *maxUs)
+			*p99Us = *maxUs;
+		if (*p99Us < *minUs)
+			*p99Us = *minUs;
+		return true;
+	}
+	return false;
+}
+
+/**
+* Clear the statistics of every opcode.
+*/
+void AmuletLCD::resetLatency(){
+	if (_LatencyLength)
+		memset(_Latency, 0, _LatencyLength * sizeof(AmuletLatency));
+}
+
+/**
+* Utility function adding the stamps of the reply just sent to the statistics of its opcode.
+* @param opcode uint8_t the command from the display
+*/
+void AmuletLCD::recordLatency(uint8_t opcode){
+	AmuletLatency * entry = NULL;
+	uint32_t us[AMULET_STAGES];
+	us[AMULET_STAGE_WAIT]       = _stamps[AMULET_STAMP_COMPLETE] - _stamps[AMULET_STAMP_IDLE];
+	us[AMULET_STAGE_RECEIVE]    = _stamps[AMULET_STAMP_COMPLETE] - _stamps[AMULET_STAMP_START];
+	us[AMULET_STAGE_CRC]        = _stamps[AMULET_STAMP_VERIFIED] - _stamps[AMULET_STAMP_COMPLETE];
+	us[AMULET_STAGE_HANDLER]    = _stamps[AMULET_STAMP_HANDLED] - _stamps[AMULET_STAMP_VERIFIED];
+	us[AMULET_STAGE_REPLY]      = _stamps[AMULET_STAMP_QUEUED] - _stamps[AMULET_STAMP_HANDLED];
+	us[AMULET_STAGE_TURNAROUND] = _stamps[AMULET_STAMP_QUEUED] - _stamps[AMULET_STAMP_IDLE];
+	for (uint8_t k = 0; k < _LatencyLength; k++){
+		if (_Latency[k].opcode == opcode){
+			entry = &_Latency[k];
+			break;
+		}
+		if ((entry == NULL) && (_Latency[k].opcode == 0))
+			entry = &_Latency[k];  //first free entry, used if the opcode has none yet
+	}
+	if (entry){
+		entry->opcode = opcode;
+		entry->count++;
+		for (uint8_t i = 0; i < AMULET_STAGES; i++){
+			uint32_t v = us[i];
+			uint8_t b = 0;
+			if ((entry->count == 1) || (v < entry->stage[i].min))
+				entry->stage[i].min = v;
+			if (v > entry->stage[i].max)
+				entry->stage[i].max = v;
+			entry->stage[i].sum += v;
+			while (v && (b < AMULET_LATENCY_BUCKETS - 1)){
+				v >>= 1;
+				b++;
+			}
+			if (entry->stage[i].hist[b] == 0xFFFF){
+				for (uint8_t h = 0; h < AMULET_LATENCY_BUCKETS; h++)
+					entry->stage[i].hist[h] >>= 1;
+			}
+			entry->stage[i].hist[b]++;
+		}
+	}
+	if (_latencyHook)
+		_latencyHook(opcode, _stamps);
 }
+#endif
+
+#if !defined(AMULET_NO_LINKTEST) && !defined(AMULET_NO_WORDS)
+/**
+* Measure the link to the display at the current baud rate, for commissioning.
+* Runs rounds Set Word + Get Word round trips on variable start, then Set + Get Word Array transfers of
+* 1, 2, 4... words from start, up to what fits the buffers and the local Word array, then rounds
+* callScript pings if pingScript is given. Every value is read back and compared.
+* Word variables from start on are overwritten, both local and on the display, so use spare ones.
+* Blocks until done, a few seconds for 50 rounds at 115200 baud.
+* @param result AmuletLinkTest* filled in with the measurements
+* @param start uint16_t the first Word variable the test may use
+* @param rounds uint8_t round trips per phase, e.g. 50
+* @param pingScript const char* name of a GEMscript function on the current page, NULL for none
+* @return uint8_t true if every command was answered and every value came back, false otherwise
+*/
+uint8_t AmuletLCD::linkTest(AmuletLinkTest * result, uint16_t start, uint8_t rounds, const char * pingScript){
+	uint32_t retries = _retryCount;
+	uint32_t crcErrors = _crcErrors;
+	uint32_t frames = _rxFrames;
+	uint32_t sum = 0, t;
+	uint16_t value;
+	uint8_t i, k;
+	memset(result, 0, sizeof(AmuletLinkTest));
+	result->baud = _baud;
+	result->rounds = rounds;
+	if ((start >= _WordsLength) || (rounds == 0)){
+		setError();
+		return false;
+	}
+
+	//single variable round trips
+	result->rttMin = 0xFFFFFFFF;
+	for (i = 0; i < rounds; i++){
+		value = 0xA55A ^ (i * 0x0101);
+		t = clockMicros();
+		if (!setWord(start, value, true))
+			result->failures++;
+		t = clockMicros() - t;
+		sum += t;
+		if (t < result->rttMin)
+			result->rttMin = t;
+		if (t > result->rttMax)
+			result->rttMax = t;
+		t = clockMicros();
+		if (!requestWord(start))
+			result->failures++;
+		else if (getWord(start) != value)
+			result->mismatches++;
+		t = clockMicros() - t;
+		sum += t;
+		if (t < result->rttMin)
+			result->rttMin = t;
+		if (t > result->rttMax)
+			result->rttMax = t;
+	}
+	result->rttAvg = sum / (2 * rounds);
+
+	#ifndef AMULET_NO_ARRAYS
+	//arrays of increasing size, the throughput of the largest one that works
+	uint16_t most = maxArrayCount(_GET_WORD);
+	if (most > _WordsLength - start)
+		most = _WordsLength - start;
+	if (most > (_TxBufferSize - 7) / 2)
+		most = (_TxBufferSize - 7) / 2;
+	for (uint16_t count = 1; count <= most; count = (count < most && count * 2 > most) ? most : count * 2){
+		uint8_t intact = true;  //1, 2, 4... and most last
+		t = clockMicros();
+		for (i = 0; intact && (i < rounds); i++){
+			beginWrite(_GET_WORD);
+			for (k = 0; k < count; k++)
+				_Words[start + k] = (i << 8) + k + count;
+			valuesChanged(_GET_WORD, start, count);
+			intact = setWords(start, count, true);
+			beginWrite(_GET_WORD);
+			for (k = 0; k < count; k++)
+				_Words[start + k] = 0;   //so the values checked below come from the display
+			valuesChanged(_GET_WORD, start, count);
+			intact = intact && requestWords(start, count);
+			for (k = 0; intact && (k < count); k++)
+				intact = (_Words[start + k] == (uint16_t)((i << 8) + k + count));
+		}
+		t = clockMicros() - t;
+		if (!intact){
+			result->failures++;
+			break;
+		}
+		if (t == 0)
+			t = 1;
+		result->arrayCount = count;
+		result->framesPerSec = 2UL * rounds * 1000000UL / t;  //at most 510 frames, so no overflow
+		result->bytesPerSec = result->framesPerSec * count * 2;
+	}
+	#endif
+
+	#ifndef AMULET_NO_GEMSCRIPT
+	if (pingScript){
+		sum = 0;
+		for (i = 0; i < rounds; i++){
+			t = clockMicros();
+			if (callScript(pingScript, true) != true)
+				result->failures++;
+			t = clockMicros() - t;
+			sum += t;
+			if (t > result->scriptMax)
+				result->scriptMax = t;
+		}
+		result->scriptAvg = sum / rounds;
+	}
+	#endif
+
+	result->retries = _retryCount - retries;
+	result->crcErrors = _crcErrors - crcErrors;
+	result->frames = _rxFrames - frames;
+	if (result->frames)
+		result->crcErrorRate = (uint32_t)result->crcErrors * 10000 / result->frames;
+	return (result->failures == 0) && (result->mismatches == 0);
+}
+#endif
 
 /**
 * Read the current error status, then reset the status.
@@ -1267,6 +3711,30 @@ uint32_t AmuletLCD::readError(){
 	return ec;
 }
 
+/**
+* The number of blocking commands sent again because no valid reply came in time.
+* @return uint32_t the retry count since startup
+*/
+uint32_t AmuletLCD::retryCount(){
+	return _retryCount;
+}
+
+/**
+* The number of frames from the display that failed the CRC check. Replies are retried, commands are resent by the display.
+* @return uint32_t the CRC error count since startup
+*/
+uint32_t AmuletLCD::crcErrorCount(){
+	return _crcErrors;
+}
+
+/**
+* The number of complete frames received from the display, commands and replies, good or bad.
+* @return uint32_t the frame count since startup
+*/
+uint32_t AmuletLCD::framesReceived(){
+	return _rxFrames;
+}
+
 /**
 * Set the current error status.
 */
@@ -23,10 +23,11 @@
 #define AmuletLCD_h
 
 #include "Arduino.h"
+#include "AmuletConfig.h"
 
 // Define the buffer lengths here, if the user hasn't set their own.
 // This is long enough for most messages. 
-// Change to send/receive long arrays.
+// Change to send/receive long arrays, or pass buffers of the right size to begin.
 // Max is 0x400 bytes.
 #ifndef AMULET_TX_BUF_LEN
 #define AMULET_TX_BUF_LEN    64
@@ -39,6 +40,40 @@
 #define MAX_STRING_LENGTH    25
 #endif
 
+// Smallest buffers begin accepts, so every fixed length frame fits with a 2 byte address.
+// Receive: host addr + opcode + 16bit address + 32bit color + 2-byte CRC = 10
+// Transmit: the longest frame built in the transmit buffer. A GEMscript call is 37, a Set String
+// is slave addr + opcode + 16bit address + string + null + 2-byte CRC, a Set Color Array of one is 11.
+// Shorter master frames are built on the stack, and replies to the display never use it.
+#define AMULET_MIN_RX_LEN    10
+#ifndef AMULET_NO_GEMSCRIPT
+#define AMULET_SCRIPT_FRAME_LEN  37
+#else
+#define AMULET_SCRIPT_FRAME_LEN  0
+#endif
+#ifndef AMULET_NO_STRINGS
+#define AMULET_STRING_FRAME_LEN  (MAX_STRING_LENGTH + 7)
+#else
+#define AMULET_STRING_FRAME_LEN  0
+#endif
+#ifndef AMULET_NO_ARRAYS
+#define AMULET_ARRAY_FRAME_LEN   11
+#else
+#define AMULET_ARRAY_FRAME_LEN   0
+#endif
+#define AMULET_MIN_TX_LEN    (AMULET_SCRIPT_FRAME_LEN > AMULET_STRING_FRAME_LEN ? \
+                             (AMULET_SCRIPT_FRAME_LEN > AMULET_ARRAY_FRAME_LEN ? AMULET_SCRIPT_FRAME_LEN : AMULET_ARRAY_FRAME_LEN) : \
+                             (AMULET_STRING_FRAME_LEN > AMULET_ARRAY_FRAME_LEN ? AMULET_STRING_FRAME_LEN : AMULET_ARRAY_FRAME_LEN))
+
+// Length of a Byte/Word/Color array frame of count variables of width bytes, with a 2 byte address.
+// Size receive buffers with the largest reply expected, transmit buffers with the largest array sent.
+#define AMULET_ARRAY_LEN(count, width)  (7 + (count) * (width))
+
+#ifndef AMULET_NO_BUILTIN_BUFFERS
+static_assert(AMULET_RX_BUF_LEN >= AMULET_MIN_RX_LEN, "AMULET_RX_BUF_LEN is shorter than AMULET_MIN_RX_LEN");
+static_assert(AMULET_TX_BUF_LEN >= AMULET_MIN_TX_LEN, "AMULET_TX_BUF_LEN is shorter than AMULET_MIN_TX_LEN");
+#endif
+
 // Invalid script reply value reset upon invoking callScript. 
 // Useful to allow non-blocking function of callScript to determine if reply has been received yet.
 // Define your own value if you want to use this for a valid value.
@@ -46,6 +81,29 @@
 #define INVALID_SCRIPT_REPLY 0x80000000
 #endif
 
+// Largest array request fetchByte/fetchWord/fetchColor grow to when stale neighbours are refreshed together.
+#ifndef AMULET_FETCH_SPAN
+#define AMULET_FETCH_SPAN    8
+#endif
+
+// Frame length reserved by AmuletCommand. The longest frame that can be prepared is a GEMscript call:
+// slave addr + opcode + 32 character name + null + 2-byte CRC = 37
+#ifndef AMULET_PREPARED_LEN
+#define AMULET_PREPARED_LEN  37
+#endif
+
+/**
+* Sequence numbers guarding the local arrays against torn reads, see snapshotWords.
+* They must be read in a single access, so they are only 8 bits wide on AVR.
+*/
+#if defined(__AVR__)
+typedef uint8_t amulet_seq_t;
+#define AMULET_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+typedef uint32_t amulet_seq_t;
+#define AMULET_BARRIER() __sync_synchronize()
+#endif
+
 /**
 * typedef used by RPC_Entry.
 */
@@ -57,106 +115,616 @@ typedef struct {
 	functionPointer function;
 } RPC_Entry;
 
+/**
+* struct used to hold a command frame that is built and CRC'd once by one of the prepare methods,
+* then sent as many times as needed by sendPrepared, or sendPreparedValue for Set frames.
+*/
+typedef struct {
+	uint8_t  frame[AMULET_PREPARED_LEN];
+	uint8_t  length;    //total frame length, including CRC
+	uint8_t  payload;   //offset of the first variable payload byte. Equals length-2 if there is no payload.
+	uint16_t prefixCRC; //CRC of the fixed bytes in front of the payload
+} AmuletCommand;
+
+/**
+* struct used by the reply cache to hold a prebuilt Get Byte/Word/Color reply, including CRC.
+*/
+typedef struct {
+	uint8_t  opcode;    //_GET_BYTE, _GET_WORD or _GET_COLOR. 0 if the entry is empty.
+	uint8_t  length;
+	uint16_t loc;
+	uint8_t  frame[11]; //host addr + opcode + 16bit address + 32bit color + 2-byte CRC
+} AmuletReply;
+
+/**
+* struct used by the polling scheduler, one entry per subscribed range of Amulet variables.
+*/
+typedef struct {
+	uint8_t  bank;      //_GET_BYTE, _GET_WORD or _GET_COLOR. 0 if the entry is unused.
+	uint8_t  count;
+	uint16_t start;
+	uint16_t period;    //requested refresh period in ms
+	uint16_t interval;  //achieved refresh period in ms, smoothed. 0 until refreshed twice.
+	uint32_t due;       //millis() when the next refresh is due
+	uint32_t last;      //millis() of the last refresh
+	uint8_t  merged;    //set while the entry is part of the frame being built
+} AmuletPoll;
+
+#ifdef AMULET_LATENCY
+// Timestamps taken while a command from the display is handled, in micros(). See setLatencyHook.
+#define AMULET_STAMP_IDLE        0  //serialEvent last found nothing to read. The last byte arrived after this.
+#define AMULET_STAMP_START       1  //address byte parsed
+#define AMULET_STAMP_COMPLETE    2  //last CRC byte parsed
+#define AMULET_STAMP_VERIFIED    3  //CRC checked
+#define AMULET_STAMP_HANDLED     4  //local array updated and reply built
+#define AMULET_STAMP_QUEUED      5  //reply written to Serial
+#define AMULET_STAMPS            6
+
+// Stages aggregated by setLatencyPointer, the time between two stamps
+#define AMULET_STAGE_WAIT        0  //IDLE to COMPLETE, the most the last byte waited for serialEvent
+#define AMULET_STAGE_RECEIVE     1  //START to COMPLETE
+#define AMULET_STAGE_CRC         2  //COMPLETE to VERIFIED
+#define AMULET_STAGE_HANDLER     3  //VERIFIED to HANDLED
+#define AMULET_STAGE_REPLY       4  //HANDLED to QUEUED
+#define AMULET_STAGE_TURNAROUND  5  //IDLE to QUEUED, the most the display waited on us after its last byte
+#define AMULET_STAGES            6
+
+// Histogram bucket k > 0 counts times from 2^(k-1) to 2^k - 1 us, the last bucket everything longer.
+#ifndef AMULET_LATENCY_BUCKETS
+#define AMULET_LATENCY_BUCKETS   16
+#endif
+
+/**
+* typedef used by setLatencyHook. stamps holds AMULET_STAMPS micros() values.
+*/
+typedef void (* latencyHook) (uint8_t opcode, const uint32_t * stamps);
+
+/**
+* struct used by setLatencyPointer, one per opcode from the display.
+*/
+typedef struct {
+	uint8_t  opcode;    //0 if the entry is unused
+	uint32_t count;     //replies timed
+	struct {
+		uint32_t min;
+		uint32_t max;
+		uint32_t sum;   //for the average, wraps after about 71 minutes of total stage time
+		uint16_t hist[AMULET_LATENCY_BUCKETS];  //halved when a bucket is full, which keeps the percentiles
+	} stage[AMULET_STAGES];
+} AmuletLatency;
+#endif
+
+#if !defined(AMULET_NO_LINKTEST) && !defined(AMULET_NO_WORDS)
+/**
+* struct filled in by linkTest. Times are in microseconds.
+*/
+typedef struct {
+	uint32_t baud;          //rate the test ran at
+	uint8_t  rounds;        //round trips per phase
+	uint32_t rttMin;        //single Set Word and Get Word commands, each timed on its own
+	uint32_t rttAvg;
+	uint32_t rttMax;
+	uint8_t  arrayCount;    //largest Set/Get Word Array that came back intact, 0 if none did
+	uint32_t framesPerSec;  //commands acknowledged per second at arrayCount
+	uint32_t bytesPerSec;   //payload bytes per second at arrayCount, both directions together
+	uint32_t scriptAvg;     //callScript pings, 0 if no script was given
+	uint32_t scriptMax;
+	uint32_t frames;        //frames received from the display during the test
+	uint16_t retries;       //commands sent again after a timeout
+	uint16_t crcErrors;     //frames received with a bad CRC
+	uint16_t crcErrorRate;  //crcErrors per 10000 frames received
+	uint16_t mismatches;    //values read back that differ from what was set
+	uint16_t failures;      //commands that ran out of retries
+} AmuletLinkTest;
+#endif
+
+// Bytes poll parses between checks of its time budget
+#ifndef AMULET_POLL_CHECK
+#define AMULET_POLL_CHECK    8
+#endif
+
+#ifndef AMULET_NO_AUTOBAUD
+// Blocking commands per fallback check, and verification round trips per baud rate tried, see negotiateBaud.
+#ifndef AMULET_BAUD_WINDOW
+#define AMULET_BAUD_WINDOW   64
+#endif
+#ifndef AMULET_BAUD_PROBES
+#define AMULET_BAUD_PROBES   4
+#endif
+// Time the display gets to change its UART after acknowledging the switch
+#ifndef AMULET_BAUD_SETTLE_MS
+#define AMULET_BAUD_SETTLE_MS  20
+#endif
+// The display should go back to its previous rate if no valid command arrives this long after a switch
+#ifndef AMULET_BAUD_REVERT_MS
+#define AMULET_BAUD_REVERT_MS  1000
+#endif
+
+/**
+* typedef used by negotiateBaud. Tells the display to change to baud, e.g. by setting an InternalRAM
+* variable and calling a GEMscript that reprograms its UART. Returns true if the display acknowledged.
+*/
+typedef uint8_t (* baudCallback) (uint32_t baud);
+#endif
+
+#ifndef AMULET_NO_IDLE
+/**
+* typedef used by setIdleHook. Called over and over while a blocking command waits for its reply.
+*/
+typedef void (* idleHook) ();
+#endif
+
+#ifndef AMULET_NO_CLOCK
+/**
+* typedef used by setClock. A millis() or micros() style time source.
+*/
+typedef unsigned long (* clockSource) ();
+#endif
+
+#ifndef AMULET_NO_IMAGE
+// Marks a valid image, see saveImage. Changes whenever the layout does.
+#define AMULET_IMAGE_MAGIC     0x4131
+// Bytes copied through the stack at a time while saving or checking an image, a multiple of 4
+#ifndef AMULET_IMAGE_CHUNK
+#define AMULET_IMAGE_CHUNK     32
+#endif
+// Where amuletEepromRead and amuletEepromWrite keep the image
+#ifndef AMULET_IMAGE_EEPROM_ADDR
+#define AMULET_IMAGE_EEPROM_ADDR 0
+#endif
+
+/**
+* typedefs used by saveImage and restoreImage. Read or write length bytes at offset into the image
+* storage, e.g. EEPROM, flash or a file. Return true on success.
+*/
+typedef uint8_t (* imageRead) (uint32_t offset, uint8_t * data, uint16_t length);
+typedef uint8_t (* imageWrite) (uint32_t offset, const uint8_t * data, uint16_t length);
+
+/**
+* struct at the start of an image, followed by the Byte, Word and Color arrays in local byte order.
+*/
+typedef struct {
+	uint16_t magic;       // AMULET_IMAGE_MAGIC, also rejects images written with the other byte order
+	uint16_t byteCount;   // length of each local array when the image was saved
+	uint16_t wordCount;
+	uint16_t colorCount;
+	uint16_t crc;         // MODBUS CRC of the arrays
+} AmuletImageHeader;
+
+#if defined(__AVR__)
+uint8_t amuletEepromRead(uint32_t offset, uint8_t * data, uint16_t length);
+uint8_t amuletEepromWrite(uint32_t offset, const uint8_t * data, uint16_t length);
+#endif
+#endif
+
+#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+// How often checkLink tries a link that is down, unless setLinkMonitor gave a heartbeat
+#ifndef AMULET_LINK_PROBE_MS
+#define AMULET_LINK_PROBE_MS   1000
+#endif
+
+/**
+* typedef used by setLinkMonitor. Called with false when the link goes down, and with true once it is
+* back and the local arrays are on the display again. Must not wait for replies from the display.
+*/
+typedef void (* linkHook) (uint8_t up);
+#endif
+
+template <class Link, class Bank, uint16_t Index> class AmuletVar;
+
 /**
 * A class used to manage the UART state machine between the Amulet display and Arduino.
 */
 class AmuletLCD
 {
+  template <class Link, class Bank, uint16_t Index> friend class AmuletVar;
   public:
     AmuletLCD();  
+#ifndef AMULET_NO_BUILTIN_BUFFERS
     void begin(uint32_t baud);
 	void begin(uint32_t baud, uint8_t config, uint8_t extended_address);
+#endif
+	uint8_t begin(uint32_t baud, uint8_t config, uint8_t extended_address, uint8_t * rxBuffer, uint16_t rxLength, uint8_t * txBuffer, uint16_t txLength);
+#ifndef AMULET_NO_WORDS
     void setWordPointer(uint16_t * ptr, uint16_t ptrSize);
+#endif
+#ifndef AMULET_NO_BYTES
     void setBytePointer(uint8_t * ptr, uint16_t ptrSize);
+#endif
+#ifndef AMULET_NO_COLORS
     void setColorPointer(uint32_t * ptr, uint16_t ptrSize);
+#endif
+#ifndef AMULET_NO_RPC
 	void setRPCPointer(RPC_Entry * ptr, uint16_t ptrSize);
+#endif
+#ifndef AMULET_NO_REPLY_CACHE
+	void setReplyCachePointer(AmuletReply * ptr, uint8_t ptrSize);
+#endif
+#ifndef AMULET_NO_POLLING
+	void setPollPointer(AmuletPoll * ptr, uint8_t ptrSize);
+#endif
+#ifndef AMULET_NO_FETCH
+	void setStampPointers(uint32_t * byteStamps, uint32_t * wordStamps, uint32_t * colorStamps);
+#endif
+#ifndef AMULET_NO_RPC
 	void registerRPC(uint8_t index, functionPointer function);
+#endif
 
+#ifndef AMULET_NO_BYTES
     uint8_t getByte(uint16_t loc);
 	uint8_t requestByte(uint16_t loc);
-	uint8_t requestBytes(uint16_t start, uint8_t count);
     int8_t setByte(uint16_t loc, uint8_t value);
 	int8_t setByte(uint16_t loc, uint8_t value, uint8_t waitForResponse);
+#ifndef AMULET_NO_ARRAYS
+	uint8_t requestBytes(uint16_t start, uint8_t count);
+	int8_t setBytes(uint16_t start, uint8_t count, uint8_t waitForResponse);
+#endif
+#endif
 
+#ifndef AMULET_NO_WORDS
     uint16_t getWord(uint16_t loc);
 	uint8_t requestWord(uint16_t loc);
-	uint8_t requestWords(uint16_t start, uint8_t count);
     int8_t setWord(uint16_t loc, uint16_t value);
 	int8_t setWord(uint16_t loc, uint16_t value, uint8_t waitForResponse);
+#ifndef AMULET_NO_ARRAYS
+	uint8_t requestWords(uint16_t start, uint8_t count);
+	int8_t setWords(uint16_t start, uint8_t count, uint8_t waitForResponse);
+#endif
+#endif
 
+#ifndef AMULET_NO_COLORS
     uint32_t getColor(uint16_t loc);
 	uint8_t requestColor(uint16_t loc);
-	uint8_t requestColors(uint16_t start, uint8_t count);
     int8_t setColor(uint16_t loc, uint32_t value);
 	int8_t setColor(uint16_t loc, uint32_t value, uint8_t waitForResponse);
+#ifndef AMULET_NO_ARRAYS
+	uint8_t requestColors(uint16_t start, uint8_t count);
+	int8_t setColors(uint16_t start, uint8_t count, uint8_t waitForResponse);
+#endif
+#endif
 	
+#ifndef AMULET_NO_STRINGS
 	int8_t setString(uint16_t loc, const char * str);
     int8_t setString(uint16_t loc, const char * str, uint8_t waitForResponse);
 	uint8_t requestString(uint16_t start, uint8_t * destination_buffer, uint16_t buffer_length);
+#endif
 	
+#ifndef AMULET_NO_GEMSCRIPT
     int8_t callScript(const char * fname, uint8_t waitForResponse);
     int8_t callScript(const char * fname);
     int32_t scriptReply();
+#endif
+
+#ifndef AMULET_NO_BYTES
+	uint8_t prepareSetByte(AmuletCommand * cmd, uint16_t loc);
+	uint8_t prepareRequestByte(AmuletCommand * cmd, uint16_t loc);
+#ifndef AMULET_NO_ARRAYS
+	uint8_t prepareRequestBytes(AmuletCommand * cmd, uint16_t start, uint8_t count);
+#endif
+#endif
+#ifndef AMULET_NO_WORDS
+	uint8_t prepareSetWord(AmuletCommand * cmd, uint16_t loc);
+	uint8_t prepareRequestWord(AmuletCommand * cmd, uint16_t loc);
+#ifndef AMULET_NO_ARRAYS
+	uint8_t prepareRequestWords(AmuletCommand * cmd, uint16_t start, uint8_t count);
+#endif
+#endif
+#ifndef AMULET_NO_COLORS
+	uint8_t prepareSetColor(AmuletCommand * cmd, uint16_t loc);
+	uint8_t prepareRequestColor(AmuletCommand * cmd, uint16_t loc);
+#ifndef AMULET_NO_ARRAYS
+	uint8_t prepareRequestColors(AmuletCommand * cmd, uint16_t start, uint8_t count);
+#endif
+#endif
+#ifndef AMULET_NO_GEMSCRIPT
+	uint8_t prepareScript(AmuletCommand * cmd, const char * fname);
+#endif
+	int8_t sendPrepared(AmuletCommand * cmd, uint8_t waitForResponse);
+	int8_t sendPreparedValue(AmuletCommand * cmd, uint32_t value, uint8_t waitForResponse);
+
+#ifndef AMULET_NO_FETCH
+#ifndef AMULET_NO_BYTES
+	uint8_t fetchByte(uint16_t loc, uint16_t maxAgeMs);
+#endif
+#ifndef AMULET_NO_WORDS
+	uint16_t fetchWord(uint16_t loc, uint16_t maxAgeMs);
+#endif
+#ifndef AMULET_NO_COLORS
+	uint32_t fetchColor(uint16_t loc, uint16_t maxAgeMs);
+#endif
+	uint8_t fetchRange(uint8_t bank, uint16_t start, uint16_t count, uint16_t maxAgeMs);
+#endif
+
+#ifndef AMULET_NO_BYTES
+	uint8_t snapshotBytes(uint16_t start, uint16_t count, uint8_t * dest);
+#endif
+#ifndef AMULET_NO_WORDS
+	uint8_t snapshotWords(uint16_t start, uint16_t count, uint16_t * dest);
+#endif
+#ifndef AMULET_NO_COLORS
+	uint8_t snapshotColors(uint16_t start, uint16_t count, uint32_t * dest);
+#endif
+	void setSeqPointers(volatile amulet_seq_t * byteSeq, volatile amulet_seq_t * wordSeq, volatile amulet_seq_t * colorSeq);
+
+#ifndef AMULET_NO_POLLING
+	int8_t subscribe(uint8_t bank, uint16_t start, uint8_t count, uint16_t period_ms);
+	void unsubscribe(uint8_t index);
+	void setPollBudget(uint8_t percent);
+	uint8_t pollUpdate();
+	uint16_t pollInterval(uint8_t index);
+#endif
+	
+#ifndef AMULET_NO_AUTOBAUD
+	uint32_t negotiateBaud(const uint32_t * rates, uint8_t rateCount, baudCallback change);
+	void setBaudFallback(uint8_t percent);
+	uint32_t linkBaud();
+#endif
+
+#ifndef AMULET_NO_IMAGE
+	uint8_t pushRange(uint8_t bank, uint16_t start, uint16_t count);
+	uint8_t pullRange(uint8_t bank, uint16_t start, uint16_t count);
+	uint8_t saveImage(imageWrite write);
+	uint8_t restoreImage(imageRead read);
+#endif
+
+#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+	void setLinkMonitor(uint8_t failures, uint16_t heartbeatMs, linkHook hook);
+	uint8_t checkLink();
+	uint8_t linkUp();
+#endif
+
+#ifndef AMULET_NO_IDLE
+	void setIdleHook(idleHook hook);
+	void setIdleSleep(uint8_t enable);
+#endif
+
+#ifndef AMULET_NO_CLOCK
+	void setClock(clockSource millisSource, clockSource microsSource);
+#endif
+
+#ifndef AMULET_NO_TX_BATCH
+	void setTxBatchPointer(uint8_t * ptr, uint16_t ptrSize, uint32_t maxDelayUs);
+	void flush();
+#endif
+
+#ifdef AMULET_LATENCY
+	void setLatencyPointer(AmuletLatency * ptr, uint8_t ptrSize);
+	void setLatencyHook(latencyHook hook);
+	uint8_t latencyStats(uint8_t opcode, uint8_t stage, uint32_t * minUs, uint32_t * avgUs, uint32_t * maxUs, uint32_t * p99Us);
+	void resetLatency();
+#endif
+	
+#if !defined(AMULET_NO_LINKTEST) && !defined(AMULET_NO_WORDS)
+	uint8_t linkTest(AmuletLinkTest * result, uint16_t start, uint8_t rounds, const char * pingScript);
+#endif
 	
     uint32_t readError();
+	uint32_t retryCount();
+	uint32_t crcErrorCount();
+	uint32_t framesReceived();
+#ifndef AMULET_NO_REPLY_CACHE
+	uint32_t replyCacheHits();
+	uint32_t replyCacheMisses();
+#endif
     void serialEvent();
+	uint8_t poll(uint32_t maxMicros, uint8_t maxFrames);
+	int backlog();
 	
     private:
         //Virtual Dual Port RAM arrays:
+#ifndef AMULET_NO_BYTES
         uint8_t * _Bytes; 
         uint16_t _BytesLength;    //max length = 32768
+#endif
+#ifndef AMULET_NO_WORDS
         uint16_t * _Words;
         uint16_t _WordsLength;   //max length = 32768
+#endif
+#ifndef AMULET_NO_COLORS
         uint32_t * _Colors;
         uint16_t _ColorsLength;  //max length = 32768
+#endif
+#ifndef AMULET_NO_RPC
 		RPC_Entry * _RPCs;
 		uint16_t _RPCsLength;    //max length = 256
+#endif
+#ifndef AMULET_NO_REPLY_CACHE
+		AmuletReply * _ReplyCache;
+		uint8_t _ReplyCacheLength;
+		uint32_t _replyCacheHits;
+		uint32_t _replyCacheMisses;
+#endif
+#ifndef AMULET_NO_POLLING
+		AmuletPoll * _Polls;
+		uint8_t _PollsLength;
+		uint8_t _pollBudget;     //percent of the link the scheduler may use
+		uint32_t _pollTokens;    //bytes x 1000 the scheduler may send now
+		uint32_t _pollRefill;    //millis() of the last token refill
+#endif
+#ifndef AMULET_NO_FETCH
+		uint32_t * _ByteStamps;  //millis() each variable was last refreshed, see setStampPointers
+		uint32_t * _WordStamps;
+		uint32_t * _ColorStamps;
+#endif
+		volatile amulet_seq_t * _ByteSeq;  //odd while the parser is writing to the bank, see setSeqPointers
+		volatile amulet_seq_t * _WordSeq;
+		volatile amulet_seq_t * _ColorSeq;
+		volatile amulet_seq_t _seqs[3];     //where they point unless setSeqPointers moved them
 		
+#ifdef AMULET_NO_EXTENDED_ADDRESS
+		static const uint8_t _ea = 0; // extended address, fixed so the compiler folds it away
+#else
 		uint8_t   _ea; // extended address
+#endif
 		uint32_t  _Timeout_ms;
 		uint8_t   _retries;
         uint32_t  _baud;
+#ifndef AMULET_NO_AUTOBAUD
+		uint32_t  _baseBaud;       //rate negotiateBaud started from, the last fallback
+		const uint32_t * _baudRates;
+		uint8_t   _baudRateCount;
+		baudCallback _baudChange;  //NULL until negotiateBaud, which disables the fallback
+		uint8_t   _baudFallback;   //percent of timed out commands that makes the link step down
+		uint8_t   _baudStepDown;   //set when the last window crossed _baudFallback
+		uint8_t   _blockingDepth;  //nested send_command_blocking calls, e.g. from an RPC
+		uint16_t  _linkFrames;     //blocking commands sent in the current window, including retries
+		uint16_t  _linkTimeouts;
+#endif
+#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+		uint8_t   _linkFailLimit;  //tries in a row that time out before the link is down, 0 for no monitor
+		uint8_t   _linkFailures;   //tries that timed out since the last valid frame
+		uint8_t   _linkDown;
+		uint8_t   _linkHeard;      //a valid frame arrived while the link was down
+		uint8_t   _linkChecking;   //set while checkLink probes, so its Get goes out while the link is down and its reply is not stored
+		uint16_t  _heartbeatMs;
+		uint32_t  _linkActive;     //clockMillis() of the last valid frame, or of the last probe while down
+		linkHook  _linkHook;
+#endif
+#ifndef AMULET_NO_IDLE
+		idleHook  _idleHook;
+		uint8_t   _idleSleep;      //sleep until the next interrupt while waiting, AVR only
+		uint8_t   _inIdle;         //set while _idleHook runs, so it is not called again from inside
+#endif
+#ifndef AMULET_NO_CLOCK
+		clockSource _millis;       //millis and micros unless setClock says otherwise
+		clockSource _micros;
+#endif
+#ifndef AMULET_NO_TX_BATCH
+		uint8_t * _TxBatch;        //frames of non-blocking commands waiting to be written together
+		uint16_t  _TxBatchSize;
+		uint16_t  _TxBatchLength;
+		uint32_t  _TxBatchDelay;   //us the first frame may wait, 0 for no limit
+		uint32_t  _TxBatchStart;   //clockMicros() when the first frame was added
+#endif
 		uint8_t   _config;
 		uint32_t  _errorCount;
+		uint32_t  _retryCount;     //blocking commands sent again after a timeout
+		uint32_t  _crcErrors;      //frames received with a bad CRC
+		uint32_t  _rxFrames;       //frames received, good or bad
 		uint32_t  _lastError;
 		uint8_t   _reply;
+#ifndef AMULET_NO_GEMSCRIPT
         int32_t   _scriptReply;
+#endif
+#ifndef AMULET_NO_STRINGS
 		uint8_t * _GetStringDest;
 		uint16_t  _GetStringLen;
+#endif
         
+#ifndef AMULET_NO_BYTES
 		volatile uint8_t _GetByteReply;
-		volatile uint8_t _GetWordReply;
-		volatile uint8_t _GetColorReply;
-		volatile uint8_t _GetStringReply;
-		volatile uint8_t _GetBytesReply;
-		volatile uint8_t _GetWordsReply;
-		volatile uint8_t _GetColorsReply;
-		
 		volatile uint8_t _SetByteReply;
-		volatile uint8_t _SetWordReply;
-		volatile uint8_t _SetColorReply;
-		volatile uint8_t _SetStringReply;
+#ifndef AMULET_NO_ARRAYS
+		volatile uint8_t _GetBytesReply;
 		volatile uint8_t _SetBytesReply;
+#endif
+#endif
+#ifndef AMULET_NO_WORDS
+		volatile uint8_t _GetWordReply;
+		volatile uint8_t _SetWordReply;
+#ifndef AMULET_NO_ARRAYS
+		volatile uint8_t _GetWordsReply;
 		volatile uint8_t _SetWordsReply;
+#endif
+#endif
+#ifndef AMULET_NO_COLORS
+		volatile uint8_t _GetColorReply;
+		volatile uint8_t _SetColorReply;
+#ifndef AMULET_NO_ARRAYS
+		volatile uint8_t _GetColorsReply;
 		volatile uint8_t _SetColorsReply;
+#endif
+#endif
+#ifndef AMULET_NO_STRINGS
+		volatile uint8_t _GetStringReply;
+		volatile uint8_t _SetStringReply;
+#endif
+#ifndef AMULET_NO_GEMSCRIPT
 		volatile uint8_t _InvokeGEMscriptReply;
+#endif
 
-        uint8_t _RxBuffer[AMULET_RX_BUF_LEN];
-        uint8_t _TxBuffer[AMULET_TX_BUF_LEN];
+        uint8_t * _RxBuffer;
+        uint8_t * _TxBuffer;     //long master frames are built here. May be shared, see begin.
+        uint16_t _RxBufferSize;
+        uint16_t _TxBufferSize;
         uint16_t _RxBufferLength;
-		uint16_t _TxBufferLength;
+#ifndef AMULET_NO_BUILTIN_BUFFERS
+        uint8_t _RxStorage[AMULET_RX_BUF_LEN];
+        uint8_t _TxStorage[AMULET_TX_BUF_LEN];
+#endif
         uint16_t _UART_State;
+#ifdef AMULET_LATENCY
+		uint32_t _stamps[AMULET_STAMPS];
+		AmuletLatency * _Latency;
+		uint8_t _LatencyLength;
+		latencyHook _latencyHook;
+#endif
 		
 		uint8_t send_command_blocking(uint8_t * command, uint16_t length);
+		uint8_t send_command_attempts(uint8_t * command, uint16_t length);
+#ifndef AMULET_NO_IDLE
+		void idle();
+#endif
+#if !defined(AMULET_NO_LINK_MONITOR) && !defined(AMULET_NO_IMAGE)
+		void linkLost();
+		uint8_t linkProbe();
+#endif
+		uint32_t clockMillis();
+		uint32_t clockMicros();
+		void writeFrame(uint8_t * frame, uint16_t length, uint8_t now);
+#ifndef AMULET_NO_TX_BATCH
+		void flushIfDue();
+#endif
+#ifndef AMULET_NO_AUTOBAUD
+		void setRate(uint32_t baud);
+		uint8_t verifyLink();
+		uint8_t tryBaud(baudCallback change, uint32_t baud);
+		void stepDownBaud();
+#endif
         uint16_t calcCRC(uint8_t *ptr, uint16_t count);
+        uint16_t updateCRC(uint16_t crc, uint8_t *ptr, uint16_t count);
 		void appendCRC(uint8_t *ptr, uint16_t count);
         void setup();                    // run once, when the sketch starts    
         void CRC_State_Machine(uint8_t b);
+        void storeRx(uint8_t b);
         int8_t recieve_OpcodeParser(uint8_t b);    
         boolean checkCRC(uint8_t *buf, uint16_t bufLen);
         void processUARTCommand(uint8_t *buf, uint16_t bufLen);
         void SetCmd_Reply(uint8_t OPCODE);
+		void writeReply(uint8_t * frame, uint8_t length);
+#ifdef AMULET_LATENCY
+		void recordLatency(uint8_t opcode);
+#endif
+#ifndef AMULET_NO_RPC
 		void callRPC(uint8_t index);
+#endif
+		uint8_t prepareFrame(AmuletCommand * cmd, uint8_t opcode, uint16_t loc, int16_t count, uint8_t payloadLength);
+		void resetReply(uint8_t opcode);
+		uint8_t sendCachedReply(uint8_t opcode, uint16_t loc);
+		void cacheReply(uint8_t *buf, uint8_t length, uint16_t loc);
+		void invalidateReplies(uint8_t opcode, uint16_t start, uint16_t count);
+		void beginWrite(uint8_t bank);
+		void valuesChanged(uint8_t bank, uint16_t start, uint16_t count);
+		volatile amulet_seq_t * bankSeq(uint8_t bank);
+		amulet_seq_t readBegin(uint8_t bank);
+		uint8_t readRetry(uint8_t bank, amulet_seq_t seq);
+		uint8_t snapshot(uint8_t bank, uint16_t start, uint16_t count, void * dest);
+#ifndef AMULET_NO_ARRAYS
+		int8_t sendArray(uint8_t opcode, uint16_t start, uint8_t count, uint8_t waitForResponse);
+#endif
+#ifndef AMULET_NO_FETCH
+		uint8_t refreshStale(uint8_t bank, uint16_t start, uint16_t count, uint16_t maxAgeMs, uint8_t spread);
+		uint32_t * bankStamps(uint8_t bank);
+#endif
+		uint8_t requestRange(uint8_t bank, uint16_t start, uint8_t count);
+#ifndef AMULET_NO_IMAGE
+		uint8_t sendRange(uint8_t bank, uint16_t start, uint8_t count);
+		uint8_t imageMatches(imageRead read, AmuletImageHeader * header);
+#endif
+		uint8_t * bankData(uint8_t bank);
+		uint8_t bankWidth(uint8_t bank);
+		uint16_t bankLength(uint8_t bank);
+		uint8_t maxArrayCount(uint8_t bank);
 		void setError();
     
 };
@@ -207,4 +775,22 @@ class AmuletLCD
 #define _CRC_SEED                0xFFFF
 #define _CRC_POLY                0xA001
 
+/**
+* One bit of the MODBUS CRC, shared by the compile-time and run-time versions.
+*/
+constexpr uint16_t amuletCRCBit(uint16_t crc){
+	return (crc & 0x0001) ? ((crc >> 1) ^ _CRC_POLY) : (crc >> 1);
+}
+
+/**
+* Compile-time version of calcCRC, used to build constant frames.
+* amuletCRCShift runs the remaining bits of one byte, amuletCRCByte folds in the next byte.
+*/
+constexpr uint16_t amuletCRCShift(uint16_t crc, uint8_t bits){
+	return (bits == 0) ? crc : amuletCRCShift(amuletCRCBit(crc), bits - 1);
+}
+constexpr uint16_t amuletCRCByte(uint16_t crc, uint8_t b){
+	return amuletCRCShift(crc ^ b, 8);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,225 @@
+/*
+  AmuletVar.h - Compile-time typed handles for Amulet Virtual Dual Port variables
+  Copyright (c) 2017 Amulet Technologies. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  AmuletLink fixes the address size and the local array sizes at compile time.
+  AmuletVar handles then fold the address bytes, the bounds check and the CRC of
+  the fixed part of every frame into constants, instead of branching on _ea and
+  checking _BytesLength/_WordsLength/_ColorsLength on each call.
+
+  Example:
+    typedef AmuletLink<0, 0, 4, 0> MyLink;  //1 address byte, 4 words
+    uint16_t AmuletWords[4];
+    MyLink myModule;
+    MyLink::Word<2> pot(myModule);          //MyLink::Word<4> would not compile
+    ...
+    myModule.begin(115200);
+    myModule.setWordPointer(AmuletWords);   //array size checked against the link
+    pot.set(analogRead(0), false);
+
+  Headers generated by extras/tools/gemp_bindings.py declare AmuletVDPLink sized for the project.
+ */
+
+#ifndef AmuletVar_h
+#define AmuletVar_h
+
+#include "AmuletLCD.h"
+
+/**
+* Bank tags used by AmuletVar to select the Byte, Word or Color variables.
+*/
+struct AmuletByteBank  { typedef uint8_t  type; enum { get = _GET_BYTE,  set = _SET_BYTE,  width = 1 }; };
+struct AmuletWordBank  { typedef uint16_t type; enum { get = _GET_WORD,  set = _SET_WORD,  width = 2 }; };
+struct AmuletColorBank { typedef uint32_t type; enum { get = _GET_COLOR, set = _SET_COLOR, width = 4 }; };
+
+/**
+* An AmuletLCD whose address size and local array sizes are fixed at compile time.
+* @tparam EA 0 for 1 address byte, 1 for 2 address bytes. See AmuletLCD::begin.
+* @tparam BYTES, WORDS, COLORS the number of variables in each local array
+*/
+template <uint8_t EA, uint16_t BYTES, uint16_t WORDS, uint16_t COLORS>
+class AmuletLink : public AmuletLCD
+{
+	static_assert(EA == 0 || EA == 1, "EA must be 0 or 1");
+	static_assert(EA || (BYTES <= 256 && WORDS <= 256 && COLORS <= 256), "more than 256 variables needs EA = 1");
+#ifdef AMULET_NO_EXTENDED_ADDRESS
+	static_assert(EA == 0, "EA = 1 needs the library built without AMULET_NO_EXTENDED_ADDRESS");
+#endif
+  public:
+	static const uint8_t ea = EA;
+	static constexpr uint16_t size(uint8_t getOpcode){
+		return (getOpcode == _GET_BYTE) ? BYTES : (getOpcode == _GET_WORD) ? WORDS : COLORS;
+	}
+
+#ifndef AMULET_NO_BYTES
+	template <uint16_t Index> using Byte  = AmuletVar<AmuletLink, AmuletByteBank,  Index>;
+#endif
+#ifndef AMULET_NO_WORDS
+	template <uint16_t Index> using Word  = AmuletVar<AmuletLink, AmuletWordBank,  Index>;
+#endif
+#ifndef AMULET_NO_COLORS
+	template <uint16_t Index> using Color = AmuletVar<AmuletLink, AmuletColorBank, Index>;
+#endif
+
+#ifndef AMULET_NO_BUILTIN_BUFFERS
+	void begin(uint32_t baud){
+		AmuletLCD::begin(baud, SERIAL_8N1, EA);
+	}
+	void begin(uint32_t baud, uint8_t config){
+		AmuletLCD::begin(baud, config, EA);
+	}
+#endif
+	// Buffers owned by the sketch, see AmuletLCD::begin. A buffer that is too short is a compile error.
+	template <uint16_t R, uint16_t T> void begin(uint32_t baud, uint8_t config, uint8_t (&rxBuffer)[R], uint8_t (&txBuffer)[T]){
+		static_assert(R >= AMULET_MIN_RX_LEN, "receive buffer is shorter than AMULET_MIN_RX_LEN");
+		static_assert(T >= AMULET_MIN_TX_LEN, "transmit buffer is shorter than AMULET_MIN_TX_LEN");
+		AmuletLCD::begin(baud, config, EA, rxBuffer, R, txBuffer, T);
+	}
+
+	// Arrays are taken by reference, so a local array smaller than the link is a compile error.
+#ifndef AMULET_NO_BYTES
+	template <uint16_t N> void setBytePointer(uint8_t (&ptr)[N]){
+		static_assert(N >= BYTES, "byte array is smaller than the link");
+		AmuletLCD::setBytePointer(ptr, N);
+	}
+#endif
+#ifndef AMULET_NO_WORDS
+	template <uint16_t N> void setWordPointer(uint16_t (&ptr)[N]){
+		static_assert(N >= WORDS, "word array is smaller than the link");
+		AmuletLCD::setWordPointer(ptr, N);
+	}
+#endif
+#ifndef AMULET_NO_COLORS
+	template <uint16_t N> void setColorPointer(uint32_t (&ptr)[N]){
+		static_assert(N >= COLORS, "color array is smaller than the link");
+		AmuletLCD::setColorPointer(ptr, N);
+	}
+#endif
+};
+
+/**
+* Handle to one Amulet variable. Address bytes and bounds are checked at compile time.
+* @tparam Link the AmuletLink the variable is reached through
+* @tparam Bank AmuletByteBank, AmuletWordBank or AmuletColorBank
+* @tparam Index the index into the Amulet and local array
+*/
+template <class Link, class Bank, uint16_t Index>
+class AmuletVar
+{
+	static_assert(Index < Link::size(Bank::get), "index is outside the local array of the link");
+	static_assert(Link::ea || Index <= 0xFF, "index needs extended addressing");
+
+	// Frame layout: slave addr, opcode, 1 or 2 address bytes, payload, 2-byte CRC
+	static const uint8_t addr = 2;
+	static const uint8_t payload = addr + 1 + Link::ea;
+	static const uint8_t setLength = payload + Bank::width + 2;
+	static const uint8_t requestLength = payload + 2;
+	static constexpr uint16_t headerCRC(uint8_t opcode){
+		return Link::ea ? amuletCRCByte(amuletCRCByte(amuletCRCByte(amuletCRCByte(_CRC_SEED, _AMULET_ADDRESS), opcode), Index >> 8), Index & 0xFF)
+		                : amuletCRCByte(amuletCRCByte(amuletCRCByte(_CRC_SEED, _AMULET_ADDRESS), opcode), Index & 0xFF);
+	}
+
+#ifndef AMULET_NO_BYTES
+	static uint8_t  * data(AmuletLCD & lcd, AmuletByteBank)  { return lcd._Bytes; }
+#endif
+#ifndef AMULET_NO_WORDS
+	static uint16_t * data(AmuletLCD & lcd, AmuletWordBank)  { return lcd._Words; }
+#endif
+#ifndef AMULET_NO_COLORS
+	static uint32_t * data(AmuletLCD & lcd, AmuletColorBank) { return lcd._Colors; }
+#endif
+
+	static void header(uint8_t * command, uint8_t opcode){
+		command[0] = _AMULET_ADDRESS;
+		command[1] = opcode;
+		if (Link::ea)
+			command[addr] = (uint8_t)(Index >> 8);
+		command[payload-1] = (uint8_t)(Index & 0xFF);
+	}
+
+	Link & _lcd;
+
+  public:
+	typedef typename Bank::type type;
+	static const uint16_t index = Index;
+
+	AmuletVar(Link & lcd) : _lcd(lcd) {}
+
+	/**
+	* Read the variable from the local array, which may or may not match the state of Amulet InternalRAM.
+	* @return the value of the local copy
+	*/
+	type get() const {
+		type value;
+		amulet_seq_t seq;
+		do {
+			seq = _lcd.readBegin(Bank::get);
+			value = data(_lcd, Bank())[Index];
+		} while (_lcd.readRetry(Bank::get, seq));
+		return value;
+	}
+
+	/**
+	* Send out a serial command to set the variable in Amulet InternalRAM.
+	* @param value the value to set
+	* @param waitForResponse true will block until response is received or timeout occurs
+	* @return int8_t true if correct response was received or skipped, false otherwise
+	*/
+	int8_t set(type value, uint8_t waitForResponse = true){
+		uint8_t command[setLength];
+		header(command, Bank::set);
+		for (uint8_t i = Bank::width; i > 0; i--){  //MSB first for data
+			command[payload + i - 1] = (uint8_t)(value & 0xFF);
+			value >>= 8;
+		}
+		constexpr uint16_t prefixCRC = headerCRC(Bank::set);
+		uint16_t CRC = _lcd.updateCRC(prefixCRC, command + payload, Bank::width);
+		command[setLength-2] = CRC & 0xFF;
+		command[setLength-1] = (CRC >> 8) & 0xFF;
+		if(Serial.availableForWrite() >= setLength){
+			if (waitForResponse){
+				_lcd.resetReply(Bank::set);
+				return _lcd.send_command_blocking(command, setLength);
+			}
+			_lcd.writeFrame(command, setLength, false);  //behind any frames batched before it
+			return true;
+		}
+		_lcd.setError();
+		return false;
+	}
+
+	/**
+	* Request the variable from Amulet Display, and wait for a response.
+	* The whole frame, including CRC, is a compile-time constant.
+	* @return uint8_t true if correct response was received, false otherwise
+	*/
+	uint8_t request(){
+		constexpr uint16_t CRC = headerCRC(Bank::get);
+		uint8_t command[requestLength];
+		header(command, Bank::get);
+		command[requestLength-2] = CRC & 0xFF;
+		command[requestLength-1] = (CRC >> 8) & 0xFF;
+		if(Serial.availableForWrite() >= requestLength){
+			_lcd.resetReply(Bank::get);
+			return _lcd.send_command_blocking(command, requestLength);
+		}
+		_lcd.setError();
+		return false;
+	}
+};
+
+#endif